@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "arena.h"
+
+static void* arenaReallocate(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize);
+
+#define ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+/* The header is padded so the data behind it stays aligned */
+#define BLOCK_HEADER_SIZE ALIGN(sizeof(ArenaBlock))
+#define BLOCK_DATA(block) ((char*)(block) + BLOCK_HEADER_SIZE)
+
+void initArena(Arena* arena, Allocator* parent)
+{
+    arena->allocator.reallocate = arenaReallocate;
+    arena->allocator.userData = NULL;
+    memset(&(arena->allocator.stats), 0, sizeof(MemoryStats));
+    arena->parent = parent;
+    arena->blocks = NULL;
+    arena->last = NULL;
+    arena->lastSize = 0;
+}
+
+static ArenaBlock* newBlock(Arena* arena, size_t capacity)
+{
+    ArenaBlock* block = reallocateWith(arena->parent, MEM_ARENA, NULL, 0, BLOCK_HEADER_SIZE + capacity);
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+void* arenaAllocate(Arena* arena, size_t size)
+{
+    size = ALIGN(size);
+    ArenaBlock* head = arena->blocks;
+
+    if (head == NULL || head->used + size > head->capacity)
+    {
+        if (size > ARENA_BLOCK_SIZE / 4)
+        {
+            /*
+                Big one: give it its own block and slot it in behind the head,
+                so the head keeps serving small requests
+            */
+            ArenaBlock* block = newBlock(arena, size);
+            block->used = size;
+            if (head == NULL)
+            {
+                block->next = NULL;
+                arena->blocks = block;
+            }
+            else
+            {
+                block->next = head->next;
+                head->next = block;
+            }
+            arena->last = NULL;
+            arena->lastSize = 0;
+            return BLOCK_DATA(block);
+        }
+
+        ArenaBlock* block = newBlock(arena, ARENA_BLOCK_SIZE);
+        block->next = head;
+        arena->blocks = block;
+        head = block;
+    }
+
+    void* result = BLOCK_DATA(head) + head->used;
+    head->used += size;
+    arena->last = result;
+    arena->lastSize = size;
+    return result;
+}
+
+static void* arenaReallocate(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize)
+{
+    /* allocator is the first member of the Arena */
+    Arena* arena = (Arena*)allocator;
+    ArenaBlock* head = arena->blocks;
+
+    if (pointer != NULL && pointer == arena->last)
+    {
+        /* Most recent allocation: move the bump pointer instead of copying (frees roll it back) */
+        size_t grown = ALIGN(newSize);
+        if (head->used - arena->lastSize + grown <= head->capacity)
+        {
+            head->used = head->used - arena->lastSize + grown;
+            arena->lastSize = grown;
+            if (newSize == 0)
+            {
+                arena->last = NULL;
+                return NULL;
+            }
+            return pointer;
+        }
+    }
+
+    if (newSize == 0)
+    {
+        /* Everything else is only given back by resetArena() */
+        return NULL;
+    }
+
+    void* result = arenaAllocate(arena, newSize);
+    if (pointer != NULL)
+    {
+        memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+    }
+    return result;
+}
+
+void resetArena(Arena* arena)
+{
+    ArenaBlock* keep = NULL;
+    ArenaBlock* block = arena->blocks;
+    while (block != NULL)
+    {
+        ArenaBlock* next = block->next;
+        if (keep == NULL && block->capacity == ARENA_BLOCK_SIZE)
+        {
+            keep = block;
+        }
+        else
+        {
+            reallocateWith(arena->parent, MEM_ARENA, block, BLOCK_HEADER_SIZE + block->capacity, 0);
+        }
+        block = next;
+    }
+
+    if (keep != NULL)
+    {
+        keep->used = 0;
+        keep->next = NULL;
+    }
+    arena->blocks = keep;
+    arena->last = NULL;
+    arena->lastSize = 0;
+    /* Nothing allocated from the arena is alive any more, peaks and counts stay */
+    resetMemoryStats(&(arena->allocator.stats));
+}
+
+void freeArena(Arena* arena)
+{
+    resetArena(arena);
+    if (arena->blocks != NULL)
+    {
+        reallocateWith(arena->parent, MEM_ARENA, arena->blocks, BLOCK_HEADER_SIZE + arena->blocks->capacity, 0);
+    }
+    initArena(arena, arena->parent);
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef clox_arena_h
+#define clox_arena_h
+
+#include "common.h"
+#include "memory.h"
+
+/* Regular block size, bigger requests get a block of their own */
+#define ARENA_BLOCK_SIZE    0x10000
+#define ARENA_ALIGNMENT     16
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+} ArenaBlock;
+
+/*
+    Bump-pointer allocator for everything that lives exactly as long as one compile
+    (code, constants, and whatever else the compiler grows later).
+    It IS an Allocator (first member), so a Chunk can be pointed at it with initChunkWith(&chunk, &arena.allocator).
+    Freeing single blocks is a no-op (except for the last one), resetArena() drops everything at once
+*/
+typedef struct
+{
+    Allocator allocator;
+    /* Blocks come from here */
+    Allocator* parent;
+    /* Head is the block we bump from */
+    ArenaBlock* blocks;
+    /* The most recent allocation can grow and shrink in place */
+    void* last;
+    size_t lastSize;
+} Arena;
+
+void initArena(Arena* arena, Allocator* parent);
+void* arenaAllocate(Arena* arena, size_t size);
+/* Forget every allocation, keeps one regular block around so the next compile doesn't malloc() */
+void resetArena(Arena* arena);
+void freeArena(Arena* arena);
+
+#endif
\ No newline at end of file
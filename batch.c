@@ -0,0 +1,287 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "vm.h"
+
+/* What popJob() and stealJob() return instead of a job index */
+#define JOB_EMPTY   -1
+/* Lost a race for the last job, worth another look */
+#define JOB_ABORT   -2
+
+/*
+    Chase-Lev deque of job indices: the owner pushes and pops at the bottom, thieves take from the top.
+    Only the fight for the very last job needs a CAS. All jobs are pushed before the workers start
+    and nobody pushes afterwards, so the array never wraps or grows
+*/
+typedef struct
+{
+    atomic_long top;
+    atomic_long bottom;
+    atomic_int* jobs;
+    long capacity;
+} WorkDeque;
+
+typedef struct Batch Batch;
+
+typedef struct
+{
+    Batch* batch;
+    pthread_t thread;
+    WorkDeque deque;
+    uint64_t steals;
+    /* xorshift state for picking victims */
+    uint32_t seed;
+} Worker;
+
+struct Batch
+{
+    BatchJob* jobs;
+    Worker* workers;
+    int workerCount;
+    size_t cacheLimit;
+};
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void pushJob(WorkDeque* deque, int job)
+{
+    long bottom = atomic_load_explicit(&(deque->bottom), memory_order_relaxed);
+    atomic_store_explicit(&(deque->jobs[bottom]), job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&(deque->bottom), bottom + 1, memory_order_relaxed);
+}
+
+static int popJob(WorkDeque* deque)
+{
+    long bottom = atomic_load_explicit(&(deque->bottom), memory_order_relaxed) - 1;
+    atomic_store_explicit(&(deque->bottom), bottom, memory_order_relaxed);
+    /* Thieves must see the smaller bottom before we look at top */
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&(deque->top), memory_order_relaxed);
+
+    int job = JOB_EMPTY;
+    if (top <= bottom)
+    {
+        job = atomic_load_explicit(&(deque->jobs[bottom]), memory_order_relaxed);
+        if (top == bottom)
+        {
+            /* The last one, a thief may be after it too */
+            if (!atomic_compare_exchange_strong_explicit(&(deque->top), &top, top + 1,
+                                                         memory_order_seq_cst, memory_order_relaxed))
+            {
+                job = JOB_EMPTY;
+            }
+            atomic_store_explicit(&(deque->bottom), bottom + 1, memory_order_relaxed);
+        }
+    }
+    else
+    {
+        atomic_store_explicit(&(deque->bottom), bottom + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+static int stealJob(WorkDeque* deque)
+{
+    long top = atomic_load_explicit(&(deque->top), memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&(deque->bottom), memory_order_acquire);
+    if (top >= bottom)
+    {
+        return JOB_EMPTY;
+    }
+    int job = atomic_load_explicit(&(deque->jobs[top]), memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&(deque->top), &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+    {
+        return JOB_ABORT;
+    }
+    return job;
+}
+
+/* Nobody adds jobs once the batch runs, so once every deque was seen empty (and no steal was lost) we are done */
+static int findWork(Worker* self)
+{
+    Batch* batch = self->batch;
+    while (1)
+    {
+        bool lost = false;
+        self->seed ^= self->seed << 13;
+        self->seed ^= self->seed >> 17;
+        self->seed ^= self->seed << 5;
+        int first = (int)(self->seed % (uint32_t)batch->workerCount);
+        for (int i = 0; i < batch->workerCount; i++)
+        {
+            Worker* victim = &(batch->workers[(first + i) % batch->workerCount]);
+            if (victim == self)
+            {
+                continue;
+            }
+            int job = stealJob(&(victim->deque));
+            if (job >= 0)
+            {
+                self->steals++;
+                return job;
+            }
+            lost |= job == JOB_ABORT;
+        }
+        if (!lost)
+        {
+            return JOB_EMPTY;
+        }
+    }
+}
+
+static InterpreterResult runScript(VM* vm, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return INTERPRET_COMPILER_ERROR;
+    }
+
+    /* Same as runFile(): map regular files, stream the rest */
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0 && S_ISREG(fileStat.st_mode) && fileStat.st_size > 0)
+    {
+        size_t fileSize = (size_t)fileStat.st_size;
+        void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            close(fd);
+            InterpreterResult result = interpretWith(vm, (const char*)mapping, fileSize);
+            munmap(mapping, fileSize);
+            return result;
+        }
+    }
+
+    InterpreterResult result = interpretStreamWith(vm, fd);
+    close(fd);
+    return result;
+}
+
+static void runJob(VM* vm, BatchJob* job)
+{
+    double start = seconds();
+
+    /* The VM's output goes to a buffer of the job's own */
+    FILE* stream = open_memstream(&(job->output), &(job->outputLength));
+    if (stream == NULL)
+    {
+        fprintf(stderr, "Out of memory running \"%s\".\n", job->path);
+        job->ok = false;
+        return;
+    }
+    initOutput(&(vm->out), stream);
+
+    InterpreterResult result = runScript(vm, job->path);
+    if (result == INTERPRET_OK)
+    {
+        printValue(vm, &(vm->out), vm->result);
+        writeOutputChar(&(vm->out), '\n');
+    }
+    flushOutput(&(vm->out));
+    fclose(stream);
+    /* Never left pointing at a closed stream, freeVMWith() flushes it */
+    initOutput(&(vm->out), stdout);
+
+    job->ok = result == INTERPRET_OK;
+    job->seconds = seconds() - start;
+}
+
+static void* work(void* argument)
+{
+    Worker* self = argument;
+    VM vm;
+    initVMWith(&vm);
+    setChunkCacheLimit(&(vm.chunkCache), self->batch->cacheLimit);
+
+    while (1)
+    {
+        int job = popJob(&(self->deque));
+        if (job == JOB_EMPTY)
+        {
+            job = findWork(self);
+        }
+        if (job == JOB_EMPTY)
+        {
+            break;
+        }
+        runJob(&vm, &(self->batch->jobs[job]));
+        if (vm.error.kind == ERROR_OUT_OF_MEMORY)
+        {
+            /* Can't be trusted anymore, the rest of the jobs get a fresh one */
+            freeVMWith(&vm);
+            initVMWith(&vm);
+            setChunkCacheLimit(&(vm.chunkCache), self->batch->cacheLimit);
+        }
+    }
+
+    freeVMWith(&vm);
+    return NULL;
+}
+
+BatchStats runBatch(BatchJob* jobs, int jobCount, int workerCount, size_t cacheLimit)
+{
+    BatchStats stats = { 0, 0, 0 };
+    double start = seconds();
+
+    Batch batch;
+    batch.jobs = jobs;
+    batch.workerCount = workerCount;
+    batch.cacheLimit = cacheLimit;
+    batch.workers = calloc((size_t)workerCount, sizeof(Worker));
+    long capacity = (jobCount + workerCount - 1) / workerCount;
+    for (int i = 0; i < workerCount; i++)
+    {
+        Worker* worker = &(batch.workers[i]);
+        worker->batch = &batch;
+        worker->seed = 2463534242u + (uint32_t)i * 2654435761u;
+        atomic_init(&(worker->deque.top), 0);
+        atomic_init(&(worker->deque.bottom), 0);
+        worker->deque.capacity = capacity;
+        worker->deque.jobs = calloc((size_t)(capacity > 0 ? capacity : 1), sizeof(atomic_int));
+    }
+
+    /* Round robin, pushed backwards so each worker's own next job is its lowest one, thieves take the highest */
+    for (int job = jobCount - 1; job >= 0; job--)
+    {
+        jobs[job].output = NULL;
+        jobs[job].outputLength = 0;
+        jobs[job].ok = false;
+        jobs[job].seconds = 0;
+        pushJob(&(batch.workers[job % workerCount].deque), job);
+    }
+
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_create(&(batch.workers[i].thread), NULL, work, &(batch.workers[i]));
+    }
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_join(batch.workers[i].thread, NULL);
+        stats.steals += batch.workers[i].steals;
+        free(batch.workers[i].deque.jobs);
+    }
+    free(batch.workers);
+
+    for (int i = 0; i < jobCount; i++)
+    {
+        stats.failed += jobs[i].ok ? 0 : 1;
+    }
+    stats.seconds = seconds() - start;
+    return stats;
+}
\ No newline at end of file
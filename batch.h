@@ -0,0 +1,33 @@
+#ifndef clox_batch_h
+#define clox_batch_h
+
+#include "common.h"
+
+/* One script of a batch, filled in by runBatch() */
+typedef struct
+{
+    const char* path;
+    /* Everything the script printed, result included. malloc()'ed, the caller frees it */
+    char* output;
+    size_t outputLength;
+    bool ok;
+    /* Wall time of this script alone, reading it included */
+    double seconds;
+} BatchJob;
+
+typedef struct
+{
+    double seconds;
+    /* Scripts a worker took from another worker's deque */
+    uint64_t steals;
+    int failed;
+} BatchStats;
+
+/*
+    Run every job's script on a pool of workerCount threads, each with a VM of its own.
+    Jobs are dealt out round robin, a worker that runs dry steals from the others.
+    Outputs are collected per job, so the caller can print them in order however they were scheduled
+*/
+BatchStats runBatch(BatchJob* jobs, int jobCount, int workerCount, size_t cacheLimit);
+
+#endif
\ No newline at end of file
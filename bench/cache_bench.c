@@ -0,0 +1,87 @@
+/*
+    Repeated rule evaluation: a hundred rules, each interpret()'ed over and over in turn,
+    with the chunk cache off (scan and compile every time) and on. Both must compute the same results.
+
+    USAGE: ./bench/cache_bench [rules] [evaluations]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../vm.h"
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* About forty terms each, like a real scoring rule */
+static char* makeRule(int index)
+{
+    size_t capacity = 1024;
+    char* rule = malloc(capacity);
+    size_t length = (size_t)snprintf(rule, capacity, "%d.5", index);
+    for (int term = 1; term < 40; term++)
+    {
+        const char* op = (term % 4 == 0) ? "-" : (term % 4 == 1) ? "+" : (term % 4 == 2) ? "*" : "/";
+        length += (size_t)snprintf(rule + length, capacity - length, " %s (%d + %d.25)", op, term, index % 7 + 1);
+    }
+    return rule;
+}
+
+static double evaluate(char** rules, int ruleCount, long evaluations, double* checksum)
+{
+    *checksum = 0;
+    double start = seconds();
+    for (long i = 0; i < evaluations; i++)
+    {
+        const char* rule = rules[i % ruleCount];
+        if (interpret(rule, strlen(rule)) != INTERPRET_OK)
+        {
+            fprintf(stderr, "Rule %ld failed.\n", i % ruleCount);
+            exit(1);
+        }
+        *checksum += AS_NUMBER(vm.result);
+    }
+    return seconds() - start;
+}
+
+int main(int argc, const char* argv[])
+{
+    int ruleCount = argc > 1 ? atoi(argv[1]) : 100;
+    long evaluations = argc > 2 ? atol(argv[2]) : 200000;
+
+    initVM();
+    char** rules = malloc(sizeof(char*) * ruleCount);
+    for (int i = 0; i < ruleCount; i++)
+    {
+        rules[i] = makeRule(i);
+    }
+
+    double uncachedSum, cachedSum;
+    setChunkCacheLimit(&vm.chunkCache, 0);
+    double uncached = evaluate(rules, ruleCount, evaluations, &uncachedSum);
+    setChunkCacheLimit(&vm.chunkCache, CHUNK_CACHE_DEFAULT_LIMIT);
+    double cached = evaluate(rules, ruleCount, evaluations, &cachedSum);
+
+    printf("%d rules, %ld evaluations\n", ruleCount, evaluations);
+    printf("%-18s %8.3fs  %10.0f evaluations/s\n", "compile every time", uncached, evaluations / uncached);
+    printf("%-18s %8.3fs  %10.0f evaluations/s (%.1fx)\n", "chunk cache", cached, evaluations / cached,
+           uncached / cached);
+    dumpChunkCacheStats(stdout, &vm.chunkCache);
+    if (uncachedSum != cachedSum)
+    {
+        printf("MISMATCH: %.17g against %.17g\n", uncachedSum, cachedSum);
+        return 1;
+    }
+
+    for (int i = 0; i < ruleCount; i++)
+    {
+        free(rules[i]);
+    }
+    free(rules);
+    freeVM();
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,220 @@
+/*
+    Channels between two threads: raw throughput of SPSC and MPMC channels, the same through send() and
+    receive() in scripts on two VMs, and the round trip of a ping-pong over a pair of SPSC channels.
+    Both threads are pinned to cores of their own when there are at least two.
+
+    USAGE: ./bench/channel_bench [messages] [capacity]
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../channel.h"
+#include "../compiler.h"
+#include "../vm.h"
+
+#define SCRIPT_BATCH    1000
+#define PING_PONGS      100000
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static long cores;
+
+static void pin(int core)
+{
+    if (cores < 2)
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void sendBlocking(Channel* channel, Message* message)
+{
+    while (!trySendMessage(channel, message))
+    {
+        waitToSend(channel, 0);
+    }
+}
+
+static void receiveBlocking(Channel* channel, Message* message)
+{
+    while (!tryReceiveMessage(channel, message))
+    {
+        waitToReceive(channel, 0);
+    }
+}
+
+typedef struct
+{
+    Channel* in;
+    Channel* out;
+    long messages;
+    double sum;
+} Peer;
+
+static void* rawReceiver(void* argument)
+{
+    Peer* peer = argument;
+    pin(1);
+    Message message;
+    for (long i = 0; i < peer->messages; i++)
+    {
+        receiveBlocking(peer->in, &message);
+        peer->sum += message.number;
+    }
+    return NULL;
+}
+
+static void raw(const char* name, ChannelKind kind, long messages, int capacity)
+{
+    Peer peer = { newChannel(kind, capacity), NULL, messages, 0 };
+    pthread_t thread;
+    double start = seconds();
+    pthread_create(&thread, NULL, rawReceiver, &peer);
+    for (long i = 0; i < messages; i++)
+    {
+        Message message = { NULL, 0, (double)i };
+        sendBlocking(peer.in, &message);
+    }
+    pthread_join(thread, NULL);
+    double elapsed = seconds() - start;
+    bool right = peer.sum == (double)messages * (messages - 1) / 2;
+    printf("%-14s %10.1f M msgs/s %8.1f ns/msg   %s\n", name, messages / elapsed / 1e6, elapsed / messages * 1e9,
+           right ? "ok" : "WRONG");
+    releaseChannel(peer.in);
+}
+
+/* send(0, 1) + send(0, 1) + ... or receive(0) + receive(0) + ..., compiled once and run over and over */
+static void compileBatch(VM* vm, const char* term, Chunk* chunk)
+{
+    size_t length = strlen(term) + 3;
+    char* source = malloc(length * SCRIPT_BATCH + 1);
+    char* end = source;
+    for (int i = 0; i < SCRIPT_BATCH; i++)
+    {
+        end += sprintf(end, i == 0 ? "%s" : " + %s", term);
+    }
+    initChunkWith(chunk, vm->allocator);
+    Compiler compiler;
+    if (!compileWith(&compiler, vm, source, (size_t)(end - source), chunk))
+    {
+        fprintf(stderr, "Compile error.\n");
+        exit(1);
+    }
+    free(source);
+}
+
+static void* scriptReceiver(void* argument)
+{
+    Peer* peer = argument;
+    pin(1);
+    VM vm;
+    initVMWith(&vm);
+    attachChannel(&(vm.channels), peer->in);
+    Chunk chunk;
+    compileBatch(&vm, "receive(0)", &chunk);
+    for (long i = 0; i < peer->messages / SCRIPT_BATCH; i++)
+    {
+        runChunkWith(&vm, &chunk);
+        peer->sum += AS_NUMBER(vm.result);
+    }
+    freeChunk(&chunk);
+    freeVMWith(&vm);
+    return NULL;
+}
+
+static void script(long messages, int capacity)
+{
+    Peer peer = { newChannel(CHANNEL_SPSC, capacity), NULL, messages / SCRIPT_BATCH * SCRIPT_BATCH, 0 };
+    VM vm;
+    initVMWith(&vm);
+    attachChannel(&(vm.channels), peer.in);
+    Chunk chunk;
+    compileBatch(&vm, "send(0, 1)", &chunk);
+
+    pthread_t thread;
+    double start = seconds();
+    pthread_create(&thread, NULL, scriptReceiver, &peer);
+    for (long i = 0; i < peer.messages / SCRIPT_BATCH; i++)
+    {
+        runChunkWith(&vm, &chunk);
+    }
+    pthread_join(thread, NULL);
+    double elapsed = seconds() - start;
+    printf("%-14s %10.1f M msgs/s %8.1f ns/msg   %s\n", "script spsc", peer.messages / elapsed / 1e6,
+           elapsed / peer.messages * 1e9, peer.sum == (double)peer.messages ? "ok" : "WRONG");
+    freeChunk(&chunk);
+    freeVMWith(&vm);
+    releaseChannel(peer.in);
+}
+
+static void* ponger(void* argument)
+{
+    Peer* peer = argument;
+    pin(1);
+    Message message;
+    for (long i = 0; i < peer->messages; i++)
+    {
+        receiveBlocking(peer->in, &message);
+        sendBlocking(peer->out, &message);
+    }
+    return NULL;
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void pingPong()
+{
+    Peer peer = { newChannel(CHANNEL_SPSC, 2), newChannel(CHANNEL_SPSC, 2), PING_PONGS, 0 };
+    double* trips = malloc(sizeof(double) * PING_PONGS);
+    pthread_t thread;
+    pthread_create(&thread, NULL, ponger, &peer);
+    Message message;
+    for (long i = 0; i < PING_PONGS; i++)
+    {
+        double start = seconds();
+        message = (Message){ NULL, 0, (double)i };
+        sendBlocking(peer.in, &message);
+        receiveBlocking(peer.out, &message);
+        trips[i] = seconds() - start;
+    }
+    pthread_join(thread, NULL);
+    qsort(trips, PING_PONGS, sizeof(double), compareDoubles);
+    printf("%-14s p50 %.2f us, p99 %.2f us, max %.2f us\n", "ping-pong", trips[PING_PONGS / 2] * 1e6,
+           trips[PING_PONGS / 100 * 99] * 1e6, trips[PING_PONGS - 1] * 1e6);
+    free(trips);
+    releaseChannel(peer.in);
+    releaseChannel(peer.out);
+}
+
+int main(int argc, const char* argv[])
+{
+    long messages = argc > 1 ? atol(argv[1]) : 10000000;
+    int capacity = argc > 2 ? atoi(argv[2]) : 1024;
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%ld messages, capacity %d, %ld cores online%s\n", messages, capacity, cores,
+           cores < 2 ? " (both threads share it)" : "");
+    pin(0);
+    raw("raw spsc", CHANNEL_SPSC, messages, capacity);
+    raw("raw mpmc", CHANNEL_MPMC, messages, capacity);
+    script(messages, capacity);
+    pingPong();
+    return 0;
+}
\ No newline at end of file
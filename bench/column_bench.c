@@ -0,0 +1,127 @@
+/*
+    One expression over millions of rows of three input columns:
+    - interpret() per row, the row's values pasted into the source (what a host without slots has to do)
+    - the compiled chunk run by the scalar VM per row, inputs through OP_SLOT
+    - runColumnsWith(), every opcode over blocks of COLUMN_BLOCK rows
+    All three must compute the same bits.
+
+    USAGE: ./bench/column_bench [rows]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../column.h"
+#include "../compiler.h"
+#include "../vm.h"
+
+#define EXPRESSION  "(a + b) * 2.5 - c / 4 + -a * (b - 1.25)"
+/* interpret() per row is slow, it only gets a slice of the rows */
+#define TEXT_ROWS   200000
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void report(const char* title, size_t rows, double elapsed, double baseline)
+{
+    printf("%-28s %10zu rows %9.3f s %14.0f rows/s %8.1fx\n", title, rows, elapsed, rows / elapsed,
+           (rows / elapsed) / baseline);
+}
+
+int main(int argc, const char* argv[])
+{
+    size_t rows = argc > 1 ? (size_t)atol(argv[1]) : 4000000;
+    size_t textRows = rows < TEXT_ROWS ? rows : TEXT_ROWS;
+
+    double* a = malloc(sizeof(double) * rows);
+    double* b = malloc(sizeof(double) * rows);
+    double* c = malloc(sizeof(double) * rows);
+    double* scalar = malloc(sizeof(double) * rows);
+    double* columnar = malloc(sizeof(double) * rows);
+    double* text = malloc(sizeof(double) * textRows);
+    srand(42);
+    for (size_t i = 0; i < rows; i++)
+    {
+        a[i] = (rand() % 100000) / 100.0;
+        b[i] = (rand() % 100000) / 1000.0 - 50;
+        c[i] = (rand() % 1000) + 0.5;
+    }
+
+    initVM();
+    /* Every row's text is new, caching them would only cost */
+    setChunkCacheLimit(&vm.chunkCache, 0);
+    const char* names[] = { "a", "b", "c" };
+    const double* inputs[] = { a, b, c };
+
+    char source[256];
+    double start = seconds();
+    for (size_t i = 0; i < textRows; i++)
+    {
+        int length = snprintf(source, sizeof(source), "(%.17g + %.17g) * 2.5 - %.17g / 4 + -%.17g * (%.17g - 1.25)",
+                              a[i], b[i], c[i], a[i], b[i]);
+        if (interpret(source, (size_t)length) != INTERPRET_OK)
+        {
+            fprintf(stderr, "Row %zu failed.\n", i);
+            return 1;
+        }
+        text[i] = AS_NUMBER(vm.result);
+    }
+    double textSeconds = seconds() - start;
+
+    Chunk chunk;
+    initChunkWith(&chunk, vm.allocator);
+    Compiler compiler;
+    if (!compileSlotsWith(&compiler, &vm, EXPRESSION, strlen(EXPRESSION), names, 3, &chunk))
+    {
+        return 1;
+    }
+
+    Value slots[3];
+    vm.slots = slots;
+    vm.slotCount = 3;
+    start = seconds();
+    for (size_t i = 0; i < rows; i++)
+    {
+        slots[0] = NUMBER_VAL(a[i]);
+        slots[1] = NUMBER_VAL(b[i]);
+        slots[2] = NUMBER_VAL(c[i]);
+        runChunk(&chunk);
+        scalar[i] = AS_NUMBER(vm.result);
+    }
+    double scalarSeconds = seconds() - start;
+    vm.slots = NULL;
+    vm.slotCount = 0;
+
+    start = seconds();
+    if (!runColumnsWith(&vm, &chunk, inputs, 3, columnar, rows))
+    {
+        fprintf(stderr, "Could not run over columns.\n");
+        return 1;
+    }
+    double columnSeconds = seconds() - start;
+
+    bool same = memcmp(scalar, columnar, sizeof(double) * rows) == 0 &&
+                memcmp(text, columnar, sizeof(double) * textRows) == 0;
+
+    printf("%s\n", EXPRESSION);
+    double baseline = textRows / textSeconds;
+    report("interpret() per row", textRows, textSeconds, baseline);
+    report("scalar VM per row (slots)", rows, scalarSeconds, baseline);
+    report("columnar blocks", rows, columnSeconds, baseline);
+    printf("columnar vs scalar VM      %.1fx, results %s\n", scalarSeconds / columnSeconds,
+           same ? "identical" : "DIFFER");
+
+    freeChunk(&chunk);
+    freeVM();
+    free(a);
+    free(b);
+    free(c);
+    free(scalar);
+    free(columnar);
+    free(text);
+    return same ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+/*
+    Many concurrent fibers in one VM on one thread. Every fiber yields at every term, so all of them are alive
+    at once and the scheduler cycles through the whole lot for each term.
+    First the host spawns them (spawnFiberWith()), then a script spawns them itself and joins them all.
+    The baseline runs the same expression as many times one after the other, with no fibers in between.
+
+    USAGE: ./bench/fiber_bench [fibers] [yields per fiber]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../compiler.h"
+#include "../vm.h"
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* yield(1) + yield(2) + ... with yields terms, the value is yields * (yields + 1) / 2 */
+static size_t writeBody(char* buffer, int yields)
+{
+    size_t length = 0;
+    for (int i = 1; i <= yields; i++)
+    {
+        length += (size_t)sprintf(buffer + length, i == 1 ? "yield(%d)" : " + yield(%d)", i);
+    }
+    return length;
+}
+
+static void compileOrDie(VM* vm, const char* source, size_t length, Chunk* chunk)
+{
+    initChunkWith(chunk, vm->allocator);
+    Compiler compiler;
+    if (!compileWith(&compiler, vm, source, length, chunk))
+    {
+        fprintf(stderr, "Compile error.\n");
+        exit(1);
+    }
+}
+
+static void report(const char* title, double elapsed, int fibers, VM* vm, double expected, double checksum)
+{
+    MemoryCounter* stacks = &(vm->systemAllocator.stats.tags[MEM_VM_STACK]);
+    printf("%-14s %8.3f s %11.0f switches/s %6.1f ns/switch   %6.0f bytes/fiber   %s\n",
+           title, elapsed, vm->fibers.switches / elapsed, elapsed * 1e9 / vm->fibers.switches,
+           (double)stacks->peakBytes / fibers, checksum == expected ? "ok" : "WRONG");
+}
+
+int main(int argc, const char* argv[])
+{
+    int fibers = argc > 1 ? atoi(argv[1]) : 100000;
+    int yields = argc > 2 ? atoi(argv[2]) : 10;
+    double expected = (double)fibers * yields * (yields + 1) / 2;
+    char* body = malloc((size_t)yields * 16 + 1);
+    size_t bodyLength = writeBody(body, yields);
+    printf("%d fibers, %d yields each: %s\n", fibers, yields, yields <= 4 ? body : "yield(1) + yield(2) + ...");
+
+    /* Baseline: one run after the other, the lone fiber has nobody to yield to */
+    {
+        VM vm;
+        initVMWith(&vm);
+        Chunk chunk;
+        compileOrDie(&vm, body, bodyLength, &chunk);
+        double checksum = 0;
+        double start = seconds();
+        for (int i = 0; i < fibers; i++)
+        {
+            runChunkWith(&vm, &chunk);
+            checksum += AS_NUMBER(vm.result);
+        }
+        double elapsed = seconds() - start;
+        printf("%-14s %8.3f s %35s %6.0f bytes/fiber   %s\n", "sequential", elapsed, "",
+               (double)vm.systemAllocator.stats.tags[MEM_VM_STACK].peakBytes / fibers,
+               checksum == expected ? "ok" : "WRONG");
+        freeChunk(&chunk);
+        freeVMWith(&vm);
+    }
+
+    /* All spawned by the host up front, then run together */
+    {
+        VM vm;
+        initVMWith(&vm);
+        Chunk chunk;
+        compileOrDie(&vm, body, bodyLength, &chunk);
+        double start = seconds();
+        for (int i = 0; i < fibers; i++)
+        {
+            spawnFiberWith(&vm, &chunk);
+        }
+        runFibersWith(&vm);
+        double elapsed = seconds() - start;
+        double checksum = 0;
+        for (int i = 0; i < fibers; i++)
+        {
+            checksum += AS_NUMBER(fiberResultWith(&vm, i));
+        }
+        report("host spawn", elapsed, fibers, &vm, expected, checksum);
+        freeChunk(&chunk);
+        freeVMWith(&vm);
+    }
+
+    /* The script spawns them all (ids 1..fibers), then joins each: 0 * (spawn(..) + ...) + join(1) + ... */
+    {
+        size_t capacity = (size_t)fibers * (bodyLength + 32) + 64;
+        char* source = malloc(capacity);
+        size_t length = (size_t)sprintf(source, "0 * (");
+        for (int i = 0; i < fibers; i++)
+        {
+            length += (size_t)sprintf(source + length, i == 0 ? "spawn(" : " + spawn(");
+            memcpy(source + length, body, bodyLength);
+            length += bodyLength;
+            source[length++] = ')';
+        }
+        length += (size_t)sprintf(source + length, ")");
+        for (int i = 1; i <= fibers; i++)
+        {
+            length += (size_t)sprintf(source + length, " + join(%d)", i);
+        }
+
+        VM vm;
+        initVMWith(&vm);
+        Chunk chunk;
+        compileOrDie(&vm, source, length, &chunk);
+        double start = seconds();
+        runChunkWith(&vm, &chunk);
+        double elapsed = seconds() - start;
+        report("script spawn", elapsed, fibers, &vm, expected, AS_NUMBER(vm.result));
+        freeChunk(&chunk);
+        freeVMWith(&vm);
+        free(source);
+    }
+
+    free(body);
+    return 0;
+}
\ No newline at end of file
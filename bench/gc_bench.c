@@ -0,0 +1,117 @@
+/*
+    GC stress benchmark.
+    A table of long-lived arrays keeps getting entries replaced (old garbage, old -> young pointers through the write barrier)
+    while every iteration also makes an array that dies young. Prints pause percentiles and allocation throughput.
+
+    USAGE: ./bench/gc_bench [iterations] [pause budget in us]
+*/
+#include <stdlib.h>
+#include <time.h>
+
+#include "../vm.h"
+
+#define TABLE_SIZE 100000
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static uint32_t nextRandom(uint32_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+int main(int argc, const char* argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 20000000;
+    initVM();
+    if (argc > 2)
+    {
+        gcSetPauseBudget(&vm, (uint64_t)atol(argv[2]) * 1000);
+    }
+
+    /* Rooted, so AS_ARRAY(table) is valid again after every allocation */
+    Value table = OBJ_VAL(newArray(&vm));
+    gcPushRoot(&vm, &table);
+    for (int i = 0; i < TABLE_SIZE; i++)
+    {
+        arrayPush(&vm, AS_ARRAY(table), NUMBER_VAL(0));
+    }
+
+    uint32_t seed = 0x2545F491;
+    long objects = 1;
+    double start = seconds();
+    for (long i = 0; i < iterations; i++)
+    {
+        /* Dies young */
+        ObjArray* temporary = newArray(&vm);
+        arrayPush(&vm, temporary, NUMBER_VAL((double)i));
+        objects++;
+
+        if ((i & 3) == 0)
+        {
+            /* Replaces an entry that may be old by now: {i, 2i, some other entry} */
+            int slot = (int)(nextRandom(&seed) % TABLE_SIZE);
+            int other = (int)(nextRandom(&seed) % TABLE_SIZE);
+            ObjArray* entry = newArray(&vm);
+            objects++;
+            arrayPush(&vm, entry, NUMBER_VAL((double)i));
+            arrayPush(&vm, entry, NUMBER_VAL((double)i * 2));
+            arrayPush(&vm, entry, AS_ARRAY(table)->values[other]);
+            arraySet(&vm, AS_ARRAY(table), slot, OBJ_VAL(entry));
+        }
+    }
+    double elapsed = seconds() - start;
+    /* Before the full collection below, which has no budget */
+    GCStats stats = *gcStats(&vm);
+    uint64_t p50 = gcPausePercentile(&vm, 50);
+    uint64_t p99 = gcPausePercentile(&vm, 99);
+
+    /* Make sure nothing live was lost or moved without its references being updated */
+    gcCollectFull(&vm);
+    long checked = 0;
+    ObjArray* entries = AS_ARRAY(table);
+    for (int i = 0; i < TABLE_SIZE; i++)
+    {
+        Value value = entries->values[i];
+        if (!IS_OBJ(value))
+        {
+            continue;
+        }
+        ObjArray* entry = AS_ARRAY(value);
+        if (entry->count != 3 || AS_NUMBER(entry->values[0]) * 2 != AS_NUMBER(entry->values[1]) ||
+            (IS_OBJ(entry->values[2]) && AS_ARRAY(entry->values[2])->count != 3))
+        {
+            fprintf(stderr, "Corrupted entry %d\n", i);
+            return 1;
+        }
+        checked++;
+    }
+
+    printf("iterations        %ld\n", iterations);
+    printf("objects           %ld (%.1f M/s)\n", objects, objects / elapsed / 1e6);
+    printf("allocated         %.1f MB (%.1f MB/s)\n", stats.allocatedBytes / 1e6, stats.allocatedBytes / elapsed / 1e6);
+    printf("elapsed           %.3f s, %.1f%% in GC\n", elapsed, 100.0 * stats.totalPauseNs / 1e9 / elapsed);
+    printf("collections       %llu minor, %llu major cycles in %llu steps\n",
+           (unsigned long long)stats.minorCollections, (unsigned long long)stats.majorCycles,
+           (unsigned long long)stats.majorSteps);
+    printf("pause p50         %.1f us\n", p50 / 1000.0);
+    printf("pause p99         %.1f us\n", p99 / 1000.0);
+    printf("pause max         %.1f us (budget %.1f us)\n", stats.maxPauseNs / 1000.0, vm.gc.pauseBudgetNs / 1000.0);
+    /* Pauses the budget couldn't hold, the minor collections can't be cut short */
+    printf("over budget       %llu of %llu pauses (%.2f%%), minor collection max %.1f us\n",
+           (unsigned long long)stats.overBudgetPauses, (unsigned long long)stats.pauses,
+           100.0 * stats.overBudgetPauses / (stats.pauses > 0 ? stats.pauses : 1), stats.maxMinorNs / 1000.0);
+    printf("nursery           %zu KB at the end (%d KB at most)\n", vm.gc.nurserySize / 1024, GC_NURSERY_SIZE / 1024);
+    printf("live entries      %ld checked\n", checked);
+
+    gcPopRoot(&vm);
+    freeVM();
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,197 @@
+/*
+    Load generator for clox --serve: connections threads, each with one request in flight at a time,
+    first sending the script's source every time, then only its id. Latency is measured by the client,
+    from sending the request to having read the whole response.
+
+    USAGE: ./bench/loadgen socket [connections] [requests per connection]
+*/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../server.h"
+
+#define SCRIPT "(arg0 + arg1) * 2.5 - arg2 / 4 + -arg0 * (arg1 - 1.25)"
+
+typedef struct
+{
+    const char* path;
+    bool bySource;
+    uint64_t scriptId;
+    int requests;
+    uint64_t* latencies;
+    uint64_t queueNs;
+    uint64_t runNs;
+    int failed;
+} Client;
+
+static uint64_t nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static int connectTo(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+    {
+        fprintf(stderr, "Could not connect to \"%s\", is clox --serve running?\n", path);
+        exit(1);
+    }
+    return fd;
+}
+
+static bool readFully(int fd, void* buffer, size_t length)
+{
+    char* bytes = buffer;
+    while (length > 0)
+    {
+        ssize_t got = read(fd, bytes, length);
+        if (got <= 0)
+        {
+            return false;
+        }
+        bytes += got;
+        length -= (size_t)got;
+    }
+    return true;
+}
+
+/* One round trip, the result text lands in result */
+static bool request(int fd, uint32_t requestId, bool bySource, uint64_t scriptId, const double* args, int argCount,
+                    ResponseHeader* response, char* result, size_t capacity)
+{
+    char frame[512];
+    RequestHeader header;
+    memset(&header, 0, sizeof(RequestHeader));
+    size_t sourceLength = bySource ? strlen(SCRIPT) : 0;
+    header.length = (uint32_t)(sizeof(RequestHeader) - sizeof(uint32_t) + sizeof(double) * argCount + sourceLength);
+    header.requestId = requestId;
+    header.scriptId = scriptId;
+    header.kind = bySource ? REQUEST_SOURCE : REQUEST_SCRIPT;
+    header.argCount = (uint8_t)argCount;
+    memcpy(frame, &header, sizeof(RequestHeader));
+    memcpy(frame + sizeof(RequestHeader), args, sizeof(double) * argCount);
+    memcpy(frame + sizeof(RequestHeader) + sizeof(double) * argCount, SCRIPT, sourceLength);
+    size_t frameLength = sizeof(uint32_t) + header.length;
+    if (write(fd, frame, frameLength) != (ssize_t)frameLength)
+    {
+        return false;
+    }
+
+    if (!readFully(fd, response, sizeof(ResponseHeader)))
+    {
+        return false;
+    }
+    size_t resultLength = response->length - (sizeof(ResponseHeader) - sizeof(uint32_t));
+    if (resultLength >= capacity || !readFully(fd, result, resultLength))
+    {
+        return false;
+    }
+    result[resultLength] = '\0';
+    return response->requestId == requestId;
+}
+
+static void* run(void* argument)
+{
+    Client* client = argument;
+    int fd = connectTo(client->path);
+    char result[256];
+    for (int i = 0; i < client->requests; i++)
+    {
+        double args[3] = { i % 1000, (i % 77) * 0.5, 3.0 + i % 5 };
+        ResponseHeader response;
+        uint64_t start = nowNs();
+        if (!request(fd, (uint32_t)i, client->bySource, client->scriptId, args, 3, &response, result, sizeof(result)))
+        {
+            fprintf(stderr, "Connection lost.\n");
+            exit(1);
+        }
+        client->latencies[i] = nowNs() - start;
+        client->queueNs += response.queueNs;
+        client->runNs += response.runNs;
+        client->failed += response.status != RESPONSE_OK;
+    }
+    close(fd);
+    return NULL;
+}
+
+static int compareLatency(const void* a, const void* b)
+{
+    uint64_t left = *(const uint64_t*)a, right = *(const uint64_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+static void measure(const char* title, const char* path, bool bySource, uint64_t scriptId, int connections, int requests)
+{
+    Client* clients = calloc((size_t)connections, sizeof(Client));
+    pthread_t* threads = calloc((size_t)connections, sizeof(pthread_t));
+    uint64_t* latencies = malloc(sizeof(uint64_t) * connections * requests);
+
+    uint64_t start = nowNs();
+    for (int i = 0; i < connections; i++)
+    {
+        clients[i] = (Client){ path, bySource, scriptId, requests, latencies + (size_t)i * requests, 0, 0, 0 };
+        pthread_create(&threads[i], NULL, run, &clients[i]);
+    }
+    uint64_t queueNs = 0, runNs = 0;
+    int failed = 0;
+    for (int i = 0; i < connections; i++)
+    {
+        pthread_join(threads[i], NULL);
+        queueNs += clients[i].queueNs;
+        runNs += clients[i].runNs;
+        failed += clients[i].failed;
+    }
+    double seconds = (nowNs() - start) / 1e9;
+
+    size_t total = (size_t)connections * requests;
+    qsort(latencies, total, sizeof(uint64_t), compareLatency);
+    printf("%-10s %8zu requests %9.0f req/s   p50 %7.1f us   p99 %7.1f us   max %8.1f us   "
+           "server queue %6.1f us  run %5.1f us   %d failed\n",
+           title, total, total / seconds, latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3,
+           latencies[total - 1] / 1e3, queueNs / 1e3 / total, runNs / 1e3 / total, failed);
+
+    free(clients);
+    free(threads);
+    free(latencies);
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "USAGE: ./bench/loadgen socket [connections] [requests per connection]\n");
+        return 1;
+    }
+    int connections = argc > 2 ? atoi(argv[2]) : 4;
+    int requests = argc > 3 ? atoi(argv[3]) : 20000;
+
+    /* Compiled once here, the id is what the fast path sends */
+    int fd = connectTo(argv[1]);
+    double args[3] = { 1, 2, 3 };
+    ResponseHeader response;
+    char result[256];
+    if (!request(fd, 0, true, 0, args, 3, &response, result, sizeof(result)) || response.status != RESPONSE_OK)
+    {
+        fprintf(stderr, "The script failed.\n");
+        return 1;
+    }
+    close(fd);
+    printf("%s with (1, 2, 3) = %s, script id %016llx, %d connections\n", SCRIPT, result,
+           (unsigned long long)response.scriptId, connections);
+
+    measure("by source", argv[1], true, 0, connections, requests);
+    measure("by id", argv[1], false, response.scriptId, connections, requests);
+    return 0;
+}
\ No newline at end of file
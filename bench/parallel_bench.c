@@ -0,0 +1,112 @@
+/*
+    parallelMap and parallelReduce on pools of 1..N threads, over the same columns.
+    The map runs as column kernels, the reduce runs the VM once per row, so it is the one that should scale
+    best. Every pool must give bit for bit the same results as the pool of 1.
+
+    USAGE: ./bench/parallel_bench [max threads] [rows]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../compiler.h"
+#include "../parallel.h"
+#include "../vm.h"
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static FrozenChunk* compileFrozen(VM* vm, const char* source, const char* const* names, int nameCount)
+{
+    Chunk chunk;
+    initChunkWith(&chunk, vm->allocator);
+    Compiler compiler;
+    if (!compileSlotsWith(&compiler, vm, source, strlen(source), names, nameCount, &chunk))
+    {
+        fprintf(stderr, "Compile error.\n");
+        exit(1);
+    }
+    FrozenChunk* frozen = freezeChunk(vm, &chunk);
+    freeChunk(&chunk);
+    return frozen;
+}
+
+int main(int argc, const char* argv[])
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 16;
+    size_t rows = argc > 2 ? (size_t)atol(argv[2]) : 4000000;
+
+    double* a = malloc(sizeof(double) * rows);
+    double* b = malloc(sizeof(double) * rows);
+    double* output = malloc(sizeof(double) * rows);
+    double* expected = malloc(sizeof(double) * rows);
+    /* Touched up front, so page faults don't count against the first pool */
+    memset(output, 0, sizeof(double) * rows);
+    memset(expected, 0, sizeof(double) * rows);
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < rows; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        a[i] = (double)(state % 100000) / 100.0 - 500.0;
+        b[i] = (double)(state >> 40) / 1e4 + 1.0;
+    }
+    const double* inputs[] = { a, b };
+
+    VM vm;
+    initVMWith(&vm);
+    static const char* mapNames[] = { "a", "b" };
+    static const char* reduceNames[] = { "acc", "x" };
+    FrozenChunk* map = compileFrozen(&vm, "(a * 1.5 + b) / (a - b * 0.5) - -a * 2", mapNames, 2);
+    FrozenChunk* reduce = compileFrozen(&vm, "acc + x * x / 1000", reduceNames, 2);
+
+    /* Warm up caches and the allocator before anything is timed */
+    ThreadPool* warmup = startThreadPool(1);
+    parallelMapWith(&vm, warmup, map, inputs, 2, output, rows);
+    stopThreadPool(warmup);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("%zu rows, %ld cores online, chunks of %d rows\n", rows, cores, PARALLEL_CHUNK);
+    printf("threads       map      speedup     reduce      speedup   same\n");
+    double mapBase = 0, reduceBase = 0, expectedSum = 0;
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        ThreadPool* pool = startThreadPool(threads);
+
+        double start = seconds();
+        parallelMapWith(&vm, pool, map, inputs, 2, output, rows);
+        double mapSeconds = seconds() - start;
+
+        double sum = 0;
+        start = seconds();
+        parallelReduceWith(&vm, pool, reduce, a, rows, 0, &sum);
+        double reduceSeconds = seconds() - start;
+
+        if (threads == 1)
+        {
+            mapBase = mapSeconds;
+            reduceBase = reduceSeconds;
+            expectedSum = sum;
+            memcpy(expected, output, sizeof(double) * rows);
+        }
+        bool same = sum == expectedSum && memcmp(expected, output, sizeof(double) * rows) == 0;
+        printf("%7d %8.1f ms %8.2fx %9.1f ms %8.2fx   %s\n", threads, mapSeconds * 1e3, mapBase / mapSeconds,
+               reduceSeconds * 1e3, reduceBase / reduceSeconds, same ? "yes" : "NO");
+        stopThreadPool(pool);
+    }
+
+    releaseFrozenChunk(map);
+    releaseFrozenChunk(reduce);
+    freeVMWith(&vm);
+    free(a);
+    free(b);
+    free(output);
+    free(expected);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+/*
+    Report generation: `s = s + piece` over and over, the way a script would build its output.
+    Runs the same concatenation OP_ADD does, once with ropes and once flattening after every step
+    (what flat strings cost), then checks the rope's characters.
+
+    USAGE: ./bench/rope_bench [pieces] [flat pieces]
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../object.h"
+#include "../vm.h"
+
+#define PIECE "0123456789"
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Returns the time taken, the result is left in *text */
+static double build(Value* text, Value* piece, long pieces, bool flatten)
+{
+    double start = seconds();
+    *text = OBJ_VAL(copyString(&vm, "", 0));
+    for (long i = 0; i < pieces; i++)
+    {
+        *text = concatenateText(&vm, text, piece);
+        if (flatten)
+        {
+            *text = OBJ_VAL(flattenText(&vm, text));
+        }
+    }
+    /* Somebody will look at it in the end */
+    flattenText(&vm, text);
+    return seconds() - start;
+}
+
+int main(int argc, const char* argv[])
+{
+    long pieces = argc > 1 ? atol(argv[1]) : 10000000;
+    long flatPieces = argc > 2 ? atol(argv[2]) : 20000;
+    initVM();
+
+    Value text = NUMBER_VAL(0);
+    Value piece = OBJ_VAL(copyString(&vm, PIECE, (int)strlen(PIECE)));
+    gcPushRoot(&vm, &text);
+    gcPushRoot(&vm, &piece);
+
+    double flatTime = build(&text, &piece, flatPieces, true);
+    double flatMB = textLength(text) / 1e6;
+
+    double ropeTime = build(&text, &piece, pieces, false);
+    ObjString* result = flattenText(&vm, &text);
+    for (long i = 0; i < pieces; i++)
+    {
+        if (memcmp(result->chars + i * 10, PIECE, 10) != 0)
+        {
+            fprintf(stderr, "Wrong characters at piece %ld\n", i);
+            return 1;
+        }
+    }
+
+    printf("flat strings      %ld pieces, %.1f MB in %.3f s (%.1f MB/s)\n", flatPieces, flatMB, flatTime, flatMB / flatTime);
+    printf("ropes             %ld pieces, %.1f MB in %.3f s (%.1f MB/s)\n", pieces, result->length / 1e6, ropeTime,
+           result->length / 1e6 / ropeTime);
+    printf("gc                %llu minor, %llu major, pause max %.1f us\n",
+           (unsigned long long)gcStats(&vm)->minorCollections, (unsigned long long)gcStats(&vm)->majorCycles,
+           gcStats(&vm)->maxPauseNs / 1000.0);
+
+    gcPopRoot(&vm);
+    gcPopRoot(&vm);
+    freeVM();
+    return 0;
+}
\ No newline at end of file
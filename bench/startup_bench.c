@@ -0,0 +1,122 @@
+/*
+    Time to first instruction: from having nothing but a file name to a chunk ready for run(),
+    compiling the source against mapping a snapshot image of it. Both then run and must agree.
+
+    USAGE: ./bench/startup_bench [terms] [runs]
+*/
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../compiler.h"
+#include "../image.h"
+#include "../object.h"
+#include "../vm.h"
+
+#define PRELUDE_PATH    "/tmp/clox_startup_prelude.lox"
+#define IMAGE_PATH      "/tmp/clox_startup_prelude.img"
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return (left > right) - (left < right);
+}
+
+/* A prelude with a sum of terms numbers, each its own constant */
+static void writePrelude(long terms)
+{
+    FILE* file = fopen(PRELUDE_PATH, "w");
+    for (long i = 0; i < terms; i++)
+    {
+        fprintf(file, i == 0 ? "%ld.25" : " + %ld.25", i);
+    }
+    fprintf(file, "\n");
+    fclose(file);
+}
+
+static double compileStartup(Chunk* chunk)
+{
+    double start = seconds();
+    int fd = open(PRELUDE_PATH, O_RDONLY);
+    struct stat fileStat;
+    fstat(fd, &fileStat);
+    void* source = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    compile((const char*)source, fileStat.st_size, chunk);
+    double elapsed = seconds() - start;
+    munmap(source, fileStat.st_size);
+    return elapsed;
+}
+
+int main(int argc, const char* argv[])
+{
+    long terms = argc > 1 ? atol(argv[1]) : 200000;
+    int runs = argc > 2 ? atoi(argv[2]) : 20;
+    initVM();
+    writePrelude(terms);
+
+    double compileTimes[runs];
+    double imageTimes[runs];
+    double expected = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        Chunk chunk;
+        initChunkWith(&chunk, vm.allocator);
+        compileTimes[i] = compileStartup(&chunk);
+        runChunk(&chunk);
+        expected = AS_NUMBER(vm.result);
+        if (i == 0)
+        {
+            writeImage(&vm, IMAGE_PATH, &chunk, 0);
+        }
+        freeChunk(&chunk);
+    }
+
+    for (int i = 0; i < runs; i++)
+    {
+        Image image;
+        double start = seconds();
+        if (!loadImage(&vm, IMAGE_PATH, &image))
+        {
+            return 1;
+        }
+        imageTimes[i] = seconds() - start;
+        runChunk(&(image.chunk));
+        if (AS_NUMBER(vm.result) != expected)
+        {
+            fprintf(stderr, "Image computed %g, source %g\n", AS_NUMBER(vm.result), expected);
+            return 1;
+        }
+        freeImage(&image);
+    }
+
+    qsort(compileTimes, runs, sizeof(double), compareDoubles);
+    qsort(imageTimes, runs, sizeof(double), compareDoubles);
+    struct stat sourceStat;
+    struct stat imageStat;
+    stat(PRELUDE_PATH, &sourceStat);
+    stat(IMAGE_PATH, &imageStat);
+    printf("prelude           %ld constants, %.1f KB source, %.1f KB image\n", terms,
+           sourceStat.st_size / 1024.0, imageStat.st_size / 1024.0);
+    printf("from source       median %.3f ms, min %.3f ms to first instruction\n",
+           compileTimes[runs / 2] * 1e3, compileTimes[0] * 1e3);
+    printf("from image        median %.3f ms, min %.3f ms to first instruction (%.0fx)\n",
+           imageTimes[runs / 2] * 1e3, imageTimes[0] * 1e3, compileTimes[runs / 2] / imageTimes[runs / 2]);
+
+    unlink(PRELUDE_PATH);
+    unlink(IMAGE_PATH);
+    freeVM();
+    return 0;
+}
\ No newline at end of file
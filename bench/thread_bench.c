@@ -0,0 +1,187 @@
+/*
+    One VM per thread, each evaluating the same rules, for 1..N threads. First every VM compiles its own copy
+    (interpretWith() and its chunk cache), then all of them run the same frozen chunks (runFrozenChunkWith()).
+    Nothing mutable is shared between the VMs, so throughput should grow with the number of cores.
+    Every thread must end up with the same checksum as the single threaded run.
+
+    USAGE: ./bench/thread_bench [max threads] [evaluations per thread]
+*/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../compiler.h"
+#include "../vm.h"
+
+#define RULE_COUNT 100
+
+typedef struct
+{
+    char** rules;
+    /* NULL: compile through interpretWith() instead */
+    FrozenChunk** frozen;
+    long evaluations;
+    double checksum;
+    /* What this VM keeps of the compiled rules */
+    size_t compiledBytes;
+} Worker;
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Same shape as the rules of cache_bench, plus a string so the heap and the GC get some work */
+static char* makeRule(int index)
+{
+    size_t capacity = 1024;
+    char* rule = malloc(capacity);
+    size_t length = (size_t)snprintf(rule, capacity, "%d.5", index);
+    for (int term = 1; term < 40; term++)
+    {
+        const char* op = (term % 4 == 0) ? "-" : (term % 4 == 1) ? "+" : (term % 4 == 2) ? "*" : "/";
+        length += (size_t)snprintf(rule + length, capacity - length, " %s (%d + %d.25)", op, term, index % 7 + 1);
+    }
+    if (index % 10 == 0)
+    {
+        snprintf(rule, capacity, "\"rule\" + \"%d\" + \"-tag\"", index);
+    }
+    return rule;
+}
+
+static void* work(void* argument)
+{
+    Worker* worker = argument;
+    VM vm;
+    initVMWith(&vm);
+
+    worker->checksum = 0;
+    for (long i = 0; i < worker->evaluations; i++)
+    {
+        const char* rule = worker->rules[i % RULE_COUNT];
+        InterpreterResult result = worker->frozen != NULL ?
+            runFrozenChunkWith(&vm, worker->frozen[i % RULE_COUNT]) : interpretWith(&vm, rule, strlen(rule));
+        if (result != INTERPRET_OK)
+        {
+            fprintf(stderr, "Rule %ld failed.\n", i % RULE_COUNT);
+            exit(1);
+        }
+        if (IS_NUMBER(vm.result))
+        {
+            worker->checksum += AS_NUMBER(vm.result);
+        }
+    }
+
+    worker->compiledBytes = vm.chunkCache.bytes;
+    freeVMWith(&vm);
+    return NULL;
+}
+
+/* Throughput for 1..maxThreads threads, false if any thread computed something else */
+static bool measure(const char* title, char** rules, FrozenChunk** frozen, int maxThreads, long evaluations)
+{
+    printf("\n%s\n", title);
+    printf("threads      seconds    evaluations/s    scaling    compiled bytes per VM\n");
+
+    double single = 0;
+    double expected = 0;
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        Worker* workers = calloc((size_t)threads, sizeof(Worker));
+        pthread_t* ids = calloc((size_t)threads, sizeof(pthread_t));
+
+        double start = seconds();
+        for (int i = 0; i < threads; i++)
+        {
+            workers[i].rules = rules;
+            workers[i].frozen = frozen;
+            workers[i].evaluations = evaluations;
+            pthread_create(&ids[i], NULL, work, &workers[i]);
+        }
+        for (int i = 0; i < threads; i++)
+        {
+            pthread_join(ids[i], NULL);
+        }
+        double elapsed = seconds() - start;
+
+        for (int i = 0; i < threads; i++)
+        {
+            if (threads == 1 && i == 0)
+            {
+                expected = workers[i].checksum;
+            }
+            else if (workers[i].checksum != expected)
+            {
+                fprintf(stderr, "Thread %d computed %.17g, expected %.17g\n", i, workers[i].checksum, expected);
+                return false;
+            }
+        }
+
+        double throughput = (double)evaluations * threads / elapsed;
+        if (threads == 1)
+        {
+            single = throughput;
+        }
+        printf("%7d %12.3f %16.0f %9.2fx %24zu\n", threads, elapsed, throughput, throughput / single,
+               workers[0].compiledBytes);
+
+        free(workers);
+        free(ids);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (cores < 2 ? 4 : (int)cores);
+    long evaluations = argc > 2 ? atol(argv[2]) : 200000;
+
+    char* rules[RULE_COUNT];
+    for (int i = 0; i < RULE_COUNT; i++)
+    {
+        rules[i] = makeRule(i);
+    }
+
+    /* Compiled once, by a VM that is gone before any thread starts */
+    FrozenChunk* frozen[RULE_COUNT];
+    size_t frozenBytes = 0;
+    VM compilerVM;
+    initVMWith(&compilerVM);
+    for (int i = 0; i < RULE_COUNT; i++)
+    {
+        Chunk chunk;
+        initChunkWith(&chunk, compilerVM.allocator);
+        Compiler compiler;
+        if (!compileWith(&compiler, &compilerVM, rules[i], strlen(rules[i]), &chunk) ||
+            (frozen[i] = freezeChunk(&compilerVM, &chunk)) == NULL)
+        {
+            fprintf(stderr, "Rule %d failed.\n", i);
+            return 1;
+        }
+        frozenBytes += frozen[i]->size;
+        freeChunk(&chunk);
+    }
+    freeVMWith(&compilerVM);
+
+    printf("%ld core(s) online, %ld evaluations per thread\n", cores, evaluations);
+    if (cores < maxThreads)
+    {
+        printf("NOTE: more threads than cores, the threads take turns and scaling stays flat\n");
+    }
+
+    bool same = measure("Every VM compiles its own copy (chunk cache)", rules, NULL, maxThreads, evaluations) &&
+                measure("All VMs run the same frozen chunks", rules, frozen, maxThreads, evaluations);
+    printf("\nfrozen chunks       %zu bytes, once for all threads\n", frozenBytes);
+
+    for (int i = 0; i < RULE_COUNT; i++)
+    {
+        releaseFrozenChunk(frozen[i]);
+        free(rules[i]);
+    }
+    return same ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "budget.h"
+
+uint64_t monotonicNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static Budget processBudget;
+static pthread_once_t processBudgetOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t readLimit(const char* name)
+{
+    const char* value = getenv(name);
+    return value != NULL ? strtoull(value, NULL, 0) : 0;
+}
+
+static void readProcessBudget()
+{
+    processBudget.fuel = readLimit("CLOX_FUEL");
+    processBudget.heapBytes = (size_t)readLimit("CLOX_MAX_HEAP");
+    processBudget.timeoutNs = readLimit("CLOX_TIMEOUT_MS") * 1000000ull;
+}
+
+Budget defaultBudget()
+{
+    pthread_once(&processBudgetOnce, readProcessBudget);
+    return processBudget;
+}
+
+void initBudgetMeter(BudgetMeter* meter, Budget limits)
+{
+    meter->limits = limits;
+    meter->enabled = limits.fuel != 0 || limits.heapBytes != 0 || limits.timeoutNs != 0;
+    startBudgetMeter(meter);
+}
+
+void startBudgetMeter(BudgetMeter* meter)
+{
+    meter->status = BUDGET_OK;
+    meter->segmentStart = NULL;
+    meter->fuelLeft = meter->limits.fuel != 0 ? meter->limits.fuel : UINT64_MAX;
+    /* A clock read per run would cost tiny runs more than everything else here, see budgetDeadline() */
+    meter->deadlineNs = 0;
+    /* The first checkpoint is the start of the run, the clock starts at the second */
+    meter->clockCountdown = 2;
+}
+
+bool checkBudgetClock(BudgetMeter* meter)
+{
+    meter->clockCountdown = BUDGET_CLOCK_INTERVAL;
+    uint64_t now = monotonicNs();
+    if (meter->deadlineNs == 0)
+    {
+        meter->deadlineNs = now + meter->limits.timeoutNs;
+    }
+    else if (now >= meter->deadlineNs)
+    {
+        meter->status = BUDGET_DEADLINE;
+        return false;
+    }
+    return true;
+}
+
+uint64_t budgetDeadline(BudgetMeter* meter)
+{
+    if (meter->deadlineNs == 0 && meter->limits.timeoutNs != 0)
+    {
+        meter->deadlineNs = monotonicNs() + meter->limits.timeoutNs;
+    }
+    return meter->deadlineNs;
+}
+
+static const char* budgetMessages[] =
+{
+    "Within budget.",
+    "Out of fuel.",
+    "Over the heap budget.",
+    "Deadline exceeded."
+};
+
+const char* budgetMessage(BudgetStatus status)
+{
+    return budgetMessages[status];
+}
\ No newline at end of file
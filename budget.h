@@ -0,0 +1,87 @@
+#ifndef clox_budget_h
+#define clox_budget_h
+
+#include "common.h"
+
+/* The clock is only read at every this many checkpoints, a read costs about as much as a fiber switch */
+#define BUDGET_CLOCK_INTERVAL   0x40
+
+/*
+    Limits on a single run (interpret(), runChunk(), ...), 0 is no limit.
+    The language has no loops or calls, code between two fiber switches runs straight through, so fuel and
+    the deadline are checked at the switches (yield(), join(), spawn()ed fibers ending, full or empty channels)
+    and the end of the run, and can be overshot by at most one such stretch of code. The heap is checked
+    whenever it grows instead, see gcCheckHeapBudget()
+*/
+typedef struct
+{
+    /* Bytes of bytecode executed, an instruction is 1 to 4 of them */
+    uint64_t fuel;
+    /* Live bytes of the VM's GC heap, see gcHeapBytes(). Code, tables and compile scratch don't count */
+    size_t heapBytes;
+    /*
+        Wall clock, from the end of the run's first stretch (runs over by then never read the clock at all).
+        Also cuts short a thread blocked on a channel
+    */
+    uint64_t timeoutNs;
+} Budget;
+
+typedef enum
+{
+    BUDGET_OK,
+    BUDGET_FUEL,
+    BUDGET_HEAP,
+    BUDGET_DEADLINE
+} BudgetStatus;
+
+/* What is left of a Budget during a run */
+typedef struct
+{
+    Budget limits;
+    /* Any limit at all, the checkpoints skip everything else when not */
+    bool enabled;
+    uint64_t fuelLeft;
+    /* CLOCK_MONOTONIC, 0 until the clock is first read */
+    uint64_t deadlineNs;
+    int clockCountdown;
+    /* Where the running fiber's current stretch of code started */
+    const uint8_t* segmentStart;
+    /* Why the last run stopped early, if it did */
+    BudgetStatus status;
+} BudgetMeter;
+
+/* From CLOX_FUEL, CLOX_MAX_HEAP (bytes) and CLOX_TIMEOUT_MS, read once per process */
+Budget defaultBudget();
+void initBudgetMeter(BudgetMeter* meter, Budget limits);
+/* At the start of a run: full tank, no deadline yet */
+void startBudgetMeter(BudgetMeter* meter);
+/* The clock part of checkBudgetMeter() */
+bool checkBudgetClock(BudgetMeter* meter);
+/* For a blocked channel wait, started now if it hasn't been yet. 0 for no timeout */
+uint64_t budgetDeadline(BudgetMeter* meter);
+const char* budgetMessage(BudgetStatus status);
+uint64_t monotonicNs();
+
+/*
+    Charge the stretch that ended at ip. Now and then, unless it's the end of the run anyway,
+    look at the clock too. False once out of fuel or time. Inline, it runs at every fiber switch
+*/
+static inline bool checkBudgetMeter(BudgetMeter* meter, const uint8_t* ip, bool lastStretch)
+{
+    /* No stretch yet when the first fiber is switched in */
+    uint64_t used = meter->segmentStart != NULL ? (uint64_t)(ip - meter->segmentStart) : 0;
+    if (used > meter->fuelLeft)
+    {
+        meter->fuelLeft = 0;
+        meter->status = BUDGET_FUEL;
+        return false;
+    }
+    meter->fuelLeft -= used;
+    if (meter->limits.timeoutNs != 0 && !lastStretch && --meter->clockCountdown <= 0)
+    {
+        return checkBudgetClock(meter);
+    }
+    return true;
+}
+
+#endif
\ No newline at end of file
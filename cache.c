@@ -0,0 +1,257 @@
+#include <string.h>
+
+#include "cache.h"
+#include "hash.h"
+
+void initChunkCache(ChunkCache* cache, Allocator* allocator, size_t limit)
+{
+    cache->allocator = allocator;
+    cache->buckets = NULL;
+    cache->bucketCount = 0;
+    cache->count = 0;
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->bytes = 0;
+    cache->limit = limit;
+    memset(cache->ghosts, 0, sizeof(cache->ghosts));
+    cache->ghostClock = 0;
+    memset(&(cache->stats), 0, sizeof(ChunkCacheStats));
+}
+
+static void unlinkEntry(ChunkCache* cache, CacheEntry* entry)
+{
+    if (entry->newer != NULL)
+    {
+        entry->newer->older = entry->older;
+    }
+    else
+    {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL)
+    {
+        entry->older->newer = entry->newer;
+    }
+    else
+    {
+        cache->oldest = entry->newer;
+    }
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+static void pushNewest(ChunkCache* cache, CacheEntry* entry)
+{
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL)
+    {
+        cache->newest->newer = entry;
+    }
+    else
+    {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+static CacheEntry** findSlot(ChunkCache* cache, const char* source, size_t length, uint64_t hash)
+{
+    CacheEntry** slot = &(cache->buckets[hash & (uint64_t)(cache->bucketCount - 1)]);
+    while (*slot != NULL)
+    {
+        CacheEntry* entry = *slot;
+        if (entry->hash == hash && entry->length == length && memcmp(entry->source, source, length) == 0)
+        {
+            break;
+        }
+        slot = &(entry->chain);
+    }
+    return slot;
+}
+
+static void removeEntry(ChunkCache* cache, CacheEntry** slot)
+{
+    CacheEntry* entry = *slot;
+    *slot = entry->chain;
+    unlinkEntry(cache, entry);
+    cache->count--;
+    cache->bytes -= entry->bytes;
+
+    freeChunk(&(entry->chunk));
+    reallocateWith(cache->allocator, MEM_CHUNK_CACHE, entry->source, entry->length, 0);
+    reallocateWith(cache->allocator, MEM_CHUNK_CACHE, entry, sizeof(CacheEntry), 0);
+}
+
+static void removeOldest(ChunkCache* cache)
+{
+    CacheEntry* oldest = cache->oldest;
+    removeEntry(cache, findSlot(cache, oldest->source, oldest->length, oldest->hash));
+}
+
+static void evictDownTo(ChunkCache* cache, size_t limit)
+{
+    while (cache->oldest != NULL && cache->bytes > limit)
+    {
+        removeOldest(cache);
+        cache->stats.evictions++;
+    }
+}
+
+static void growBuckets(ChunkCache* cache)
+{
+    int bucketCount = cache->bucketCount == 0 ? CHUNK_CACHE_INITIAL_BUCKETS : cache->bucketCount * 2;
+    CacheEntry** buckets = GROW_ARRAY(cache->allocator, MEM_CHUNK_CACHE, CacheEntry*, NULL, 0, bucketCount);
+    memset(buckets, 0, sizeof(CacheEntry*) * bucketCount);
+    for (int i = 0; i < cache->bucketCount; i++)
+    {
+        CacheEntry* entry = cache->buckets[i];
+        while (entry != NULL)
+        {
+            CacheEntry* next = entry->chain;
+            CacheEntry** bucket = &(buckets[entry->hash & (uint64_t)(bucketCount - 1)]);
+            entry->chain = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    FREE_ARRAY(cache->allocator, MEM_CHUNK_CACHE, CacheEntry*, cache->buckets, cache->bucketCount);
+    cache->buckets = buckets;
+    cache->bucketCount = bucketCount;
+}
+
+Chunk* lookupChunk(ChunkCache* cache, const char* source, size_t length, uint64_t hash)
+{
+    CacheEntry* entry = cache->count > 0 ? *findSlot(cache, source, length, hash) : NULL;
+    if (entry == NULL)
+    {
+        cache->stats.misses++;
+        return NULL;
+    }
+    cache->stats.hits++;
+    if (cache->newest != entry)
+    {
+        unlinkEntry(cache, entry);
+        pushNewest(cache, entry);
+    }
+    return &(entry->chunk);
+}
+
+Chunk* storeChunk(ChunkCache* cache, const char* source, size_t length, uint64_t hash, Chunk* compiled)
+{
+    /* A set-associative filter of recent misses: the first miss only leaves the hash here */
+    uint64_t* set = &(cache->ghosts[(hash % (CHUNK_CACHE_GHOSTS / CHUNK_CACHE_GHOST_WAYS)) * CHUNK_CACHE_GHOST_WAYS]);
+    uint64_t* ghost = NULL;
+    for (int way = 0; way < CHUNK_CACHE_GHOST_WAYS; way++)
+    {
+        if (set[way] == hash)
+        {
+            ghost = &(set[way]);
+        }
+    }
+    if (ghost == NULL)
+    {
+        set[cache->ghostClock++ % CHUNK_CACHE_GHOST_WAYS] = hash;
+        cache->stats.rejected++;
+        return NULL;
+    }
+
+    size_t bytes = sizeof(CacheEntry) + length + (size_t)compiled->count +
+                   sizeof(LineRun) * (size_t)compiled->lineCount + sizeof(Value) * (size_t)compiled->constants.count;
+    if (bytes > cache->limit)
+    {
+        return NULL;
+    }
+    evictDownTo(cache, cache->limit - bytes);
+    if (cache->count >= cache->bucketCount)
+    {
+        growBuckets(cache);
+    }
+
+    CacheEntry* entry = reallocateWith(cache->allocator, MEM_CHUNK_CACHE, NULL, 0, sizeof(CacheEntry));
+    entry->hash = hash;
+    entry->source = reallocateWith(cache->allocator, MEM_CHUNK_CACHE, NULL, 0, length);
+    memcpy(entry->source, source, length);
+    entry->length = length;
+    entry->bytes = bytes;
+    initChunkWith(&(entry->chunk), cache->allocator);
+    copyChunk(&(entry->chunk), compiled);
+
+    CacheEntry** bucket = &(cache->buckets[hash & (uint64_t)(cache->bucketCount - 1)]);
+    entry->chain = *bucket;
+    *bucket = entry;
+    pushNewest(cache, entry);
+    cache->count++;
+    cache->bytes += bytes;
+    *ghost = 0;
+    return &(entry->chunk);
+}
+
+bool invalidateChunk(ChunkCache* cache, const char* source, size_t length)
+{
+    if (cache->count == 0)
+    {
+        return false;
+    }
+    CacheEntry** slot = findSlot(cache, source, length, hashBytes(source, length, 0));
+    if (*slot == NULL)
+    {
+        return false;
+    }
+    removeEntry(cache, slot);
+    cache->stats.invalidations++;
+    return true;
+}
+
+void invalidateChunkCache(ChunkCache* cache)
+{
+    while (cache->oldest != NULL)
+    {
+        removeOldest(cache);
+        cache->stats.invalidations++;
+    }
+}
+
+void setChunkCacheLimit(ChunkCache* cache, size_t limit)
+{
+    cache->limit = limit;
+    evictDownTo(cache, limit);
+}
+
+void markChunkCacheRoots(VM* vm, ChunkCache* cache, void (*visit)(VM* vm, Value* slot))
+{
+    for (CacheEntry* entry = cache->newest; entry != NULL; entry = entry->older)
+    {
+        for (int i = 0; i < entry->chunk.constants.count; i++)
+        {
+            visit(vm, &(entry->chunk.constants.values[i]));
+        }
+    }
+}
+
+void freeChunkCache(ChunkCache* cache)
+{
+    while (cache->oldest != NULL)
+    {
+        removeOldest(cache);
+    }
+    FREE_ARRAY(cache->allocator, MEM_CHUNK_CACHE, CacheEntry*, cache->buckets, cache->bucketCount);
+    cache->buckets = NULL;
+    cache->bucketCount = 0;
+}
+
+void dumpChunkCacheStats(FILE* stream, ChunkCache* cache)
+{
+    ChunkCacheStats* stats = &(cache->stats);
+    uint64_t lookups = stats->hits + stats->misses;
+    fprintf(stream, "---------- CHUNK CACHE ----------\n");
+    fprintf(stream, "%-20s %14d\n", "chunks", cache->count);
+    fprintf(stream, "%-20s %14zu\n", "bytes", cache->bytes);
+    fprintf(stream, "%-20s %14zu\n", "limit", cache->limit);
+    fprintf(stream, "%-20s %14llu\n", "hits", (unsigned long long)stats->hits);
+    fprintf(stream, "%-20s %14llu\n", "misses", (unsigned long long)stats->misses);
+    fprintf(stream, "%-20s %14llu\n", "first sightings", (unsigned long long)stats->rejected);
+    fprintf(stream, "%-20s %14llu\n", "evictions", (unsigned long long)stats->evictions);
+    fprintf(stream, "%-20s %14llu\n", "invalidations", (unsigned long long)stats->invalidations);
+    fprintf(stream, "%-20s %13.1f%%\n", "hit rate", lookups > 0 ? 100.0 * stats->hits / lookups : 0.0);
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "chunk.h"
+
+/* Default budget for cached chunks, setChunkCacheLimit() or CLOX_CHUNK_CACHE changes it, 0 turns the cache off */
+#define CHUNK_CACHE_DEFAULT_LIMIT   0x800000
+#define CHUNK_CACHE_INITIAL_BUCKETS 0x40
+/* Remembered hashes of sources seen once, see storeChunk(). 4-way, so two hot sources rarely evict each other */
+#define CHUNK_CACHE_GHOSTS          0x1000
+#define CHUNK_CACHE_GHOST_WAYS      4
+
+typedef struct CacheEntry
+{
+    uint64_t hash;
+    /* Own copy of the source, a hash match alone is not proof enough */
+    char* source;
+    size_t length;
+    /* Everything this entry holds, counted against the limit */
+    size_t bytes;
+    /* Sized exactly, never written once it is in here */
+    Chunk chunk;
+    /* LRU order, newest first */
+    struct CacheEntry* newer;
+    struct CacheEntry* older;
+    /* Next entry in the same bucket */
+    struct CacheEntry* chain;
+} CacheEntry;
+
+typedef struct
+{
+    uint64_t hits;
+    uint64_t misses;
+    /* Misses seen for the first time, compiled but not kept */
+    uint64_t rejected;
+    uint64_t evictions;
+    uint64_t invalidations;
+} ChunkCacheStats;
+
+/*
+    Source text -> compiled chunk, least recently used goes first once the cached bytes exceed the limit.
+    Keyed by hashBytes() of the source, so a hit costs a hash and a memcmp() instead of a scan and a compile.
+    The constants of cached chunks are GC roots (markChunkCacheRoots())
+*/
+typedef struct
+{
+    Allocator* allocator;
+    CacheEntry** buckets;
+    int bucketCount;
+    int count;
+    CacheEntry* newest;
+    CacheEntry* oldest;
+    size_t bytes;
+    size_t limit;
+    uint64_t ghosts[CHUNK_CACHE_GHOSTS];
+    unsigned int ghostClock;
+    ChunkCacheStats stats;
+} ChunkCache;
+
+void initChunkCache(ChunkCache* cache, Allocator* allocator, size_t limit);
+void freeChunkCache(ChunkCache* cache);
+/* The cached chunk for this exact source, or NULL. A hit makes it the newest */
+Chunk* lookupChunk(ChunkCache* cache, const char* source, size_t length, uint64_t hash);
+/*
+    Keep a copy of compiled, the chunk a lookupChunk() for source just missed. One-off sources are not worth
+    the copy, so a source is only admitted the second time it misses. NULL when it wasn't kept
+*/
+Chunk* storeChunk(ChunkCache* cache, const char* source, size_t length, uint64_t hash, Chunk* compiled);
+/* Drop the chunk for source, true if there was one */
+bool invalidateChunk(ChunkCache* cache, const char* source, size_t length);
+/* Drop every chunk (e.g. after the compiler's behavior changed), the counters stay */
+void invalidateChunkCache(ChunkCache* cache);
+/* Evicts right away if the cache is over the new limit */
+void setChunkCacheLimit(ChunkCache* cache, size_t limit);
+void markChunkCacheRoots(VM* vm, ChunkCache* cache, void (*visit)(VM* vm, Value* slot));
+void dumpChunkCacheStats(FILE* stream, ChunkCache* cache);
+
+#endif
\ No newline at end of file
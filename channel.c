@@ -0,0 +1,337 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "budget.h"
+#include "channel.h"
+#include "object.h"
+#include "vm.h"
+
+/* Sleep until *word is no longer expected, timeout runs out (NULL: never) or for no reason at all, callers check again */
+static void futexWait(atomic_uint* word, unsigned expected, const struct timespec* timeout)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+static void futexWakeAll(atomic_uint* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline void spinPause()
+{
+    #if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+    #endif
+}
+
+Channel* newChannel(ChannelKind kind, int capacity)
+{
+    size_t size = 2;
+    while (size < (size_t)capacity)
+    {
+        size *= 2;
+    }
+
+    /* Straight from libc, like a FrozenChunk: no VM owns it and any thread may free it */
+    Channel* channel = aligned_alloc(CHANNEL_CACHE_LINE, (sizeof(Channel) + CHANNEL_CACHE_LINE - 1) & ~(size_t)(CHANNEL_CACHE_LINE - 1));
+    ChannelCell* cells = calloc(size, sizeof(ChannelCell));
+    if (channel == NULL || cells == NULL)
+    {
+        fprintf(stderr, "Out of memory making a channel.\n");
+        free(channel);
+        free(cells);
+        return NULL;
+    }
+    memset(channel, 0, sizeof(Channel));
+    channel->kind = kind;
+    channel->mask = size - 1;
+    channel->cells = cells;
+    for (size_t i = 0; i < size; i++)
+    {
+        atomic_init(&(cells[i].sequence), i);
+    }
+    atomic_init(&(channel->refCount), 1);
+    atomic_init(&(channel->head), 0);
+    atomic_init(&(channel->tail), 0);
+    atomic_init(&(channel->sent), 0);
+    atomic_init(&(channel->received), 0);
+    atomic_init(&(channel->sleepingReceivers), 0);
+    atomic_init(&(channel->sleepingSenders), 0);
+    return channel;
+}
+
+Channel* retainChannel(Channel* channel)
+{
+    atomic_fetch_add_explicit(&(channel->refCount), 1, memory_order_relaxed);
+    return channel;
+}
+
+void releaseChannel(Channel* channel)
+{
+    if (atomic_fetch_sub_explicit(&(channel->refCount), 1, memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+    Message message;
+    while (tryReceiveMessage(channel, &message))
+    {
+        freeMessage(&message);
+    }
+    free(channel->cells);
+    free(channel);
+}
+
+/* Whoever sleeps on the other end has something to look at now */
+static void wakeSleepers(atomic_uint* word, atomic_int* sleepers)
+{
+    /* Pairs with the sleeper's increment: either it sees our change, or we see it sleeping */
+    atomic_thread_fence(memory_order_seq_cst);
+    /*
+        Taking the count wakes everybody counted once. A woken thread may not run for a while (on one core it
+        certainly won't), without this every message until then would pay for another futex call
+    */
+    if (atomic_load_explicit(sleepers, memory_order_relaxed) > 0 && atomic_exchange(sleepers, 0) > 0)
+    {
+        atomic_fetch_add(word, 1);
+        futexWakeAll(word);
+    }
+}
+
+bool trySendMessage(Channel* channel, Message* message)
+{
+    size_t tail = atomic_load_explicit(&(channel->tail), memory_order_relaxed);
+    ChannelCell* cell;
+    if (channel->kind == CHANNEL_SPSC)
+    {
+        /* Only the sender writes tail and cachedHead, only the receiver head */
+        if (tail - channel->cachedHead > channel->mask)
+        {
+            channel->cachedHead = atomic_load_explicit(&(channel->head), memory_order_acquire);
+            if (tail - channel->cachedHead > channel->mask)
+            {
+                return false;
+            }
+        }
+        cell = &(channel->cells[tail & channel->mask]);
+        cell->message = *message;
+        atomic_store_explicit(&(channel->tail), tail + 1, memory_order_release);
+    }
+    else
+    {
+        while (true)
+        {
+            cell = &(channel->cells[tail & channel->mask]);
+            size_t sequence = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)tail;
+            if (difference == 0)
+            {
+                /* The cell is free on this lap, claim it */
+                if (atomic_compare_exchange_weak_explicit(&(channel->tail), &tail, tail + 1,
+                                                          memory_order_relaxed, memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                /* Still holds last lap's message */
+                return false;
+            }
+            else
+            {
+                tail = atomic_load_explicit(&(channel->tail), memory_order_relaxed);
+            }
+        }
+        cell->message = *message;
+        atomic_store_explicit(&(cell->sequence), tail + 1, memory_order_release);
+    }
+    wakeSleepers(&(channel->sent), &(channel->sleepingReceivers));
+    return true;
+}
+
+bool tryReceiveMessage(Channel* channel, Message* message)
+{
+    size_t head = atomic_load_explicit(&(channel->head), memory_order_relaxed);
+    ChannelCell* cell;
+    if (channel->kind == CHANNEL_SPSC)
+    {
+        if (head == channel->cachedTail)
+        {
+            channel->cachedTail = atomic_load_explicit(&(channel->tail), memory_order_acquire);
+            if (head == channel->cachedTail)
+            {
+                return false;
+            }
+        }
+        cell = &(channel->cells[head & channel->mask]);
+        *message = cell->message;
+        atomic_store_explicit(&(channel->head), head + 1, memory_order_release);
+    }
+    else
+    {
+        while (true)
+        {
+            cell = &(channel->cells[head & channel->mask]);
+            size_t sequence = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(head + 1);
+            if (difference == 0)
+            {
+                if (atomic_compare_exchange_weak_explicit(&(channel->head), &head, head + 1,
+                                                          memory_order_relaxed, memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                /* Not written yet */
+                return false;
+            }
+            else
+            {
+                head = atomic_load_explicit(&(channel->head), memory_order_relaxed);
+            }
+        }
+        *message = cell->message;
+        /* Free for the sender one lap later */
+        atomic_store_explicit(&(cell->sequence), head + channel->mask + 1, memory_order_release);
+    }
+    wakeSleepers(&(channel->received), &(channel->sleepingSenders));
+    return true;
+}
+
+static bool looksFull(Channel* channel)
+{
+    return atomic_load(&(channel->tail)) - atomic_load(&(channel->head)) > channel->mask;
+}
+
+static bool looksEmpty(Channel* channel)
+{
+    return atomic_load(&(channel->tail)) == atomic_load(&(channel->head));
+}
+
+static bool waitFor(Channel* channel, bool (*blocked)(Channel*), atomic_uint* word, atomic_int* sleepers,
+                    uint64_t deadlineNs)
+{
+    for (int spin = 0; spin < CHANNEL_SPIN; spin++)
+    {
+        if (!blocked(channel))
+        {
+            return true;
+        }
+        spinPause();
+    }
+    struct timespec timeout;
+    if (deadlineNs != 0)
+    {
+        uint64_t now = monotonicNs();
+        if (now >= deadlineNs)
+        {
+            return false;
+        }
+        timeout.tv_sec = (time_t)((deadlineNs - now) / 1000000000ull);
+        timeout.tv_nsec = (long)((deadlineNs - now) % 1000000000ull);
+    }
+    unsigned seen = atomic_load(word);
+    /* Only the waker takes it back. Counting too many sleepers costs one needless wake, too few a lost one */
+    atomic_fetch_add(sleepers, 1);
+    if (blocked(channel))
+    {
+        futexWait(word, seen, deadlineNs != 0 ? &timeout : NULL);
+    }
+    return true;
+}
+
+bool waitToSend(Channel* channel, uint64_t deadlineNs)
+{
+    return waitFor(channel, looksFull, &(channel->received), &(channel->sleepingSenders), deadlineNs);
+}
+
+bool waitToReceive(Channel* channel, uint64_t deadlineNs)
+{
+    return waitFor(channel, looksEmpty, &(channel->sent), &(channel->sleepingReceivers), deadlineNs);
+}
+
+bool messageFromValue(VM* vm, Value* value, Message* message)
+{
+    if (IS_NUMBER(*value))
+    {
+        *message = (Message){ NULL, 0, AS_NUMBER(*value) };
+        return true;
+    }
+    if (!IS_TEXT(*value))
+    {
+        return false;
+    }
+    /* Nothing of the sender's heap may leak into the receiver's, so the characters go out on their own */
+    ObjString* string = flattenText(vm, value);
+    char* chars = malloc((size_t)string->length + 1);
+    if (chars == NULL)
+    {
+        /* Unwinds the sending VM like running out of heap would */
+        reportOutOfMemory((size_t)string->length + 1);
+    }
+    memcpy(chars, string->chars, (size_t)string->length);
+    chars[string->length] = '\0';
+    *message = (Message){ chars, string->length, 0, string->hash };
+    return true;
+}
+
+Value valueFromMessage(VM* vm, Message* message)
+{
+    if (message->chars == NULL)
+    {
+        return NUMBER_VAL(message->number);
+    }
+    /* recoverFromError() frees the inbox, copyHashedString() may unwind */
+    if (message != &(vm->inbox))
+    {
+        freeMessage(&(vm->inbox));
+        vm->inbox = *message;
+        message->chars = NULL;
+    }
+    Value value = OBJ_VAL(copyHashedString(vm, vm->inbox.chars, vm->inbox.length, vm->inbox.hash));
+    freeMessage(&(vm->inbox));
+    return value;
+}
+
+void freeMessage(Message* message)
+{
+    free(message->chars);
+    message->chars = NULL;
+}
+
+void initChannelTable(ChannelTable* table, Allocator* allocator)
+{
+    table->allocator = allocator;
+    table->channels = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
+
+void freeChannelTable(ChannelTable* table)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        releaseChannel(table->channels[i]);
+    }
+    FREE_ARRAY(table->allocator, MEM_TABLES, Channel*, table->channels, table->capacity);
+    initChannelTable(table, table->allocator);
+}
+
+int attachChannel(ChannelTable* table, Channel* channel)
+{
+    if (table->count == table->capacity)
+    {
+        int capacity = GROW_CAPACITY(table->capacity);
+        table->channels = GROW_ARRAY(table->allocator, MEM_TABLES, Channel*, table->channels, table->capacity, capacity);
+        table->capacity = capacity;
+    }
+    table->channels[table->count] = retainChannel(channel);
+    return table->count++;
+}
\ No newline at end of file
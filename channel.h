@@ -0,0 +1,107 @@
+#ifndef clox_channel_h
+#define clox_channel_h
+
+#include <stdatomic.h>
+
+#include "value.h"
+#include "memory.h"
+
+/* Spins before a blocked sender or receiver sleeps in the kernel */
+#define CHANNEL_SPIN            0x100
+/* Keeps the two ends of a channel on different cache lines */
+#define CHANNEL_CACHE_LINE      64
+
+typedef enum
+{
+    /* One sending thread and one receiving thread, no read-modify-write at all */
+    CHANNEL_SPSC,
+    /* Any number of either, Vyukov's bounded queue */
+    CHANNEL_MPMC
+} ChannelKind;
+
+/*
+    A value on its way from one VM to another. Numbers travel as they are, strings as a malloc()'ed copy
+    that the channel owns until a receiver takes it over
+*/
+typedef struct
+{
+    /* NULL for a number */
+    char* chars;
+    int length;
+    double number;
+    /* The sender's hashString() of chars, the receiver interns without another pass */
+    uint32_t hash;
+} Message;
+
+typedef struct
+{
+    /* MPMC only: which lap of the ring the cell is ready for */
+    atomic_size_t sequence;
+    Message message;
+} ChannelCell;
+
+/*
+    Bounded lock-free ring buffer of messages, shared by any number of VMs on any threads.
+    Reference counted like a FrozenChunk, whoever drops the last reference frees it with whatever is still in it
+*/
+typedef struct
+{
+    ChannelKind kind;
+    size_t mask;
+    ChannelCell* cells;
+    atomic_int refCount;
+    /* Receiving end */
+    _Alignas(CHANNEL_CACHE_LINE) atomic_size_t head;
+    /* SPSC: the receiver's last look at tail, so it only touches the sender's line when it seems empty */
+    size_t cachedTail;
+    /* Sending end */
+    _Alignas(CHANNEL_CACHE_LINE) atomic_size_t tail;
+    size_t cachedHead;
+    /* Futex words, only bumped when somebody sleeps on them */
+    _Alignas(CHANNEL_CACHE_LINE) atomic_uint sent;
+    atomic_int sleepingReceivers;
+    _Alignas(CHANNEL_CACHE_LINE) atomic_uint received;
+    atomic_int sleepingSenders;
+} Channel;
+
+/* The channels a VM's scripts can use, send(id, ...) and receive(id) index into this */
+typedef struct
+{
+    Allocator* allocator;
+    Channel** channels;
+    int count;
+    int capacity;
+} ChannelTable;
+
+/* capacity is rounded up to a power of two. The caller holds the one reference */
+Channel* newChannel(ChannelKind kind, int capacity);
+Channel* retainChannel(Channel* channel);
+/* Safe from any thread */
+void releaseChannel(Channel* channel);
+
+/* Never block. false when full (the message stays the caller's) or empty */
+bool trySendMessage(Channel* channel, Message* message);
+bool tryReceiveMessage(Channel* channel, Message* message);
+/*
+    Block the thread until the channel looks like it has room / something in it. Spins first, then sleeps.
+    deadlineNs is CLOCK_MONOTONIC, 0 waits for as long as it takes. False once the deadline has passed
+*/
+bool waitToSend(Channel* channel, uint64_t deadlineNs);
+bool waitToReceive(Channel* channel, uint64_t deadlineNs);
+
+/* Deep copy of *value (a rope is flattened in place first). false if it is neither a number nor a string */
+bool messageFromValue(VM* vm, Value* value, Message* message);
+/*
+    The receiving VM's own copy, the message's string is freed. Until then the message sits in vm->inbox, so it is
+    freed as well if the copy runs out of memory
+*/
+Value valueFromMessage(VM* vm, Message* message);
+void freeMessage(Message* message);
+
+void initChannelTable(ChannelTable* table, Allocator* allocator);
+/* Drops the VM's references */
+void freeChannelTable(ChannelTable* table);
+/* The VM takes a reference of its own. Returns the id scripts use for it */
+int attachChannel(ChannelTable* table, Channel* channel);
+
+#endif
\ No newline at end of file
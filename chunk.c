@@ -1,17 +1,27 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "chunk.h"
 #include "memory.h"
 
 /* Initialization of the Chunk */
 void initChunk(Chunk* chunk)
+{
+    initChunkWith(chunk, &defaultAllocator);
+}
+
+void initChunkWith(Chunk* chunk, Allocator* allocator)
 {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->line = 0;
     chunk->pos = 0;
     chunk->code = NULL;
-    initValueArray(&(chunk->constants));
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
+    chunk->lines = NULL;
+    chunk->allocator = allocator;
+    initValueArrayWith(&(chunk->constants), allocator);
 }
 
 /*
@@ -25,7 +35,21 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line, int pos)
     {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+        chunk->code = GROW_ARRAY(chunk->allocator, MEM_CHUNK_CODE, uint8_t, chunk->code, oldCapacity, chunk->capacity);
+    }
+
+    /* Operands share their opcode's position, so most bytes don't start a run */
+    LineRun* last = chunk->lineCount > 0 ? &(chunk->lines[chunk->lineCount - 1]) : NULL;
+    if (last == NULL || last->line != line || last->pos != pos)
+    {
+        if (chunk->lineCount == chunk->lineCapacity)
+        {
+            int oldCapacity = chunk->lineCapacity;
+            chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+            chunk->lines = GROW_ARRAY(chunk->allocator, MEM_CHUNK_CODE, LineRun, chunk->lines, oldCapacity, chunk->lineCapacity);
+        }
+        chunk->lines[chunk->lineCount] = (LineRun){ chunk->count, line, pos };
+        chunk->lineCount++;
     }
 
     chunk->code[chunk->count] = byte;
@@ -61,6 +85,28 @@ void writeConstant(Chunk* chunk, Value value, int line, int pos)
     }
 }
 
+LineRun getLineRun(Chunk* chunk, int offset)
+{
+    /* Last run starting at or before offset */
+    int low = 0;
+    int high = chunk->lineCount - 1;
+    LineRun found = { offset, 0, 0 };
+    while (low <= high)
+    {
+        int middle = low + (high - low) / 2;
+        if (chunk->lines[middle].offset <= offset)
+        {
+            found = chunk->lines[middle];
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return found;
+}
+
 /*
     Also return the index of the Value for easy indexing
 */
@@ -72,9 +118,42 @@ int addConstant(Chunk* chunk, Value value)
 
 
 
+void copyChunk(Chunk* dest, Chunk* src)
+{
+    freeChunk(dest);
+
+    dest->code = GROW_ARRAY(dest->allocator, MEM_CHUNK_CODE, uint8_t, NULL, 0, src->count);
+    memcpy(dest->code, src->code, src->count);
+    dest->count = src->count;
+    dest->capacity = src->count;
+    dest->line = src->line;
+    dest->pos = src->pos;
+
+    dest->lines = GROW_ARRAY(dest->allocator, MEM_CHUNK_CODE, LineRun, NULL, 0, src->lineCount);
+    memcpy(dest->lines, src->lines, sizeof(LineRun) * src->lineCount);
+    dest->lineCount = src->lineCount;
+    dest->lineCapacity = src->lineCount;
+
+    ValueArray* constants = &(dest->constants);
+    constants->values = GROW_ARRAY(dest->allocator, MEM_CONSTANTS, Value, NULL, 0, src->constants.count);
+    memcpy(constants->values, src->constants.values, sizeof(Value) * src->constants.count);
+    constants->count = src->constants.count;
+    constants->capacity = src->constants.count;
+}
+
+void resetChunk(Chunk* chunk)
+{
+    chunk->count = 0;
+    chunk->line = 0;
+    chunk->pos = 0;
+    chunk->lineCount = 0;
+    chunk->constants.count = 0;
+}
+
 void freeChunk(Chunk* chunk)
 {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(chunk->allocator, MEM_CHUNK_CODE, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(chunk->allocator, MEM_CHUNK_CODE, LineRun, chunk->lines, chunk->lineCapacity);
     freeValueArray(&(chunk->constants));
-    initChunk(chunk);
+    initChunkWith(chunk, chunk->allocator);
 }
\ No newline at end of file
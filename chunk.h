@@ -2,6 +2,7 @@
 #define clox_chunk_h
 
 #include "common.h"
+#include "memory.h"
 #include "value.h"
 
 /* Enumeration of all opcodes */
@@ -15,6 +16,15 @@ typedef enum
         OP_CONSTANT_LONG - Top byte - Middle byte - Low byte
     */
     OP_CONSTANT_LONG,
+    /* Named input (see compileSlotsWith()), 1 byte OpRand -> index of the slot */
+    OP_SLOT,
+    /* Fibers: 2 byte OpRand (big endian) -> length of the child's code, which follows inline */
+    OP_SPAWN,
+    OP_YIELD,
+    OP_JOIN,
+    /* Channels between VMs */
+    OP_SEND,
+    OP_RECEIVE,
     /* Unary */
     OP_NEGATE,
     /* Binary */
@@ -26,6 +36,14 @@ typedef enum
     OP_RETURN,
 } Opcode;
 
+/* Source position of the code from offset up to the next run, run-length encoded */
+typedef struct
+{
+    int offset;
+    int line;
+    int pos;
+} LineRun;
+
 /* An array of binary instructions */
 typedef struct
 {
@@ -35,11 +53,19 @@ typedef struct
     int line;
     int pos;
     uint8_t* code;
+    /* Line table, a new run only where line or pos changes */
+    int lineCount;
+    int lineCapacity;
+    LineRun* lines;
     ValueArray constants;
+    /* Code and constants are both allocated from here */
+    Allocator* allocator;
 } Chunk;
 
-/* Initialization of the Chunk */
+/* Initialization of the Chunk, with the default allocator */
 void initChunk(Chunk* chunk);
+/* Same, but code and constants come from allocator (e.g. the VM's) */
+void initChunkWith(Chunk* chunk, Allocator* allocator);
 
 /*
     If the capacity is 0, initialize some capacities;
@@ -51,9 +77,23 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line, int pos);
 
 void writeConstant(Chunk* chunk, Value value, int line, int pos);
 
+/* Line and pos of the instruction at offset, from the line table */
+LineRun getLineRun(Chunk* chunk, int offset);
+
 /* Convenient function exposed to users to write a constant */
 int addConstant(Chunk* chunk, Value value);
 
+/*
+    Copy code and constants of src into dest (initialized, usually with a longer-lived allocator than src's),
+    sized exactly. This is how a chunk compiled in an arena outlives the arena
+*/
+void copyChunk(Chunk* dest, Chunk* src);
+
+/*
+    Empty the chunk but keep its arrays, so refilling it does not allocate
+*/
+void resetChunk(Chunk* chunk);
+
 /*
     Free dynamic array chunk->code and re-initialize chunk
 */
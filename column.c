@@ -0,0 +1,296 @@
+#include <string.h>
+
+#include "column.h"
+#include "vm.h"
+
+/*
+    GCC vector extensions: four doubles per operation, SSE2 pairs by default and one AVX
+    instruction when built with -mavx. Loads and stores go through memcpy(), columns may be unaligned
+*/
+typedef double Lanes __attribute__((vector_size(32)));
+#define LANE_COUNT  (sizeof(Lanes) / sizeof(double))
+
+/* A block on the evaluation stack, either a whole column of values or one value for every row */
+typedef struct
+{
+    const double* column;
+    double scalar;
+} Operand;
+
+#define BINARY_KERNELS(name, op) \
+    static void name##Columns(double* destination, const double* left, const double* right, size_t count) \
+    { \
+        size_t i = 0; \
+        for (; i + LANE_COUNT <= count; i += LANE_COUNT) \
+        { \
+            Lanes l, r; \
+            memcpy(&l, left + i, sizeof(Lanes)); \
+            memcpy(&r, right + i, sizeof(Lanes)); \
+            Lanes d = l op r; \
+            memcpy(destination + i, &d, sizeof(Lanes)); \
+        } \
+        for (; i < count; i++) \
+        { \
+            destination[i] = left[i] op right[i]; \
+        } \
+    } \
+    static void name##ColumnScalar(double* destination, const double* left, double right, size_t count) \
+    { \
+        size_t i = 0; \
+        for (; i + LANE_COUNT <= count; i += LANE_COUNT) \
+        { \
+            Lanes l; \
+            memcpy(&l, left + i, sizeof(Lanes)); \
+            Lanes d = l op right; \
+            memcpy(destination + i, &d, sizeof(Lanes)); \
+        } \
+        for (; i < count; i++) \
+        { \
+            destination[i] = left[i] op right; \
+        } \
+    } \
+    static void name##ScalarColumn(double* destination, double left, const double* right, size_t count) \
+    { \
+        size_t i = 0; \
+        for (; i + LANE_COUNT <= count; i += LANE_COUNT) \
+        { \
+            Lanes r; \
+            memcpy(&r, right + i, sizeof(Lanes)); \
+            Lanes d = left op r; \
+            memcpy(destination + i, &d, sizeof(Lanes)); \
+        } \
+        for (; i < count; i++) \
+        { \
+            destination[i] = left op right[i]; \
+        } \
+    }
+
+BINARY_KERNELS(add, +)
+BINARY_KERNELS(sub, -)
+BINARY_KERNELS(mul, *)
+BINARY_KERNELS(div, /)
+
+static void negateColumn(double* destination, const double* source, size_t count)
+{
+    size_t i = 0;
+    for (; i + LANE_COUNT <= count; i += LANE_COUNT)
+    {
+        Lanes s;
+        memcpy(&s, source + i, sizeof(Lanes));
+        Lanes d = -s;
+        memcpy(destination + i, &d, sizeof(Lanes));
+    }
+    for (; i < count; i++)
+    {
+        destination[i] = -source[i];
+    }
+}
+
+/* Operands of one kernel, the result goes to destination unless both are scalars */
+static void binaryBlock(Opcode op, Operand* left, Operand* right, double* destination, size_t count)
+{
+    if (left->column == NULL && right->column == NULL)
+    {
+        /* Folded, no kernel at all */
+        double l = left->scalar, r = right->scalar;
+        left->scalar = op == OP_ADD ? l + r : op == OP_SUB ? l - r : op == OP_MUL ? l * r : l / r;
+        return;
+    }
+
+    if (left->column != NULL && right->column != NULL)
+    {
+        switch (op)
+        {
+            case OP_ADD: addColumns(destination, left->column, right->column, count); break;
+            case OP_SUB: subColumns(destination, left->column, right->column, count); break;
+            case OP_MUL: mulColumns(destination, left->column, right->column, count); break;
+            default:     divColumns(destination, left->column, right->column, count); break;
+        }
+    }
+    else if (left->column != NULL)
+    {
+        switch (op)
+        {
+            case OP_ADD: addColumnScalar(destination, left->column, right->scalar, count); break;
+            case OP_SUB: subColumnScalar(destination, left->column, right->scalar, count); break;
+            case OP_MUL: mulColumnScalar(destination, left->column, right->scalar, count); break;
+            default:     divColumnScalar(destination, left->column, right->scalar, count); break;
+        }
+    }
+    else
+    {
+        switch (op)
+        {
+            case OP_ADD: addScalarColumn(destination, left->scalar, right->column, count); break;
+            case OP_SUB: subScalarColumn(destination, left->scalar, right->column, count); break;
+            case OP_MUL: mulScalarColumn(destination, left->scalar, right->column, count); break;
+            default:     divScalarColumn(destination, left->scalar, right->column, count); break;
+        }
+    }
+    left->column = destination;
+}
+
+/* Everything is checked once up front, so the block loop needs no checks. Returns the deepest stack, -1 if unfit */
+static int checkColumnChunk(Chunk* chunk, int inputCount)
+{
+    int depth = 0;
+    int maxDepth = 0;
+    int offset = 0;
+    while (offset < chunk->count)
+    {
+        switch (chunk->code[offset])
+        {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            {
+                int index = chunk->code[offset] == OP_CONSTANT ? chunk->code[offset + 1] :
+                    (chunk->code[offset + 1] << 16) + (chunk->code[offset + 2] << 8) + chunk->code[offset + 3];
+                if (!IS_NUMBER(chunk->constants.values[index]))
+                {
+                    return -1;
+                }
+                depth++;
+                offset += chunk->code[offset] == OP_CONSTANT ? 2 : 4;
+                break;
+            }
+            case OP_SLOT:
+            {
+                if (chunk->code[offset + 1] >= inputCount)
+                {
+                    return -1;
+                }
+                depth++;
+                offset += 2;
+                break;
+            }
+            case OP_NEGATE:
+            {
+                if (depth < 1)
+                {
+                    return -1;
+                }
+                offset++;
+                break;
+            }
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            {
+                if (depth < 2)
+                {
+                    return -1;
+                }
+                depth--;
+                offset++;
+                break;
+            }
+            case OP_RETURN:
+            {
+                return depth > 1 ? -1 : maxDepth;
+            }
+            default:
+            {
+                return -1;
+            }
+        }
+        maxDepth = depth > maxDepth ? depth : maxDepth;
+    }
+    return -1;
+}
+
+bool runColumnsWith(VM* vm, Chunk* chunk, const double* const* inputs, int inputCount, double* output, size_t rows)
+{
+    int maxDepth = checkColumnChunk(chunk, inputCount);
+    if (maxDepth < 0)
+    {
+        return false;
+    }
+
+    /* One block of scratch per stack slot, a kernel writes over its left operand's */
+    int scratchCount = maxDepth > 0 ? maxDepth : 1;
+    double* scratch = GROW_ARRAY(vm->allocator, MEM_VM_STACK, double, NULL, 0, (size_t)scratchCount * COLUMN_BLOCK);
+    Operand* stack = GROW_ARRAY(vm->allocator, MEM_VM_STACK, Operand, NULL, 0, scratchCount);
+
+    for (size_t base = 0; base < rows; base += COLUMN_BLOCK)
+    {
+        size_t count = rows - base < COLUMN_BLOCK ? rows - base : COLUMN_BLOCK;
+        int top = 0;
+        uint8_t* ip = chunk->code;
+        bool done = false;
+        while (!done)
+        {
+            Opcode op = *(ip++);
+            switch (op)
+            {
+                case OP_CONSTANT:
+                {
+                    stack[top].column = NULL;
+                    stack[top++].scalar = AS_NUMBER(chunk->constants.values[*(ip++)]);
+                    break;
+                }
+                case OP_CONSTANT_LONG:
+                {
+                    int index = (ip[0] << 16) + (ip[1] << 8) + ip[2];
+                    stack[top].column = NULL;
+                    stack[top++].scalar = AS_NUMBER(chunk->constants.values[index]);
+                    ip += 3;
+                    break;
+                }
+                case OP_SLOT:
+                {
+                    /* Straight out of the input, no copy */
+                    stack[top++].column = inputs[*(ip++)] + base;
+                    break;
+                }
+                case OP_NEGATE:
+                {
+                    Operand* operand = &stack[top - 1];
+                    if (operand->column == NULL)
+                    {
+                        operand->scalar = -operand->scalar;
+                        break;
+                    }
+                    /* The last kernel writes the output directly */
+                    double* destination = (*ip == OP_RETURN) ? output + base : scratch + (size_t)(top - 1) * COLUMN_BLOCK;
+                    negateColumn(destination, operand->column, count);
+                    operand->column = destination;
+                    break;
+                }
+                case OP_ADD:
+                case OP_SUB:
+                case OP_MUL:
+                case OP_DIV:
+                {
+                    double* destination = (*ip == OP_RETURN) ? output + base : scratch + (size_t)(top - 2) * COLUMN_BLOCK;
+                    binaryBlock(op, &stack[top - 2], &stack[top - 1], destination, count);
+                    top--;
+                    break;
+                }
+                default:
+                {
+                    /* OP_RETURN, checkColumnChunk() let nothing else through */
+                    Operand result = top > 0 ? stack[0] : (Operand){ NULL, 0 };
+                    if (result.column == NULL)
+                    {
+                        for (size_t i = 0; i < count; i++)
+                        {
+                            output[base + i] = result.scalar;
+                        }
+                    }
+                    else if (result.column != output + base)
+                    {
+                        /* A bare slot, or folded into a scalar before the end */
+                        memmove(output + base, result.column, sizeof(double) * count);
+                    }
+                    done = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    FREE_ARRAY(vm->allocator, MEM_VM_STACK, Operand, stack, scratchCount);
+    FREE_ARRAY(vm->allocator, MEM_VM_STACK, double, scratch, (size_t)scratchCount * COLUMN_BLOCK);
+    return true;
+}
\ No newline at end of file
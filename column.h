@@ -0,0 +1,17 @@
+#ifndef clox_column_h
+#define clox_column_h
+
+#include "chunk.h"
+
+/* Rows per block: every opcode runs over this many rows before the next one is dispatched */
+#define COLUMN_BLOCK    1024
+
+/*
+    Evaluate a chunk compiled with compileSlotsWith() over whole columns: output[row] is the
+    expression with slot i set to inputs[i][row]. Every opcode is dispatched once per block of COLUMN_BLOCK rows
+    and runs as a vector kernel over the block, instead of once per row.
+    Numbers only; false (and nothing written) if the chunk uses anything else or a slot without a column
+*/
+bool runColumnsWith(VM* vm, Chunk* chunk, const double* const* inputs, int inputCount, double* output, size_t rows);
+
+#endif
\ No newline at end of file
@@ -6,7 +6,10 @@
 #include <stdint.h>
 #include <stdio.h>
 
+/* make release builds with CLOX_RELEASE, which drops the trace, disassembly and stack dumps */
+#ifndef CLOX_RELEASE
 #define DEBUG_TRACE_EXECUTION
 #define DEBUG_PRINT_CODE
+#endif
 
 #endif
\ No newline at end of file
@@ -1,22 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "number.h"
+#include "object.h"
 #include "scanner.h"
 #include "debug.h"
 
 
 
-typedef struct Parser
-{
-    Token current;
-    Token previous;
-    bool hadError;
-    /* For error recovery: whenever in panic mode, sync after the scope */
-    bool panicMode;
-} Parser;
-
 /*
     Precedence for Pratt parser
 */
@@ -37,7 +31,7 @@ typedef enum
     // Highest
 } Precedence;
 
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(Compiler* compiler);
 
 typedef struct
 {
@@ -46,47 +40,99 @@ typedef struct
     Precedence precedence;
 } ParseRule;
 
-/* Again we make this global */
-Parser parser;
-Chunk* compilingChunk;
-
-static void advance();
-static void consume(TokenType type, const char* message);
-static void expressions();
+static void advance(Compiler* compiler);
+static void consume(Compiler* compiler, TokenType type, const char* message);
+static void expressions(Compiler* compiler);
 /* Number literal */
-static void number();
+static void number(Compiler* compiler);
+/* String literal */
+static void string(Compiler* compiler);
+/* Input slot */
+static void variable(Compiler* compiler);
 /* Parenthesis Grouping */
-static void grouping();
+static void grouping(Compiler* compiler);
+/* Fibers: spawn(expression), yield(expression), join(fiber) */
+static void spawn(Compiler* compiler);
+static void yield(Compiler* compiler);
+static void join(Compiler* compiler);
+/* Channels: send(channel, value), receive(channel) */
+static void send(Compiler* compiler);
+static void receive(Compiler* compiler);
 /* Unary operators */
-static void unary();
+static void unary(Compiler* compiler);
 /* Binary operators */
-static void binary();
+static void binary(Compiler* compiler);
 /* Pratt parsing */
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Compiler* compiler, Precedence precedence);
 static ParseRule* getRule(TokenType type);
 
 //static void consume(TokenType type, const char* message);
-static void endCompiler();
+static void endCompiler(Compiler* compiler);
 
-static void errorAtCurrent(const char* message);
-static void errorAt(Token* token, const char* message);
+static void errorAtCurrent(Compiler* compiler, const char* message);
+static void errorAt(Compiler* compiler, Token* token, const char* message);
 
 /* Chunk writing functions */
-static void emitByte(uint8_t byte);
+static void emitByte(Compiler* compiler, uint8_t byte);
 // We have some cases to write two bytes (e.g. push something onto stack, so one byte for PUSH and one byte for value)
-static void emitBytes(uint8_t byte1, uint8_t byte2);
-static void emitReturn();
+static void emitBytes(Compiler* compiler, uint8_t byte1, uint8_t byte2);
+static void emitReturn(Compiler* compiler);
+
+static void emitConstant(Compiler* compiler, Value value);
+static int getConstantIndex(Compiler* compiler, Value value);
+
+static bool compileTokens(Compiler* compiler, VM* vm, Chunk* chunk);
+
+
+bool compileWith(Compiler* compiler, VM* vm, const char* source, size_t length, Chunk* chunk)
+{
+    compiler->slotNames = NULL;
+    compiler->slotCount = 0;
+    initScannerWith(&(compiler->scanner), source, length);
+    return compileTokens(compiler, vm, chunk);
+}
 
-static void emitConstant(double value);
-static uint16_t getConstantIndex(double value);
+bool compileSlotsWith(Compiler* compiler, VM* vm, const char* source, size_t length,
+                      const char* const* slotNames, int slotCount, Chunk* chunk)
+{
+    compiler->slotNames = slotNames;
+    compiler->slotCount = slotCount < MAX_SLOTS ? slotCount : MAX_SLOTS;
+    initScannerWith(&(compiler->scanner), source, length);
+    return compileTokens(compiler, vm, chunk);
+}
+
+bool compileStreamWith(Compiler* compiler, VM* vm, int fd, Chunk* chunk)
+{
+    compiler->slotNames = NULL;
+    compiler->slotCount = 0;
+    initScannerStreamWith(&(compiler->scanner), fd, vm->allocator);
+    bool result = compileTokens(compiler, vm, chunk);
+    freeScannerWith(&(compiler->scanner));
+    return result;
+}
 
+bool compile(const char* source, size_t length, Chunk* chunk)
+{
+    Compiler compiler;
+    return compileWith(&compiler, &vm, source, length, chunk);
+}
+
+bool compileStream(int fd, Chunk* chunk)
+{
+    Compiler compiler;
+    return compileStreamWith(&compiler, &vm, fd, chunk);
+}
 
-bool compile(const char* source, Chunk* chunk)
+/* The scanner is set up by the caller, we just pull tokens from it */
+static bool compileTokens(Compiler* compiler, VM* vm, Chunk* chunk)
 {
-    initScanner(source);
-    compilingChunk = chunk;
-    parser.panicMode = false;
-    parser.hadError = false;
+    compiler->vm = vm;
+    compiler->chunk = chunk;
+    compiler->parser.panicMode = false;
+    compiler->parser.hadError = false;
+    /* Rooted from here on */
+    compiler->enclosing = vm->compiler;
+    vm->compiler = compiler;
     
     /* Scanning and making tokens */
 
@@ -105,29 +151,47 @@ bool compile(const char* source, Chunk* chunk)
     //     }
     // }
 
-    advance();
-    expressions();
-    consume(TOKEN_EOF, "Expect end of expression.");
-
-    endCompiler();
+    ErrorHandler handler;
+    enterProtectedWith(vm, &handler);
+    if (catchError(handler.jump) == 0)
+    {
+        advance(compiler);
+        expressions(compiler);
+        consume(compiler, TOKEN_EOF, "Expect end of expression.");
+        endCompiler(compiler);
+    }
+    else
+    {
+        /* panicWith() from below, e.g. a string constant too long. The chunk is half written, it's an error like any other */
+        VMError* error = &(vm->error);
+        error->line = compiler->parser.previous.line;
+        error->pos = compiler->parser.previous.offset;
+        error->fiber = FIBER_NONE;
+        error->stackDepth = 0;
+        fprintf(stderr, "Line %d offset %d Error\n%s\n", error->line, error->pos, error->message);
+        compiler->parser.hadError = true;
+    }
+    leaveProtectedWith(vm, &handler);
+    vm->compiler = compiler->enclosing;
+    compiler->chunk = NULL;
 
     /* 1 for no error and 0 for error */
-    return !parser.hadError;
+    return !compiler->parser.hadError;
 }
 
-static void advance()
+static void advance(Compiler* compiler)
 {
-    parser.previous = parser.current;
+    compiler->parser.previous = compiler->parser.current;
 
     while (true)
     {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR)
+        compiler->parser.current = scanTokenWith(&(compiler->scanner));
+        if (compiler->parser.current.type != TOKEN_ERROR)
         {
             /* So usually we only walk one Token */
             break;
         }
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(compiler, compiler->parser.current.start);
     }
 }
 
@@ -155,22 +219,22 @@ static void advance()
     * Take 5+2*4 as an example, we first reaches +, then it reaches *, which has higher precedence than +,
     * so the parser is blocked and only reads 5.
 */
-static void expressions()
+static void expressions(Compiler* compiler)
 {
     /* NOTE: we simply starts from the lowest precedence */
-    parsePrecedence(PREC_ASSIGNMENT);
+    parsePrecedence(compiler, PREC_ASSIGNMENT);
 }
 
-static void consume(TokenType type, const char* message)
+static void consume(Compiler* compiler, TokenType type, const char* message)
 {
     /* Same as advance() but validate the current token first */
-    if (parser.current.type == type)
+    if (compiler->parser.current.type == type)
     {
-        advance();
+        advance(compiler);
     }
     else
     {
-        errorAtCurrent(message);
+        errorAtCurrent(compiler, message);
     }
 }
 
@@ -178,24 +242,97 @@ static void consume(TokenType type, const char* message)
     NOTE: What the call chain does is to push the constant to the array of constants, 
     and grab the index and push index, then push the index into a chunk (remember we don't save value, just index)
 */
-static void number()
+static void number(Compiler* compiler)
+{
+    /* The token already knows its length, and the source might be a mmap without a trailing '\0' */
+    double value = parseNumber(compiler->parser.previous.start, compiler->parser.previous.length);
+    emitConstant(compiler, NUMBER_VAL(value));
+}
+
+static void string(Compiler* compiler)
 {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(value);
+    /* Interned here once, the VM only ever pushes the constant */
+    Token* token = &(compiler->parser.previous);
+    emitConstant(compiler, OBJ_VAL(copyString(compiler->vm, token->start + 1, token->length - 2)));
+}
+
+static void variable(Compiler* compiler)
+{
+    Token* token = &(compiler->parser.previous);
+    for (int slot = 0; slot < compiler->slotCount; slot++)
+    {
+        const char* name = compiler->slotNames[slot];
+        if ((int)strlen(name) == token->length && memcmp(name, token->start, token->length) == 0)
+        {
+            emitBytes(compiler, OP_SLOT, (uint8_t)slot);
+            return;
+        }
+    }
+    errorAt(compiler, token, "Unknown input.");
 }
 
-static void grouping()
+static void grouping(Compiler* compiler)
 {
     /* Assuming initial ( consumed at this point */
     /* NOTE: Whatever inside the parenthesis is an expression */
-    expressions();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    expressions(compiler);
+    consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void unary()
+static void spawn(Compiler* compiler)
+{
+    /* The child's code goes inline behind OP_SPAWN, which is patched with its length once it is known */
+    consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after spawn.");
+    emitByte(compiler, OP_SPAWN);
+    int operand = compiler->chunk->count;
+    emitBytes(compiler, 0xff, 0xff);
+    grouping(compiler);
+    emitReturn(compiler);
+
+    int length = compiler->chunk->count - operand - 2;
+    if (length > UINT16_MAX)
+    {
+        errorAt(compiler, &compiler->parser.previous, "Too much code to spawn.");
+        return;
+    }
+    compiler->chunk->code[operand] = (length >> 8) & 0xff;
+    compiler->chunk->code[operand + 1] = length & 0xff;
+}
+
+static void yield(Compiler* compiler)
+{
+    consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after yield.");
+    grouping(compiler);
+    emitByte(compiler, OP_YIELD);
+}
+
+static void join(Compiler* compiler)
+{
+    consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after join.");
+    grouping(compiler);
+    emitByte(compiler, OP_JOIN);
+}
+
+static void send(Compiler* compiler)
+{
+    consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after send.");
+    expressions(compiler);
+    consume(compiler, TOKEN_COMMA, "Expect ',' after the channel.");
+    grouping(compiler);
+    emitByte(compiler, OP_SEND);
+}
+
+static void receive(Compiler* compiler)
+{
+    consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after receive.");
+    grouping(compiler);
+    emitByte(compiler, OP_RECEIVE);
+}
+
+static void unary(Compiler* compiler)
 {
     /* Save the operator */
-    TokenType op = parser.previous.type;
+    TokenType op = compiler->parser.previous.type;
 
     /*
         NOTE: parsePrecedence() is run before the unary op is emitted
@@ -203,13 +340,13 @@ static void unary()
         This makes sense as the value first goes onto the stack and then the negate gets pushed
         During evaluation, the negation gets read first
     */
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(compiler, PREC_UNARY);
 
     switch (op)
     {
         case TOKEN_MINUS:
         {
-            emitByte(OP_NEGATE);
+            emitByte(compiler, OP_NEGATE);
             break;
         }
         default:
@@ -240,8 +377,8 @@ ParseRule rules[] = {
   [TOKEN_GREATER_EQUAL] = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LESS]          = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LESS_EQUAL]    = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_IDENTIFIER]    = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_STRING]        = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
+  [TOKEN_STRING]        = {string,   NULL,   PREC_NONE},
   [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
   [TOKEN_AND]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE},
@@ -259,29 +396,34 @@ ParseRule rules[] = {
   [TOKEN_TRUE]          = {NULL,     NULL,   PREC_NONE},
   [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_SPAWN]         = {spawn,    NULL,   PREC_NONE},
+  [TOKEN_YIELD]         = {yield,    NULL,   PREC_NONE},
+  [TOKEN_JOIN]          = {join,     NULL,   PREC_NONE},
+  [TOKEN_SEND]          = {send,     NULL,   PREC_NONE},
+  [TOKEN_RECEIVE]       = {receive,  NULL,   PREC_NONE},
   [TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
 };
 
 /* NOTE: Algo similar to wiki: https://en.wikipedia.org/wiki/Operator-precedence_parser#Pseudocode */
-static void parsePrecedence(Precedence precedence) 
+static void parsePrecedence(Compiler* compiler, Precedence precedence) 
 {
-    advance();
-    ParseFn prefixRule = (getRule(parser.previous.type))->prefix;
+    advance(compiler);
+    ParseFn prefixRule = (getRule(compiler->parser.previous.type))->prefix;
 
     if (prefixRule == NULL)
     {
-        errorAt(&parser.previous, "Expect expressions.");
+        errorAt(compiler, &compiler->parser.previous, "Expect expressions.");
         return;
     }
 
-    prefixRule();
+    prefixRule(compiler);
 
-    while (precedence <= (getRule(parser.current.type))->precedence)
+    while (precedence <= (getRule(compiler->parser.current.type))->precedence)
     {
-        advance();
-        ParseFn infixRule = (getRule(parser.previous.type))->infix;
-        infixRule();
+        advance(compiler);
+        ParseFn infixRule = (getRule(compiler->parser.previous.type))->infix;
+        infixRule(compiler);
     }
 }
 
@@ -290,7 +432,7 @@ static ParseRule* getRule(TokenType type)
     return &rules[type];
 }
 
-static void binary()
+static void binary(Compiler* compiler)
 {
     /* 
         Something like 1+2,
@@ -312,30 +454,30 @@ static void binary()
         PREC_PRIMARY
     */
 
-    TokenType op = parser.previous.type;
+    TokenType op = compiler->parser.previous.type;
     ParseRule* rule = getRule(op);
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    parsePrecedence(compiler, (Precedence)(rule->precedence + 1));
 
     switch (op)
     {
         case TOKEN_PLUS:
         {
-            emitByte(OP_ADD);
+            emitByte(compiler, OP_ADD);
             break;
         }
         case TOKEN_MINUS:
         {
-            emitByte(OP_SUB);
+            emitByte(compiler, OP_SUB);
             break;
         }
         case TOKEN_STAR:
         {
-            emitByte(OP_MUL);
+            emitByte(compiler, OP_MUL);
             break;
         }
         case TOKEN_SLASH:
         {
-            emitByte(OP_DIV);
+            emitByte(compiler, OP_DIV);
             break;
         }
         default:
@@ -348,82 +490,113 @@ static void binary()
 }
 
 
-static void endCompiler()
+void markCompilerRoots(VM* vm, void (*visit)(VM* vm, Value* slot))
+{
+    for (Compiler* compiler = vm->compiler; compiler != NULL; compiler = compiler->enclosing)
+    {
+        for (int i = 0; i < compiler->chunk->constants.count; i++)
+        {
+            visit(vm, &(compiler->chunk->constants.values[i]));
+        }
+    }
+}
+
+static void endCompiler(Compiler* compiler)
 {
     // NOTE: Right now we only deal with expressions
     // And we need to return/emit the expression, right?
     // WHY: to print that value, we are temporarily using the OP_RETURN instruction
     // So we have the compiler add one to the end of the chunk
-    disassembleChunk(compilingChunk, "code");
-    emitReturn();
+    #ifdef DEBUG_PRINT_CODE
+        disassembleChunk(compiler->vm, &(compiler->vm->out), compiler->chunk, "code");
+    #endif
+    emitReturn(compiler);
 }
 
-static void expression() 
+static void expression(Compiler* compiler) 
 {
   // What goes here?
 }
 
 /* Forward declaration */
 
-static void expression();
+static void expression(Compiler* compiler);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Compiler* compiler, Precedence precedence);
 
-static void errorAtCurrent(const char* message)
+static void errorAtCurrent(Compiler* compiler, const char* message)
 {
-    errorAt(&parser.previous, message);
+    errorAt(compiler, &compiler->parser.previous, message);
 }
 
-static void errorAt(Token* token, const char* message)
+static void errorAt(Compiler* compiler, Token* token, const char* message)
 {
-    if (!parser.panicMode)
+    if (!compiler->parser.panicMode)
     {
-        parser.panicMode = true;
+        compiler->parser.panicMode = true;
     }
 
-    fprintf(stderr, "Line %d offset %d Error\n", token->line, token->offset);
+    fprintf(stderr, "Line %d offset %d Error\n%s\n", token->line, token->offset, message);
 
     /* The format says: print a string starts from token->start with token->length of bytes */
-    fprintf(stderr, "Lexeme: '%.*s'", token->length, token->start);
+    fprintf(stderr, "Lexeme: '%.*s'\n", token->length, token->start);
 
-    parser.hadError = true;
+    /* The first error is the one the host gets, the rest tend to follow from it */
+    if (!compiler->parser.hadError)
+    {
+        VMError* error = &(compiler->vm->error);
+        error->kind = ERROR_COMPILE;
+        error->message = message;
+        error->line = token->line;
+        error->pos = token->offset;
+        error->fiber = FIBER_NONE;
+        error->stackDepth = 0;
+    }
+    compiler->parser.hadError = true;
 }
 
-static void emitByte(uint8_t byte)
+static void emitByte(Compiler* compiler, uint8_t byte)
 {
-    writeChunk(compilingChunk, byte, parser.previous.line, parser.previous.offset);
+    /* Whatever the chunk allocates now is on this line's account (see --mem-lines) */
+    setAllocationLine(compiler->parser.previous.line);
+    writeChunk(compiler->chunk, byte, compiler->parser.previous.line, compiler->parser.previous.offset);
 }
 
-static void emitBytes(uint8_t byte1, uint8_t byte2)
+static void emitBytes(Compiler* compiler, uint8_t byte1, uint8_t byte2)
 {
-    emitByte(byte1);
-    emitByte(byte2);
+    emitByte(compiler, byte1);
+    emitByte(compiler, byte2);
 }
 
-static void emitReturn()
+static void emitReturn(Compiler* compiler)
 {
-    emitByte(OP_RETURN);
+    emitByte(compiler, OP_RETURN);
 }
 
-/* 
-    FIXME: This doesn't work for long constants actually, because it's only writing 2 bytes.
-
-    For long constants, you gotta write 4 bytes (I think, 1 byte for op and 3 bytes for number)
-
-    Temp fix: change OP_CONSTNAT_LONG to OP_CONSTANT
-*/
-static void emitConstant(double value)
+/* OP_CONSTANT while the index fits a byte, OP_CONSTANT_LONG (24-bit, big endian) after that */
+static void emitConstant(Compiler* compiler, Value value)
 {
-    emitBytes(OP_CONSTANT, getConstantIndex(value));
+    /* The constant pool may grow before emitByte() gets to set the line */
+    setAllocationLine(compiler->parser.previous.line);
+    int constantIndex = getConstantIndex(compiler, value);
+    if (constantIndex <= 0xFF)
+    {
+        emitBytes(compiler, OP_CONSTANT, (uint8_t)constantIndex);
+    }
+    else
+    {
+        emitByte(compiler, OP_CONSTANT_LONG);
+        emitBytes(compiler, (uint8_t)(constantIndex >> 16), (uint8_t)(constantIndex >> 8));
+        emitByte(compiler, (uint8_t)constantIndex);
+    }
 }
 
-/* We will only use OP_CONSTANT_LONG */
-static uint16_t getConstantIndex(double value)
+static int getConstantIndex(Compiler* compiler, Value value)
 {
-    uint16_t constantIndex = addConstant(compilingChunk, value);
-    if (constantIndex >= UINT16_MAX)
+    int constantIndex = addConstant(compiler->chunk, value);
+    if (constantIndex > 0xFFFFFF)
     {
-        errorAt(&parser.previous, "Constant Array overflow");
+        errorAt(compiler, &compiler->parser.previous, "Constant Array overflow");
         return 0;
     }
     return constantIndex;
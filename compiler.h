@@ -1,11 +1,52 @@
 #ifndef clox_compiler_h
 #define clox_compiler_h
 
+#include "scanner.h"
 #include "vm.h"
 
+/* OP_SLOT has a one byte operand */
+#define MAX_SLOTS 0x100
+
+typedef struct Parser
+{
+    Token current;
+    Token previous;
+    bool hadError;
+    /* For error recovery: whenever in panic mode, sync after the scope */
+    bool panicMode;
+} Parser;
+
+/* State of one compile, on the caller's stack. Strings it makes go to vm's heap */
+struct Compiler
+{
+    VM* vm;
+    Scanner scanner;
+    Parser parser;
+    Chunk* chunk;
+    /* Names an identifier may refer to, see compileSlotsWith() */
+    const char* const* slotNames;
+    int slotCount;
+    /* The compile this one interrupted on the same VM, if any */
+    Compiler* enclosing;
+};
+
 /* Pass chunk for writing into */
 /* Right now compilingChunk is global, but in the future I think we will have multiple chunks, so we need a pointer to it */
 /* WHY: I think whence we need to parse functions, each function would have its own stack/chunk? */
-bool compile(const char* source, Chunk* chunk);
+/* source is length bytes long and does not have to be NUL-terminated */
+bool compileWith(Compiler* compiler, VM* vm, const char* source, size_t length, Chunk* chunk);
+/* Same as compileWith() but the source is read from fd as the parser goes */
+bool compileStreamWith(Compiler* compiler, VM* vm, int fd, Chunk* chunk);
+/*
+    Same as compileWith(), but identifiers name inputs: slotNames[i] compiles to OP_SLOT i,
+    which reads vm->slots[i] (or column i, see runColumnsWith()). Any other identifier is an error
+*/
+bool compileSlotsWith(Compiler* compiler, VM* vm, const char* source, size_t length,
+                      const char* const* slotNames, int slotCount, Chunk* chunk);
+/* The same on the global vm */
+bool compile(const char* source, size_t length, Chunk* chunk);
+bool compileStream(int fd, Chunk* chunk);
+/* The GC calls this so constants of chunks being compiled on vm stay alive */
+void markCompilerRoots(VM* vm, void (*visit)(VM* vm, Value* slot));
 
 #endif
\ No newline at end of file
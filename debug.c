@@ -1,27 +1,32 @@
 #include <stdio.h>
 #include "debug.h"
 
+/* Only the disassembler decodes slots and spawns */
+static int slotInstruction(OutputBuffer* out, const char* name, Chunk* chunk, int offset);
+static int spawnInstruction(OutputBuffer* out, const char* name, Chunk* chunk, int offset);
+
 /*
     We use disassembleInstruction() to move offset,
     because instructions have different sizes
 */
-void disassembleChunk(Chunk* chunk, const char* name)
+void disassembleChunk(VM* vm, OutputBuffer* out, Chunk* chunk, const char* name)
 {
-    printf("Name of chunk: %s\n", name);
+    printOutput(out, "Name of chunk: %s\n", name);
 
     for (int offset = 0; offset < chunk->count;)
     {
-        offset = disassembleInstruction(chunk, offset);
+        offset = disassembleInstruction(vm, out, chunk, offset);
     }
 
-    printf("Done disassembling\n");
+    printOutput(out, "Done disassembling\n");
 }
 
-int disassembleInstruction(Chunk* chunk, int offset)
+int disassembleInstruction(VM* vm, OutputBuffer* out, Chunk* chunk, int offset)
 {
-    printf("Offset -> %04d ", offset);
+    printOutput(out, "Offset -> %04d ", offset);
     /* Print line number and  pos */
-    printf("Line %4d - Pos %4d ", chunk->line, chunk->pos);
+    LineRun run = getLineRun(chunk, offset);
+    printOutput(out, "Line %4d - Pos %4d ", run.line, run.pos);
 
     uint8_t instr = chunk->code[offset];
 
@@ -29,63 +34,88 @@ int disassembleInstruction(Chunk* chunk, int offset)
     {
         case OP_RETURN:
         {
-            return simpleInstruction("OP_RETURN", offset);
+            return simpleInstruction(out, "OP_RETURN", offset);
         }
         case OP_CONSTANT:
         {
-            return constantInstruction("OP_CONSTANT", chunk, offset);
+            return constantInstruction(vm, out, "OP_CONSTANT", chunk, offset);
         }
         case OP_CONSTANT_LONG:
         {
-            return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
+            return constantLongInstruction(vm, out, "OP_CONSTANT_LONG", chunk, offset);
+        }
+        case OP_SLOT:
+        {
+            return slotInstruction(out, "OP_SLOT", chunk, offset);
+        }
+        case OP_SPAWN:
+        {
+            return spawnInstruction(out, "OP_SPAWN", chunk, offset);
+        }
+        case OP_YIELD:
+        {
+            return simpleInstruction(out, "OP_YIELD", offset);
+        }
+        case OP_JOIN:
+        {
+            return simpleInstruction(out, "OP_JOIN", offset);
+        }
+        case OP_SEND:
+        {
+            return simpleInstruction(out, "OP_SEND", offset);
+        }
+        case OP_RECEIVE:
+        {
+            return simpleInstruction(out, "OP_RECEIVE", offset);
         }
         case OP_NEGATE:
         {
-            return simpleInstruction("OP_NEGATE", offset);
+            return simpleInstruction(out, "OP_NEGATE", offset);
         }
         case OP_ADD:
         {
-            return binaryInstruction("OP_ADD", chunk, offset);
+            return binaryInstruction(out, "OP_ADD", chunk, offset);
         }
         case OP_SUB:
         {
-            return binaryInstruction("OP_SUB", chunk, offset);
+            return binaryInstruction(out, "OP_SUB", chunk, offset);
         }
         case OP_MUL:
         {
-            return binaryInstruction("OP_MUL", chunk, offset);
+            return binaryInstruction(out, "OP_MUL", chunk, offset);
         }
         case OP_DIV:
         {
-            return binaryInstruction("OP_DIV", chunk, offset);
+            return binaryInstruction(out, "OP_DIV", chunk, offset);
         }
         default:
         {
-            printf("Unknown opcode %d\n", instr);
+            printOutput(out, "Unknown opcode %d\n", instr);
             return offset + 1;
         }
     }
 }
 
-static int simpleInstruction(const char* name, int offset)
+static int simpleInstruction(OutputBuffer* out, const char* name, int offset)
 {
-    printf("%s\n", name);
+    writeOutputString(out, name);
+    writeOutputChar(out, '\n');
     return offset + 1;
 }
 
-static int constantInstruction(const char* name, Chunk* chunk, int offset)
+static int constantInstruction(VM* vm, OutputBuffer* out, const char* name, Chunk* chunk, int offset)
 {
     /* First byte is for OpCode and the second byte is the index of the constant, thus offset + 1 */
     uint8_t constantIndex = chunk->code[offset + 1];
-    printf("%-16s Index %4d -> '", name, constantIndex);
+    printOutput(out, "%-16s Index %4d -> '", name, constantIndex);
     /* Then we need to print the actual value */
-    printValue(chunk->constants.values[constantIndex]);
-    printf("'\n");
+    printValue(vm, out, chunk->constants.values[constantIndex]);
+    writeOutput(out, "'\n", 2);
     /* 2 byte chunk */
     return offset + 2;
 }
 
-static int constantLongInstruction(const char* name, Chunk* chunk, int offset)
+static int constantLongInstruction(VM* vm, OutputBuffer* out, const char* name, Chunk* chunk, int offset)
 {
     /*
         First byte is OpCode and the following three are High/Middle/Low byte of the index
@@ -93,15 +123,30 @@ static int constantLongInstruction(const char* name, Chunk* chunk, int offset)
     
     int constantIndex = (chunk->code[offset + 1] << 16) + (chunk->code[offset + 2] << 8) + chunk->code[offset + 3];
 
-    printf("%-16s Index %4d -> '", name, constantIndex);
-    printValue(chunk->constants.values[constantIndex]);
-    printf("'\n");
+    printOutput(out, "%-16s Index %4d -> '", name, constantIndex);
+    printValue(vm, out, chunk->constants.values[constantIndex]);
+    writeOutput(out, "'\n", 2);
     /* 4 byte chunk */
     return offset + 4;
 }
 
-static int binaryInstruction(const char* name, Chunk* chunk, int offset)
+static int slotInstruction(OutputBuffer* out, const char* name, Chunk* chunk, int offset)
+{
+    printOutput(out, "%-16s Slot  %4d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+static int spawnInstruction(OutputBuffer* out, const char* name, Chunk* chunk, int offset)
+{
+    /* The child's code is disassembled right after, the parent carries on at the end of it */
+    int length = (chunk->code[offset + 1] << 8) + chunk->code[offset + 2];
+    printOutput(out, "%-16s Skip  %4d -> %04d\n", name, length, offset + 3 + length);
+    return offset + 3;
+}
+
+static int binaryInstruction(OutputBuffer* out, const char* name, Chunk* chunk, int offset)
 {
-    printf("%s\n", name);
+    writeOutputString(out, name);
+    writeOutputChar(out, '\n');
     return offset + 1;
 }
\ No newline at end of file
@@ -4,12 +4,13 @@
 #include "chunk.h"
 #include "value.h"
 
-void disassembleChunk(Chunk* chunk, const char* name);
-int disassembleInstruction(Chunk* chunk, int offset);
+/* Disassembly is written into out, like any other VM output. Constants are printed with vm */
+void disassembleChunk(VM* vm, OutputBuffer* out, Chunk* chunk, const char* name);
+int disassembleInstruction(VM* vm, OutputBuffer* out, Chunk* chunk, int offset);
 
-static int simpleInstruction(const char* name, int offset);
-static int constantInstruction(const char* name, Chunk* chunk, int offset);
-static int constantLongInstruction(const char* name, Chunk* chunk, int offset);
-static int binaryInstruction(const char* name, Chunk* chunk, int offset);
+static int simpleInstruction(OutputBuffer* out, const char* name, int offset);
+static int constantInstruction(VM* vm, OutputBuffer* out, const char* name, Chunk* chunk, int offset);
+static int constantLongInstruction(VM* vm, OutputBuffer* out, const char* name, Chunk* chunk, int offset);
+static int binaryInstruction(OutputBuffer* out, const char* name, Chunk* chunk, int offset);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "fiber.h"
+#include "vm.h"
+
+void initFiberTable(FiberTable* table, Allocator* allocator)
+{
+    table->allocator = allocator;
+    table->fibers = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->current = FIBER_NONE;
+    table->readyHead = FIBER_NONE;
+    table->readyTail = FIBER_NONE;
+    table->waitingCount = 0;
+    table->spareCount = 0;
+    table->spawned = 0;
+    table->switches = 0;
+}
+
+static void releaseStack(FiberTable* table, Fiber* fiber)
+{
+    if (fiber->stack == NULL)
+    {
+        return;
+    }
+    if (table->spareCount < FIBER_SPARE_STACKS)
+    {
+        table->spare[table->spareCount++] = (SpareStack){ fiber->stack, fiber->stackCapacity };
+    }
+    else
+    {
+        FREE_ARRAY(table->allocator, MEM_VM_STACK, Value, fiber->stack, fiber->stackCapacity);
+    }
+    fiber->stack = NULL;
+    fiber->stackTop = NULL;
+    fiber->stackCapacity = 0;
+}
+
+void freeFiberTable(FiberTable* table)
+{
+    resetFiberTable(table);
+    for (int i = 0; i < table->spareCount; i++)
+    {
+        FREE_ARRAY(table->allocator, MEM_VM_STACK, Value, table->spare[i].stack, table->spare[i].capacity);
+    }
+    FREE_ARRAY(table->allocator, MEM_VM_STACK, Fiber, table->fibers, table->capacity);
+    initFiberTable(table, table->allocator);
+}
+
+void resetFiberTable(FiberTable* table)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        releaseStack(table, &(table->fibers[i]));
+    }
+    table->count = 0;
+    table->current = FIBER_NONE;
+    table->readyHead = FIBER_NONE;
+    table->readyTail = FIBER_NONE;
+    table->waitingCount = 0;
+}
+
+int newFiber(FiberTable* table, Chunk* chunk, uint8_t* ip)
+{
+    if (table->count == table->capacity)
+    {
+        int capacity = GROW_CAPACITY(table->capacity);
+        table->fibers = GROW_ARRAY(table->allocator, MEM_VM_STACK, Fiber, table->fibers, table->capacity, capacity);
+        table->capacity = capacity;
+    }
+    int id = table->count++;
+    Fiber* fiber = &(table->fibers[id]);
+    fiber->chunk = chunk;
+    fiber->ip = ip;
+    /* Whatever the last finished fiber left behind, or a small new one */
+    if (table->spareCount > 0)
+    {
+        SpareStack spare = table->spare[--table->spareCount];
+        fiber->stack = spare.stack;
+        fiber->stackCapacity = spare.capacity;
+    }
+    else
+    {
+        fiber->stack = GROW_ARRAY(table->allocator, MEM_VM_STACK, Value, NULL, 0, FIBER_STACK_INITIAL);
+        fiber->stackCapacity = FIBER_STACK_INITIAL;
+    }
+    fiber->stackTop = fiber->stack;
+    fiber->firstWaiter = FIBER_NONE;
+    fiber->result = NUMBER_VAL(0);
+    table->spawned++;
+    readyFiber(table, id);
+    return id;
+}
+
+void readyFiber(FiberTable* table, int id)
+{
+    Fiber* fiber = &(table->fibers[id]);
+    fiber->state = FIBER_READY;
+    fiber->next = FIBER_NONE;
+    if (table->readyTail == FIBER_NONE)
+    {
+        table->readyHead = id;
+    }
+    else
+    {
+        table->fibers[table->readyTail].next = id;
+    }
+    table->readyTail = id;
+}
+
+int nextReadyFiber(FiberTable* table)
+{
+    int id = table->readyHead;
+    if (id != FIBER_NONE)
+    {
+        table->readyHead = table->fibers[id].next;
+        if (table->readyHead == FIBER_NONE)
+        {
+            table->readyTail = FIBER_NONE;
+        }
+    }
+    return id;
+}
+
+void waitForFiber(FiberTable* table, int id, int target)
+{
+    Fiber* fiber = &(table->fibers[id]);
+    fiber->state = FIBER_WAITING;
+    fiber->next = table->fibers[target].firstWaiter;
+    table->fibers[target].firstWaiter = id;
+    table->waitingCount++;
+}
+
+void finishFiber(FiberTable* table, int id, Value result)
+{
+    Fiber* fiber = &(table->fibers[id]);
+    fiber->state = FIBER_DONE;
+    fiber->result = result;
+    releaseStack(table, fiber);
+
+    int waiter = fiber->firstWaiter;
+    fiber->firstWaiter = FIBER_NONE;
+    while (waiter != FIBER_NONE)
+    {
+        int next = table->fibers[waiter].next;
+        table->waitingCount--;
+        readyFiber(table, waiter);
+        waiter = next;
+    }
+}
+
+void markFiber(VM* vm, FiberTable* table, int id, Chunk** visited, void (*visit)(VM* vm, Value* slot))
+{
+    Fiber* fiber = &(table->fibers[id]);
+    visit(vm, &(fiber->result));
+    if (fiber->state == FIBER_DONE)
+    {
+        return;
+    }
+    for (Value* slot = fiber->stack; slot < fiber->stackTop; slot++)
+    {
+        visit(vm, slot);
+    }
+    if (fiber->chunk != *visited)
+    {
+        for (int i = 0; i < fiber->chunk->constants.count; i++)
+        {
+            visit(vm, &(fiber->chunk->constants.values[i]));
+        }
+        *visited = fiber->chunk;
+    }
+}
+
+void markFiberRoots(VM* vm, FiberTable* table, void (*visit)(VM* vm, Value* slot))
+{
+    /* Fibers spawned by one script share its chunk, its constants are visited once per run of them */
+    Chunk* visited = vm->chunk;
+    for (int id = 0; id < table->count; id++)
+    {
+        if (id == table->current)
+        {
+            visit(vm, &(table->fibers[id].result));
+            continue;
+        }
+        markFiber(vm, table, id, &visited, visit);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#ifndef clox_fiber_h
+#define clox_fiber_h
+
+#include "chunk.h"
+
+/* Values a new fiber's stack has room for, it doubles from there up to STACK_MAX */
+#define FIBER_STACK_INITIAL     8
+/* Stacks of finished fibers are handed on to new ones, up to this many are kept around */
+#define FIBER_SPARE_STACKS      0x40
+#define FIBER_NONE              (-1)
+
+typedef enum
+{
+    /* On the ready queue */
+    FIBER_READY,
+    FIBER_RUNNING,
+    /* In join(), on the waiter list of the fiber it joins */
+    FIBER_WAITING,
+    /* Only its result is left, its stack is gone */
+    FIBER_DONE
+} FiberState;
+
+/*
+    A green thread inside one VM: its own value stack and instruction pointer.
+    While it runs, all of this lives in the VM's registers (vm->ip, vm->stack, ...) and is stale here
+*/
+typedef struct
+{
+    Chunk* chunk;
+    uint8_t* ip;
+    Value* stack;
+    Value* stackTop;
+    int stackCapacity;
+    FiberState state;
+    /* Next on the ready queue or on a waiter list, whichever the fiber is on */
+    int next;
+    /* Fibers blocked in join() on this one, linked through next */
+    int firstWaiter;
+    /* The value of its expression, once done */
+    Value result;
+} Fiber;
+
+typedef struct
+{
+    Value* stack;
+    int capacity;
+} SpareStack;
+
+/* All fibers of a VM, a fiber's id is its index. Nothing here is shared between VMs */
+typedef struct
+{
+    Allocator* allocator;
+    Fiber* fibers;
+    int count;
+    int capacity;
+    /* The one in the VM's registers, FIBER_NONE outside of a run */
+    int current;
+    /* FIFO, linked through Fiber.next */
+    int readyHead;
+    int readyTail;
+    /* Fibers blocked in join(), when nothing is ready but these, they deadlocked */
+    int waitingCount;
+    SpareStack spare[FIBER_SPARE_STACKS];
+    int spareCount;
+    uint64_t spawned;
+    uint64_t switches;
+} FiberTable;
+
+void initFiberTable(FiberTable* table, Allocator* allocator);
+void freeFiberTable(FiberTable* table);
+/* Forget every fiber (their chunks may be gone), their stacks become spares */
+void resetFiberTable(FiberTable* table);
+/* A new fiber running chunk from ip with an empty stack, at the end of the ready queue. Returns its id */
+int newFiber(FiberTable* table, Chunk* chunk, uint8_t* ip);
+void readyFiber(FiberTable* table, int id);
+/* The head of the ready queue, FIBER_NONE if it is empty */
+int nextReadyFiber(FiberTable* table);
+/* Block id until target is done */
+void waitForFiber(FiberTable* table, int id, int target);
+/* id is done with result, its stack goes away and whoever joined it is ready again */
+void finishFiber(FiberTable* table, int id, Value result);
+/*
+    One fiber's result, its stack unless it is done, and its chunk's constants unless that chunk is *visited
+    (which it becomes). Its registers must have been saved if it ran
+*/
+void markFiber(VM* vm, FiberTable* table, int id, Chunk** visited, void (*visit)(VM* vm, Value* slot));
+/* Stacks, results and chunk constants of every fiber but the running one, vm's registers cover that */
+void markFiberRoots(VM* vm, FiberTable* table, void (*visit)(VM* vm, Value* slot));
+
+#endif
\ No newline at end of file
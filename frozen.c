@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "frozen.h"
+#include "hash.h"
+#include "object.h"
+#include "vm.h"
+
+FrozenChunk* freezeChunk(VM* vm, Chunk* chunk)
+{
+    /* Flatten first, that allocates, and the constants are rooted through the chunk only while it runs */
+    Chunk* running = vm->chunk;
+    vm->chunk = chunk;
+    size_t stringsSize = 0;
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        Value* constant = &(chunk->constants.values[i]);
+        if (IS_ROPE(*constant))
+        {
+            *constant = OBJ_VAL(flattenText(vm, constant));
+        }
+        if (IS_OBJ(*constant) && !IS_STRING(*constant))
+        {
+            fprintf(stderr, "Can't freeze constant %d, only numbers and strings are supported.\n", i);
+            vm->chunk = running;
+            return NULL;
+        }
+        if (IS_STRING(*constant))
+        {
+            stringsSize += FROZEN_ALIGN(AS_OBJ(*constant)->size);
+        }
+    }
+    vm->chunk = running;
+
+    /* header | code | lines | constants | strings, like an image but with real pointers */
+    size_t codeOffset = FROZEN_ALIGN(sizeof(FrozenChunk));
+    size_t linesOffset = FROZEN_ALIGN(codeOffset + (size_t)chunk->count);
+    size_t constantsOffset = FROZEN_ALIGN(linesOffset + sizeof(LineRun) * (size_t)chunk->lineCount);
+    size_t stringsOffset = FROZEN_ALIGN(constantsOffset + sizeof(Value) * (size_t)chunk->constants.count);
+    size_t size = stringsOffset + stringsSize;
+
+    /* Straight from libc: it outlives the VM that froze it, and any thread may free it */
+    char* block = calloc(1, size);
+    if (block == NULL)
+    {
+        fprintf(stderr, "Out of memory freezing a chunk.\n");
+        return NULL;
+    }
+    FrozenChunk* frozen = (FrozenChunk*)block;
+    atomic_init(&(frozen->refCount), 1);
+    frozen->size = size;
+
+    memcpy(block + codeOffset, chunk->code, chunk->count);
+    if (chunk->lineCount > 0)
+    {
+        memcpy(block + linesOffset, chunk->lines, sizeof(LineRun) * chunk->lineCount);
+    }
+    Value* constants = (Value*)(block + constantsOffset);
+    size_t stringOffset = stringsOffset;
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        Value constant = chunk->constants.values[i];
+        if (IS_STRING(constant))
+        {
+            Obj* string = AS_OBJ(constant);
+            ObjString* copy = (ObjString*)(block + stringOffset);
+            memcpy(copy, string, string->size);
+            /* Permanent: no VM's GC marks, moves or frees it, so no VM ever writes it */
+            copy->obj.flags = OBJ_OLD | OBJ_PERMANENT;
+            copy->obj.next = NULL;
+            constant = OBJ_VAL(copy);
+            stringOffset += FROZEN_ALIGN(string->size);
+        }
+        constants[i] = constant;
+    }
+
+    Chunk* frozenChunk = &(frozen->chunk);
+    /* No allocator, nothing may grow or free it on its own */
+    initChunkWith(frozenChunk, NULL);
+    frozenChunk->code = (uint8_t*)(block + codeOffset);
+    frozenChunk->count = chunk->count;
+    frozenChunk->capacity = chunk->count;
+    frozenChunk->line = chunk->line;
+    frozenChunk->pos = chunk->pos;
+    frozenChunk->lines = (LineRun*)(block + linesOffset);
+    frozenChunk->lineCount = chunk->lineCount;
+    frozenChunk->lineCapacity = chunk->lineCount;
+    frozenChunk->constants.values = constants;
+    frozenChunk->constants.count = chunk->constants.count;
+    frozenChunk->constants.capacity = chunk->constants.count;
+    return frozen;
+}
+
+FrozenChunk* retainFrozenChunk(FrozenChunk* frozen)
+{
+    /* Whoever hands it over holds a reference already, so nothing to order against */
+    atomic_fetch_add_explicit(&(frozen->refCount), 1, memory_order_relaxed);
+    return frozen;
+}
+
+void releaseFrozenChunk(FrozenChunk* frozen)
+{
+    /* Every use of the chunk happens before the last release sees zero */
+    if (atomic_fetch_sub_explicit(&(frozen->refCount), 1, memory_order_acq_rel) == 1)
+    {
+        free(frozen);
+    }
+}
+
+void initFrozenTable(FrozenTable* table, Allocator* allocator)
+{
+    table->allocator = allocator;
+    table->entries = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
+
+static void internStrings(VM* vm, FrozenChunk* frozen)
+{
+    Chunk* chunk = &(frozen->chunk);
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        if (!IS_STRING(chunk->constants.values[i]))
+        {
+            continue;
+        }
+        ObjString* string = AS_STRING(chunk->constants.values[i]);
+        /*
+            The constants can't be redirected to a string the VM made before (other VMs run them too),
+            in that case the VM keeps both. Nothing compares strings by address, so that's only memory
+        */
+        if (tableFindString(&(vm->strings), string->chars, string->length, string->hash) == NULL)
+        {
+            tableSet(&(vm->strings), string, NUMBER_VAL(0));
+        }
+    }
+}
+
+static void forgetStrings(VM* vm, FrozenChunk* frozen)
+{
+    Chunk* chunk = &(frozen->chunk);
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        /* By address, an equal string of the VM's own stays */
+        if (IS_STRING(chunk->constants.values[i]))
+        {
+            tableDelete(&(vm->strings), AS_STRING(chunk->constants.values[i]));
+        }
+    }
+}
+
+void freeFrozenTable(VM* vm, FrozenTable* table)
+{
+    for (int i = 0; i < table->capacity; i++)
+    {
+        FrozenChunk* frozen = table->entries[i].frozen;
+        if (frozen != NULL)
+        {
+            forgetStrings(vm, frozen);
+            releaseFrozenChunk(frozen);
+        }
+    }
+    FREE_ARRAY(table->allocator, MEM_TABLES, FrozenUse, table->entries, table->capacity);
+    initFrozenTable(table, table->allocator);
+}
+
+static FrozenUse* findUse(FrozenUse* entries, int capacity, FrozenChunk* frozen)
+{
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t index = (uint32_t)hashBytes(&frozen, sizeof(frozen), 0) & mask;
+    while (entries[index].frozen != NULL && entries[index].frozen != frozen)
+    {
+        index = (index + 1) & mask;
+    }
+    return &entries[index];
+}
+
+static void growFrozenTable(FrozenTable* table)
+{
+    int capacity = table->capacity < 8 ? 8 : table->capacity * 2;
+    FrozenUse* entries = GROW_ARRAY(table->allocator, MEM_TABLES, FrozenUse, NULL, 0, capacity);
+    memset(entries, 0, sizeof(FrozenUse) * capacity);
+    for (int i = 0; i < table->capacity; i++)
+    {
+        if (table->entries[i].frozen != NULL)
+        {
+            *findUse(entries, capacity, table->entries[i].frozen) = table->entries[i];
+        }
+    }
+    FREE_ARRAY(table->allocator, MEM_TABLES, FrozenUse, table->entries, table->capacity);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+FrozenUse* attachFrozenChunk(VM* vm, FrozenTable* table, FrozenChunk* frozen)
+{
+    if (table->capacity > 0)
+    {
+        FrozenUse* use = findUse(table->entries, table->capacity, frozen);
+        if (use->frozen != NULL)
+        {
+            return use;
+        }
+    }
+
+    if (table->count + 1 > table->capacity * FROZEN_TABLE_MAX_LOAD)
+    {
+        growFrozenTable(table);
+    }
+    FrozenUse* use = findUse(table->entries, table->capacity, frozen);
+    use->frozen = retainFrozenChunk(frozen);
+    use->runs = 0;
+    table->count++;
+    internStrings(vm, frozen);
+    return use;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef clox_frozen_h
+#define clox_frozen_h
+
+#include <stdatomic.h>
+
+#include "chunk.h"
+
+/* Sections of a frozen chunk start on this boundary, like heap objects */
+#define FROZEN_ALIGNMENT        16
+#define FROZEN_ALIGN(size)      (((size) + FROZEN_ALIGNMENT - 1) & ~((size_t)FROZEN_ALIGNMENT - 1))
+#define FROZEN_TABLE_MAX_LOAD   0.75
+
+/*
+    A compiled chunk that never changes again: code, lines and constants (strings included) copied into one block
+    that belongs to no VM. Any number of VMs, on any threads, run it at the same time without copying or locking.
+    Reference counted, whoever drops the last reference frees it
+*/
+typedef struct
+{
+    /* Points into the block right behind this header, read only from here on */
+    Chunk chunk;
+    atomic_int refCount;
+    /* The whole block, header included */
+    size_t size;
+} FrozenChunk;
+
+/* What one VM keeps about one frozen chunk, so the chunk itself is never written */
+typedef struct
+{
+    FrozenChunk* frozen;
+    uint64_t runs;
+} FrozenUse;
+
+/* Per VM side table of the frozen chunks it runs, open addressing on the chunk's address */
+typedef struct
+{
+    Allocator* allocator;
+    FrozenUse* entries;
+    int count;
+    int capacity;
+} FrozenTable;
+
+/*
+    Freeze a compiled chunk, the caller holds the one reference. chunk stays as it was (apart from ropes
+    among its constants being flattened) and can be freed right away
+*/
+FrozenChunk* freezeChunk(VM* vm, Chunk* chunk);
+FrozenChunk* retainFrozenChunk(FrozenChunk* frozen);
+/* Safe from any thread */
+void releaseFrozenChunk(FrozenChunk* frozen);
+
+void initFrozenTable(FrozenTable* table, Allocator* allocator);
+/* Drops the VM's references and takes the chunks' strings back out of vm->strings */
+void freeFrozenTable(VM* vm, FrozenTable* table);
+/*
+    The VM's entry for frozen. The first time, the VM takes a reference of its own
+    and interns the chunk's strings, so the host may release frozen while the VM still runs it
+*/
+FrozenUse* attachFrozenChunk(VM* vm, FrozenTable* table, FrozenChunk* frozen);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,691 @@
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "gc.h"
+#include "vm.h"
+
+/* Objects are kept 16-byte aligned in the nursery, like the slabs do */
+#define GC_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+static uint64_t nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void pushObj(VM* vm, ObjStack* stack, Obj* object)
+{
+    if (stack->count == stack->capacity)
+    {
+        int oldCapacity = stack->capacity;
+        stack->capacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+        /* GC bookkeeping, not something the script allocated */
+        stack->objects = GROW_ARRAY(vm->allocator, MEM_OTHER, Obj*, stack->objects, oldCapacity, stack->capacity);
+    }
+    stack->objects[stack->count] = object;
+    stack->count++;
+}
+
+static void freeObjStack(VM* vm, ObjStack* stack)
+{
+    FREE_ARRAY(vm->allocator, MEM_OTHER, Obj*, stack->objects, stack->capacity);
+    stack->objects = NULL;
+    stack->count = 0;
+    stack->capacity = 0;
+}
+
+void initGC(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    memset(gc, 0, sizeof(GC));
+    gc->nursery = GROW_ARRAY(vm->allocator, MEM_OBJECTS, char, NULL, 0, GC_NURSERY_SIZE);
+    gc->nurseryTop = gc->nursery;
+    gc->nurserySize = GC_NURSERY_SIZE;
+    gc->nurseryEnd = gc->nursery + gc->nurserySize;
+    gc->nextMajor = GC_MIN_MAJOR_THRESHOLD;
+    gc->phase = GC_IDLE;
+    gc->pauseBudgetNs = GC_DEFAULT_PAUSE_BUDGET_NS;
+}
+
+void freeGC(VM* vm)
+{
+    /* Old objects go with the slab heap, all at once */
+    GC* gc = &(vm->gc);
+    FREE_ARRAY(vm->allocator, MEM_OBJECTS, char, gc->nursery, GC_NURSERY_SIZE);
+    freeObjStack(vm, &(gc->nurseryStorage));
+    freeObjStack(vm, &(gc->youngStrings));
+    freeObjStack(vm, &(gc->gray));
+    FREE_ARRAY(vm->allocator, MEM_OTHER, RememberedSlot, gc->remembered.slots, gc->remembered.capacity);
+    freeObjStack(vm, &(gc->promoted));
+    memset(gc, 0, sizeof(GC));
+}
+
+/* Everything the VM can reach directly but the fibers switched out */
+static void forEachVMRoot(VM* vm, void (*visit)(VM* vm, Value* slot))
+{
+    GC* gc = &(vm->gc);
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++)
+    {
+        visit(vm, slot);
+    }
+    visit(vm, &(vm->result));
+    for (int i = 0; i < vm->slotCount; i++)
+    {
+        visit(vm, &(vm->slots[i]));
+    }
+    if (vm->chunk != NULL)
+    {
+        for (int i = 0; i < vm->chunk->constants.count; i++)
+        {
+            visit(vm, &(vm->chunk->constants.values[i]));
+        }
+    }
+    for (int i = 0; i < gc->rootCount; i++)
+    {
+        visit(vm, gc->roots[i]);
+    }
+    /* Constants of a chunk still being compiled, and of the ones cached for later */
+    markCompilerRoots(vm, visit);
+    markChunkCacheRoots(vm, &(vm->chunkCache), visit);
+}
+
+/* Everything the VM can reach directly */
+static void forEachRoot(VM* vm, void (*visit)(VM* vm, Value* slot))
+{
+    forEachVMRoot(vm, visit);
+    /* Fibers switched out, and results of finished ones */
+    markFiberRoots(vm, &(vm->fibers), visit);
+}
+
+static Obj* allocateOld(VM* vm, size_t size)
+{
+    GC* gc = &(vm->gc);
+    Obj* object = reallocateWith(&(vm->heap.allocator), MEM_OBJECTS, NULL, 0, size);
+    /*
+        Born black while marking, it has no references yet so there is nothing to scan.
+        White otherwise, the sweep only walks the list it detached
+    */
+    object->flags = OBJ_OLD | (gc->phase == GC_MARK ? OBJ_MARKED : 0);
+    object->size = (uint32_t)size;
+    object->next = gc->oldObjects;
+    gc->oldObjects = object;
+    gc->oldBytes += size;
+    gc->oldGrowth += size;
+    return object;
+}
+
+static void freeOld(VM* vm, Obj* object)
+{
+    GC* gc = &(vm->gc);
+    freeObjectStorage(vm, object);
+    gc->oldBytes -= object->size;
+    gc->stats.freedBytes += object->size;
+    reallocateWith(&(vm->heap.allocator), MEM_OBJECTS, object, object->size, 0);
+}
+
+Obj* gcAllocate(VM* vm, size_t size)
+{
+    GC* gc = &(vm->gc);
+    size = GC_ALIGN(size);
+    gc->stats.allocatedBytes += size;
+
+    if (size > GC_NURSERY_MAX_OBJECT)
+    {
+        /* Big allocations pace the collector like a full nursery would */
+        gc->pretenuredBytes += size;
+        if (gc->pretenuredBytes >= gc->nurserySize)
+        {
+            gcCollect(vm);
+        }
+        gcCheckHeapBudget(vm, size);
+        return allocateOld(vm, size);
+    }
+
+    if (gc->nurseryTop + size > gc->nurseryEnd)
+    {
+        gcCollect(vm);
+        /* The survivors just moved into the old generation. Checked here only, the bump below stays cheap */
+        gcCheckHeapBudget(vm, size);
+    }
+    Obj* object = (Obj*)gc->nurseryTop;
+    gc->nurseryTop += size;
+    object->flags = 0;
+    object->size = (uint32_t)size;
+    object->next = NULL;
+    return object;
+}
+
+size_t gcHeapBytes(VM* vm)
+{
+    return vm->heap.allocator.stats.total.liveBytes + (size_t)(vm->gc.nurseryTop - vm->gc.nursery);
+}
+
+void gcCheckHeapBudget(VM* vm, size_t bytes)
+{
+    BudgetMeter* budget = &(vm->budget);
+    if (budget->limits.heapBytes != 0 && vm->errorHandler != NULL &&
+        gcHeapBytes(vm) + bytes > budget->limits.heapBytes)
+    {
+        budget->status = BUDGET_HEAP;
+        panicWith(vm, budgetMessage(BUDGET_HEAP));
+    }
+}
+
+void gcTrackStorage(VM* vm, Obj* object)
+{
+    /* Old objects free their storage when swept */
+    if (!(object->flags & OBJ_OLD))
+    {
+        pushObj(vm, &(vm->gc.nurseryStorage), object);
+    }
+}
+
+void gcTrackInterned(VM* vm, ObjString* string)
+{
+    if (!(string->obj.flags & OBJ_OLD))
+    {
+        pushObj(vm, &(vm->gc.youngStrings), (Obj*)string);
+    }
+}
+
+static void markObject(VM* vm, Obj* object)
+{
+    if (object->flags & (OBJ_MARKED | OBJ_PERMANENT))
+    {
+        return;
+    }
+    object->flags |= OBJ_MARKED;
+    pushObj(vm, &(vm->gc.gray), object);
+}
+
+static void markSlot(VM* vm, Value* slot)
+{
+    if (IS_OBJ(*slot))
+    {
+        markObject(vm, AS_OBJ(*slot));
+    }
+}
+
+static void rememberSlot(VM* vm, Obj* owner, int slot)
+{
+    RememberedSet* remembered = &(vm->gc.remembered);
+    if (remembered->count == remembered->capacity)
+    {
+        int oldCapacity = remembered->capacity;
+        remembered->capacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+        remembered->slots = GROW_ARRAY(vm->allocator, MEM_OTHER, RememberedSlot, remembered->slots,
+                                       oldCapacity, remembered->capacity);
+    }
+    remembered->slots[remembered->count].owner = owner;
+    remembered->slots[remembered->count].slot = slot;
+    remembered->count++;
+}
+
+void gcWriteBarrier(VM* vm, Obj* owner, int slot, Value value)
+{
+    /* Young owners are always scanned in full, nothing to remember */
+    if (!IS_OBJ(value) || !(owner->flags & OBJ_OLD))
+    {
+        return;
+    }
+
+    GC* gc = &(vm->gc);
+    Obj* object = AS_OBJ(value);
+    if (!(object->flags & OBJ_OLD))
+    {
+        rememberSlot(vm, owner, slot);
+    }
+    else if (gc->phase == GC_MARK && (owner->flags & OBJ_MARKED))
+    {
+        /* A marked object must never point to an unmarked one */
+        markObject(vm, object);
+    }
+}
+
+/* Young ones don't count, the next minor collection promotes them gray */
+static void markOldSlot(VM* vm, Value* slot)
+{
+    if (IS_OBJ(*slot) && (AS_OBJ(*slot)->flags & OBJ_OLD))
+    {
+        markObject(vm, AS_OBJ(*slot));
+    }
+}
+
+void gcStopFiber(VM* vm, int id)
+{
+    if (id == FIBER_NONE)
+    {
+        return;
+    }
+    /* Its chunk is the one running, whose constants are among the roots marking ends with */
+    Chunk* visited = vm->fibers.fibers[id].chunk;
+    markFiber(vm, &(vm->fibers), id, &visited, markOldSlot);
+}
+
+void gcPushRoot(VM* vm, Value* slot)
+{
+    GC* gc = &(vm->gc);
+    if (gc->rootCount >= GC_MAX_ROOTS)
+    {
+        panicWith(vm, "Too many GC roots");
+    }
+    gc->roots[gc->rootCount] = slot;
+    gc->rootCount++;
+}
+
+void gcPopRoot(VM* vm)
+{
+    vm->gc.rootCount--;
+}
+
+/* Minor collection */
+
+static Obj* promote(VM* vm, Obj* object)
+{
+    GC* gc = &(vm->gc);
+    Obj* copy = allocateOld(vm, object->size);
+    uint8_t flags = copy->flags;
+    Obj* next = copy->next;
+    memcpy(copy, object, object->size);
+    copy->flags = flags;
+    copy->next = next;
+    gc->stats.promotedBytes += copy->size;
+
+    if (gc->phase == GC_MARK)
+    {
+        /* Gray rather than black, it may point to old objects the marker hasn't seen yet */
+        pushObj(vm, &(gc->gray), copy);
+    }
+
+    object->flags |= OBJ_FORWARDED;
+    object->next = copy;
+    pushObj(vm, &(gc->promoted), copy);
+    return copy;
+}
+
+static void evacuate(VM* vm, Value* slot)
+{
+    if (!IS_OBJ(*slot))
+    {
+        return;
+    }
+    Obj* object = AS_OBJ(*slot);
+    if (object->flags & OBJ_OLD)
+    {
+        return;
+    }
+    slot->as.obj = (object->flags & OBJ_FORWARDED) ? object->next : promote(vm, object);
+}
+
+static void minorCollection(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    forEachRoot(vm, evacuate);
+
+    for (int i = 0; i < gc->remembered.count; i++)
+    {
+        RememberedSlot* remembered = &(gc->remembered.slots[i]);
+        evacuate(vm, objectSlot(remembered->owner, remembered->slot));
+    }
+    gc->remembered.count = 0;
+
+    /* Cheney-style, except the to-space is the old generation so we keep our own worklist */
+    while (gc->promoted.count > 0)
+    {
+        gc->promoted.count--;
+        traceObject(vm, gc->promoted.objects[gc->promoted.count], evacuate);
+    }
+
+    /* Follow the interned strings that moved, forget the ones that died */
+    for (int i = 0; i < gc->youngStrings.count; i++)
+    {
+        ObjString* string = (ObjString*)gc->youngStrings.objects[i];
+        if (string->obj.flags & OBJ_FORWARDED)
+        {
+            tableReplaceKey(&vm->strings, string, (ObjString*)string->obj.next);
+        }
+        else
+        {
+            tableDelete(&vm->strings, string);
+        }
+    }
+    gc->youngStrings.count = 0;
+
+    /* Moved objects took their storage along, the rest died young */
+    for (int i = 0; i < gc->nurseryStorage.count; i++)
+    {
+        Obj* object = gc->nurseryStorage.objects[i];
+        if (!(object->flags & OBJ_FORWARDED))
+        {
+            freeObjectStorage(vm, object);
+        }
+    }
+    gc->nurseryStorage.count = 0;
+
+    gc->nurseryTop = gc->nursery;
+    gc->pretenuredBytes = 0;
+    gc->stats.minorCollections++;
+}
+
+/* Major collection, always right after a minor one so the nursery is empty */
+
+static void startMajor(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    gc->phase = GC_MARK;
+    /* Only growth during the cycle has to be paid for */
+    gc->oldGrowth = 0;
+    gc->workDebt = 0;
+    /* The fibers switched out are marked one at a time by the steps */
+    gc->fiberCursor = 0;
+    forEachVMRoot(vm, markSlot);
+}
+
+static void startSweep(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    /* Marking is done, whatever the intern table has that is still white is garbage */
+    tableRemoveWhite(&vm->strings);
+    gc->phase = GC_SWEEP;
+    gc->sweepList = gc->oldObjects;
+    gc->oldObjects = NULL;
+}
+
+static void finishMajor(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    gc->phase = GC_IDLE;
+    gc->nextMajor = gc->oldBytes * GC_HEAP_GROW_FACTOR;
+    if (gc->nextMajor < GC_MIN_MAJOR_THRESHOLD)
+    {
+        gc->nextMajor = GC_MIN_MAJOR_THRESHOLD;
+    }
+    gc->stats.majorCycles++;
+}
+
+/* The next slice of the big array being traced, returns how many slots it was */
+static int traceSlice(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    /* It may have grown or shrunk since the last slice, new slots went through the barrier */
+    ObjArray* array = (ObjArray*)gc->tracing;
+    int end = gc->tracedSlots + GC_TRACE_SLICE;
+    if (end >= array->count)
+    {
+        end = array->count;
+        gc->tracing = NULL;
+    }
+    int slots = end - gc->tracedSlots;
+    for (int i = gc->tracedSlots; i < end; i++)
+    {
+        markSlot(vm, &(array->values[i]));
+    }
+    gc->tracedSlots = end;
+    return slots > 0 ? slots : 1;
+}
+
+/* One piece of marking, returns how much work it was in objects and slots, and adds it up in bytes */
+static int markStep(VM* vm, Chunk** visited, size_t* workBytes)
+{
+    GC* gc = &(vm->gc);
+    if (gc->tracing != NULL)
+    {
+        int slots = traceSlice(vm);
+        *workBytes += (size_t)slots * sizeof(Value);
+        return slots;
+    }
+    if (gc->gray.count > 0)
+    {
+        gc->gray.count--;
+        Obj* object = gc->gray.objects[gc->gray.count];
+        *workBytes += object->size;
+        if (object->type == OBJ_ARRAY && ((ObjArray*)object)->count > GC_TRACE_SLICE)
+        {
+            gc->tracing = object;
+            gc->tracedSlots = 0;
+            return 1;
+        }
+        traceObject(vm, object, markSlot);
+        return 1;
+    }
+
+    FiberTable* fibers = &(vm->fibers);
+    if (gc->fiberCursor < fibers->count)
+    {
+        int id = gc->fiberCursor++;
+        if (id == fibers->current)
+        {
+            /* Its stack is in the registers */
+            markSlot(vm, &(fibers->fibers[id].result));
+            return 1;
+        }
+        markFiber(vm, fibers, id, visited, markSlot);
+        int slots = (int)(fibers->fibers[id].stackTop - fibers->fibers[id].stack);
+        *workBytes += (size_t)slots * sizeof(Value);
+        return 1 + slots;
+    }
+
+    /* The rest of the roots have no barrier, so look at them again before calling the marking done */
+    forEachVMRoot(vm, markSlot);
+    if (gc->gray.count == 0)
+    {
+        startSweep(vm);
+    }
+    return 1;
+}
+
+static void majorStep(VM* vm, uint64_t deadline)
+{
+    GC* gc = &(vm->gc);
+    int work = 0;
+    size_t workBytes = 0;
+    size_t minimumBytes = gc->oldGrowth * GC_WORK_RATIO + gc->workDebt;
+    gc->oldGrowth = 0;
+    gc->stats.majorSteps++;
+    /* Fibers spawned by one script share its chunk, see markFiberRoots() */
+    Chunk* visited = vm->chunk;
+    uint64_t lastCheck = nowNs();
+
+    while (gc->phase != GC_IDLE)
+    {
+        if (gc->phase == GC_MARK)
+        {
+            work += markStep(vm, &visited, &workBytes);
+        }
+        else
+        {
+            Obj* object = gc->sweepList;
+            if (object == NULL)
+            {
+                finishMajor(vm);
+                break;
+            }
+            gc->sweepList = object->next;
+            work++;
+            workBytes += object->size;
+            if (object->flags & OBJ_MARKED)
+            {
+                object->flags &= ~OBJ_MARKED;
+                object->next = gc->oldObjects;
+                gc->oldObjects = object;
+            }
+            else
+            {
+                freeOld(vm, object);
+            }
+        }
+
+        if (work >= GC_WORK_CHECK_INTERVAL)
+        {
+            /* Stop unless two more stretches of work like the last one would still end before the deadline */
+            work = 0;
+            uint64_t now = nowNs();
+            if (now + 2 * (now - lastCheck) >= deadline)
+            {
+                break;
+            }
+            lastCheck = now;
+        }
+    }
+    gc->workDebt = (gc->phase != GC_IDLE && workBytes < minimumBytes) ? minimumBytes - workBytes : 0;
+}
+
+/*
+    Minor collections take about as long as what survives them, which a smaller nursery cuts down.
+    Shrinking it also makes the major steps come more often, which is how a cycle in debt catches up
+*/
+static void resizeNursery(VM* vm, uint64_t minorNs)
+{
+    GC* gc = &(vm->gc);
+    if (minorNs > gc->pauseBudgetNs / 2 || gc->workDebt > 0)
+    {
+        if (gc->nurserySize > GC_MIN_NURSERY_SIZE)
+        {
+            gc->nurserySize /= 2;
+        }
+    }
+    else if (minorNs < gc->pauseBudgetNs / 8 && gc->nurserySize < GC_NURSERY_SIZE)
+    {
+        gc->nurserySize *= 2;
+    }
+    gc->nurseryEnd = gc->nursery + gc->nurserySize;
+}
+
+/* Pauses */
+
+static int pauseBucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < 4)
+    {
+        return (int)nanoseconds;
+    }
+    int exponent = 63 - __builtin_clzll(nanoseconds);
+    int bucket = exponent * 4 + (int)((nanoseconds >> (exponent - 2)) & 3);
+    return bucket < GC_PAUSE_BUCKETS ? bucket : GC_PAUSE_BUCKETS - 1;
+}
+
+static uint64_t bucketLimit(int bucket)
+{
+    if (bucket < 4)
+    {
+        return (uint64_t)bucket + 1;
+    }
+    return (uint64_t)(4 + bucket % 4 + 1) << (bucket / 4 - 2);
+}
+
+static void recordPause(VM* vm, uint64_t start)
+{
+    GCStats* stats = &(vm->gc.stats);
+    uint64_t pause = nowNs() - start;
+    stats->pauses++;
+    stats->totalPauseNs += pause;
+    if (pause > stats->maxPauseNs)
+    {
+        stats->maxPauseNs = pause;
+    }
+    if (pause > vm->gc.pauseBudgetNs)
+    {
+        stats->overBudgetPauses++;
+    }
+    stats->pauseHistogram[pauseBucket(pause)]++;
+}
+
+void gcCollect(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    uint64_t start = nowNs();
+
+    minorCollection(vm);
+    uint64_t minorNs = nowNs() - start;
+    if (minorNs > gc->stats.maxMinorNs)
+    {
+        gc->stats.maxMinorNs = minorNs;
+    }
+    if (gc->phase == GC_IDLE && gc->oldBytes >= gc->nextMajor)
+    {
+        startMajor(vm);
+    }
+    if (gc->phase != GC_IDLE)
+    {
+        majorStep(vm, start + gc->pauseBudgetNs);
+    }
+    resizeNursery(vm, minorNs);
+
+    recordPause(vm, start);
+}
+
+void gcCollectFull(VM* vm)
+{
+    GC* gc = &(vm->gc);
+    uint64_t start = nowNs();
+
+    minorCollection(vm);
+    /* A cycle already running can't free what died after it started, so finish it and do another */
+    if (gc->phase != GC_IDLE)
+    {
+        majorStep(vm, UINT64_MAX);
+    }
+    startMajor(vm);
+    majorStep(vm, UINT64_MAX);
+
+    recordPause(vm, start);
+}
+
+void gcSetPauseBudget(VM* vm, uint64_t nanoseconds)
+{
+    vm->gc.pauseBudgetNs = nanoseconds;
+}
+
+const GCStats* gcStats(VM* vm)
+{
+    return &(vm->gc.stats);
+}
+
+uint64_t gcPausePercentile(VM* vm, double percentile)
+{
+    const GCStats* stats = &(vm->gc.stats);
+    if (stats->pauses == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)stats->pauses);
+    if (rank >= stats->pauses)
+    {
+        rank = stats->pauses - 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        seen += stats->pauseHistogram[i];
+        if (seen > rank)
+        {
+            /* The max is exact, the buckets aren't */
+            uint64_t limit = bucketLimit(i);
+            return limit < stats->maxPauseNs ? limit : stats->maxPauseNs;
+        }
+    }
+    return stats->maxPauseNs;
+}
+
+void dumpGCStats(VM* vm, FILE* stream)
+{
+    const GCStats* stats = &(vm->gc.stats);
+    fprintf(stream, "---------- GC ------------\n");
+    fprintf(stream, "%-20s %14llu\n", "minor collections", (unsigned long long)stats->minorCollections);
+    fprintf(stream, "%-20s %14llu\n", "major cycles", (unsigned long long)stats->majorCycles);
+    fprintf(stream, "%-20s %14llu\n", "major steps", (unsigned long long)stats->majorSteps);
+    fprintf(stream, "%-20s %14llu\n", "allocated bytes", (unsigned long long)stats->allocatedBytes);
+    fprintf(stream, "%-20s %14llu\n", "promoted bytes", (unsigned long long)stats->promotedBytes);
+    fprintf(stream, "%-20s %14llu\n", "freed old bytes", (unsigned long long)stats->freedBytes);
+    fprintf(stream, "%-20s %14zu\n", "old generation", vm->gc.oldBytes);
+    fprintf(stream, "%-20s %14llu\n", "pauses", (unsigned long long)stats->pauses);
+    fprintf(stream, "%-20s %11.1f us\n", "pause p50", gcPausePercentile(vm, 50) / 1000.0);
+    fprintf(stream, "%-20s %11.1f us\n", "pause p99", gcPausePercentile(vm, 99) / 1000.0);
+    fprintf(stream, "%-20s %11.1f us\n", "pause max", stats->maxPauseNs / 1000.0);
+    fprintf(stream, "%-20s %11.1f us\n", "minor max", stats->maxMinorNs / 1000.0);
+    fprintf(stream, "%-20s %14llu\n", "over budget", (unsigned long long)stats->overBudgetPauses);
+    fprintf(stream, "%-20s %11.1f us\n", "pause budget", vm->gc.pauseBudgetNs / 1000.0);
+    fprintf(stream, "%-20s %14zu\n", "nursery bytes", vm->gc.nurserySize);
+}
\ No newline at end of file
@@ -0,0 +1,177 @@
+#ifndef clox_gc_h
+#define clox_gc_h
+
+#include "common.h"
+#include "object.h"
+
+/*
+    Generational collector:
+    - Young objects are bump-allocated in the nursery. When it fills up, a minor collection copies
+      the survivors into the old generation (promote on first survival) and starts the nursery over.
+    - The old generation lives in the VM's slab heap and is collected by an incremental mark-sweep.
+      Its steps run right after a minor collection, until the pause budget is used up. Big arrays are traced
+      a slice at a time and the fibers' stacks one fiber at a time, so no single piece of work blows the budget.
+    - The nursery shrinks when a minor collection takes more than half the budget, or when the major cycle
+      falls behind the mutator (collecting more often is how it catches up), and grows back when neither holds.
+    - gcWriteBarrier() keeps both honest: old objects pointing into the nursery go to the remembered set,
+      (a store buffer of slots, so a big old array costs what was stored into it, not its length),
+      and during marking a store into a marked object marks the stored object (Dijkstra).
+*/
+#define GC_NURSERY_SIZE             0x40000
+#define GC_MIN_NURSERY_SIZE         0x4000
+/* Bigger objects skip the nursery */
+#define GC_NURSERY_MAX_OBJECT       0x100
+#define GC_DEFAULT_PAUSE_BUDGET_NS  1000000
+/* Start the first major cycle once the old generation has this many bytes */
+#define GC_MIN_MAJOR_THRESHOLD      0x100000
+#define GC_HEAP_GROW_FACTOR         2
+/* Major work is counted in objects and slots, the clock is only read this often */
+#define GC_WORK_CHECK_INTERVAL      0x100
+/* Arrays longer than this are traced this many slots at a time */
+#define GC_TRACE_SLICE              0x100
+/*
+    A step should mark or sweep this many bytes per byte the old generation grew since the last one.
+    Whatever the budget cut short is owed, and the nursery shrinks until the steps come often enough to pay it
+*/
+#define GC_WORK_RATIO               4
+#define GC_MAX_ROOTS                64
+/* Log-linear: 4 buckets for every power of two nanoseconds */
+#define GC_PAUSE_BUCKETS            256
+
+typedef enum
+{
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP
+} GCPhase;
+
+typedef struct
+{
+    uint64_t minorCollections;
+    uint64_t majorCycles;
+    uint64_t majorSteps;
+    uint64_t allocatedBytes;
+    uint64_t promotedBytes;
+    uint64_t freedBytes;
+    /* Every pause, minor collection plus major step */
+    uint64_t pauses;
+    uint64_t totalPauseNs;
+    uint64_t maxPauseNs;
+    uint64_t overBudgetPauses;
+    /* Of the pauses, the minor collections alone */
+    uint64_t maxMinorNs;
+    uint64_t pauseHistogram[GC_PAUSE_BUCKETS];
+} GCStats;
+
+typedef struct
+{
+    Obj** objects;
+    int count;
+    int capacity;
+} ObjStack;
+
+/* Slot index rather than address, an array's storage may move when it grows */
+typedef struct
+{
+    Obj* owner;
+    int slot;
+} RememberedSlot;
+
+typedef struct
+{
+    RememberedSlot* slots;
+    int count;
+    int capacity;
+} RememberedSet;
+
+typedef struct
+{
+    char* nursery;
+    char* nurseryTop;
+    char* nurseryEnd;
+    /* How much of the nursery is in use, nurseryEnd is that far from nursery */
+    size_t nurserySize;
+    /* Nursery objects that own storage (see gcTrackStorage()), freed when they die young */
+    ObjStack nurseryStorage;
+
+    /* Every old object */
+    Obj* oldObjects;
+    size_t oldBytes;
+    size_t nextMajor;
+    /* Allocated straight into the old generation since the last collection */
+    size_t pretenuredBytes;
+    /* Promoted or pretenured since the last major step, sets its minimum work */
+    size_t oldGrowth;
+    /* Work the budget cut short, in bytes, the major cycle is behind while there is any */
+    size_t workDebt;
+
+    GCPhase phase;
+    ObjStack gray;
+    /* The big array being traced a slice at a time, and the next slot of it */
+    Obj* tracing;
+    int tracedSlots;
+    /*
+        Next fiber whose stack marking looks at. One that stops running while marking has its stack marked
+        there and then (see gcStopFiber()), so one pass of this is enough and the rest of the roots are few
+    */
+    int fiberCursor;
+    /* Detached from oldObjects while the sweep walks it */
+    Obj* sweepList;
+
+    /* Interned strings still in the nursery, the intern table holds them weakly */
+    ObjStack youngStrings;
+
+    /* Old slots that may point into the nursery, duplicates and stale entries are harmless */
+    RememberedSet remembered;
+    /* Promoted during this minor collection, still to be scanned */
+    ObjStack promoted;
+
+    /* Slots the host asked us to treat as roots */
+    Value* roots[GC_MAX_ROOTS];
+    int rootCount;
+
+    uint64_t pauseBudgetNs;
+    GCStats stats;
+} GC;
+
+/* Every function works on the given VM's gc, with vm->allocator for the nursery and vm->heap for old objects */
+void initGC(VM* vm);
+void freeGC(VM* vm);
+
+/* Raw memory for a new object, with the header's GC fields set. May collect, and panic over the heap budget */
+Obj* gcAllocate(VM* vm, size_t size);
+/*
+    What the heap budget counts: everything the heap allocator has live (old objects and what objects own),
+    plus the nursery in use
+*/
+size_t gcHeapBytes(VM* vm);
+/*
+    Panic if the heap growing by bytes would put it over vm->budget, while something runs or compiles.
+    Only where the mutator grows the heap, never in the middle of a collection
+*/
+void gcCheckHeapBudget(VM* vm, size_t bytes);
+/* The object owns memory outside itself, see freeObjectStorage() */
+void gcTrackStorage(VM* vm, Obj* object);
+/* The string was just added to vm->strings, which only holds it weakly */
+void gcTrackInterned(VM* vm, ObjString* string);
+/* Call before storing value into the given slot of owner (see objectSlot()) */
+void gcWriteBarrier(VM* vm, Obj* owner, int slot, Value value);
+/* The barrier of fiber stacks: call when fiber id (saved, or done) stops running, while vm->gc.phase is GC_MARK */
+void gcStopFiber(VM* vm, int id);
+
+/* For C code holding a value across allocations, the slot is updated if the object moves */
+void gcPushRoot(VM* vm, Value* slot);
+void gcPopRoot(VM* vm);
+
+/* A minor collection plus one budgeted major step, like the allocator would do */
+void gcCollect(VM* vm);
+/* Everything, finishing the major cycle in progress (or a new one) in one go */
+void gcCollectFull(VM* vm);
+
+void gcSetPauseBudget(VM* vm, uint64_t nanoseconds);
+const GCStats* gcStats(VM* vm);
+/* Upper bound of the bucket holding the p-th percentile (0-100) of pauses */
+uint64_t gcPausePercentile(VM* vm, double percentile);
+void dumpGCStats(VM* vm, FILE* stream);
+
+#endif
\ No newline at end of file
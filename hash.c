@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/* memcpy() so unaligned reads are fine, compilers turn it into a plain load (little endian assumed) */
+static inline uint64_t read64(const uint8_t* bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const uint8_t* bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static inline uint64_t round64(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * PRIME64_2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+static inline uint64_t mergeRound(uint64_t hash, uint64_t accumulator)
+{
+    hash ^= round64(0, accumulator);
+    return hash * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hashBytes(const void* bytes, size_t length, uint64_t seed)
+{
+    const uint8_t* current = (const uint8_t*)bytes;
+    const uint8_t* end = current + length;
+    uint64_t hash;
+
+    if (length >= 32)
+    {
+        /* Four independent lanes over 32-byte stripes */
+        uint64_t lane1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t lane2 = seed + PRIME64_2;
+        uint64_t lane3 = seed;
+        uint64_t lane4 = seed - PRIME64_1;
+        const uint8_t* limit = end - 32;
+        do
+        {
+            lane1 = round64(lane1, read64(current));
+            lane2 = round64(lane2, read64(current + 8));
+            lane3 = round64(lane3, read64(current + 16));
+            lane4 = round64(lane4, read64(current + 24));
+            current += 32;
+        } while (current <= limit);
+
+        hash = rotateLeft(lane1, 1) + rotateLeft(lane2, 7) + rotateLeft(lane3, 12) + rotateLeft(lane4, 18);
+        hash = mergeRound(hash, lane1);
+        hash = mergeRound(hash, lane2);
+        hash = mergeRound(hash, lane3);
+        hash = mergeRound(hash, lane4);
+    }
+    else
+    {
+        hash = seed + PRIME64_5;
+    }
+    hash += (uint64_t)length;
+
+    while (current + 8 <= end)
+    {
+        hash ^= round64(0, read64(current));
+        hash = rotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+        current += 8;
+    }
+    if (current + 4 <= end)
+    {
+        hash ^= (uint64_t)read32(current) * PRIME64_1;
+        hash = rotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+        current += 4;
+    }
+    while (current < end)
+    {
+        hash ^= (*current) * PRIME64_5;
+        hash = rotateLeft(hash, 11) * PRIME64_1;
+        current++;
+    }
+
+    /* Avalanche */
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#ifndef clox_hash_h
+#define clox_hash_h
+
+#include "common.h"
+
+/* xxHash64, for hashing whole sources (cache keys), not for the VM's own tables */
+uint64_t hashBytes(const void* bytes, size_t length, uint64_t seed);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "object.h"
+#include "vm.h"
+
+#define IMAGE_ALIGN(size) (((size) + IMAGE_ALIGNMENT - 1) & ~(uint64_t)(IMAGE_ALIGNMENT - 1))
+
+bool writeImage(VM* vm, const char* path, Chunk* chunk, uint64_t sourceHash)
+{
+    ImageHeader header;
+    memset(&header, 0, sizeof(ImageHeader));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.valueSize = sizeof(Value);
+    header.line = chunk->line;
+    header.pos = chunk->pos;
+    header.sourceHash = sourceHash;
+
+    /* Flatten first, that allocates, and the constants are rooted through the chunk only while it runs */
+    Chunk* running = vm->chunk;
+    vm->chunk = chunk;
+    uint64_t stringsSize = 0;
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        Value* constant = &(chunk->constants.values[i]);
+        if (IS_ROPE(*constant))
+        {
+            *constant = OBJ_VAL(flattenText(vm, constant));
+        }
+        if (IS_OBJ(*constant) && !IS_STRING(*constant))
+        {
+            fprintf(stderr, "Can't snapshot constant %d, only numbers and strings are supported.\n", i);
+            vm->chunk = running;
+            return false;
+        }
+        if (IS_STRING(*constant))
+        {
+            stringsSize += IMAGE_ALIGN(AS_OBJ(*constant)->size);
+        }
+    }
+    vm->chunk = running;
+
+    header.codeOffset = IMAGE_ALIGN(sizeof(ImageHeader));
+    header.codeCount = (uint64_t)chunk->count;
+    header.linesOffset = IMAGE_ALIGN(header.codeOffset + header.codeCount);
+    header.lineCount = (uint64_t)chunk->lineCount;
+    header.constantsOffset = IMAGE_ALIGN(header.linesOffset + header.lineCount * sizeof(LineRun));
+    header.constantCount = (uint64_t)chunk->constants.count;
+    header.stringsOffset = IMAGE_ALIGN(header.constantsOffset + header.constantCount * sizeof(Value));
+    header.stringsSize = stringsSize;
+    header.imageSize = header.stringsOffset + stringsSize;
+
+    /* Built in memory, then written in one go */
+    char* image = calloc(1, header.imageSize);
+    if (image == NULL)
+    {
+        fprintf(stderr, "Out of memory writing image \"%s\".\n", path);
+        return false;
+    }
+    memcpy(image, &header, sizeof(ImageHeader));
+    memcpy(image + header.codeOffset, chunk->code, chunk->count);
+    if (chunk->lineCount > 0)
+    {
+        memcpy(image + header.linesOffset, chunk->lines, sizeof(LineRun) * chunk->lineCount);
+    }
+
+    Value* constants = (Value*)(image + header.constantsOffset);
+    uint64_t stringOffset = header.stringsOffset;
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        Value constant = chunk->constants.values[i];
+        if (IS_STRING(constant))
+        {
+            Obj* string = AS_OBJ(constant);
+            ObjString* copy = (ObjString*)(image + stringOffset);
+            memcpy(copy, string, string->size);
+            /* Permanent: the GC never marks, moves or frees it, so its page is never written */
+            copy->obj.flags = OBJ_OLD | OBJ_PERMANENT;
+            copy->obj.next = NULL;
+            /* Offset instead of the pointer */
+            constant.as.obj = (Obj*)(uintptr_t)stringOffset;
+            stringOffset += IMAGE_ALIGN(string->size);
+        }
+        constants[i] = constant;
+    }
+
+    /* Next to the target so rename() stays on one filesystem, the pid keeps concurrent writers apart */
+    size_t pathLength = strlen(path);
+    char* temporary = malloc(pathLength + 32);
+    bool written = false;
+    if (temporary != NULL)
+    {
+        snprintf(temporary, pathLength + 32, "%s.tmp%ld", path, (long)getpid());
+        FILE* file = fopen(temporary, "wb");
+        written = file != NULL && fwrite(image, 1, header.imageSize, file) == header.imageSize;
+        if (file != NULL && fclose(file) != 0)
+        {
+            written = false;
+        }
+        if (written && rename(temporary, path) != 0)
+        {
+            written = false;
+        }
+        if (!written)
+        {
+            unlink(temporary);
+        }
+        free(temporary);
+    }
+    free(image);
+    if (!written)
+    {
+        fprintf(stderr, "Could not write image \"%s\".\n", path);
+    }
+    return written;
+}
+
+static bool validImage(ImageHeader* header, size_t size)
+{
+    if (size < sizeof(ImageHeader) || memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+    {
+        return false;
+    }
+    if (header->version != IMAGE_VERSION || header->valueSize != sizeof(Value) || header->imageSize != size)
+    {
+        return false;
+    }
+    /* Sections in order and inside the file */
+    return header->codeOffset >= sizeof(ImageHeader) &&
+           header->codeCount <= INT32_MAX && header->constantCount <= INT32_MAX &&
+           header->lineCount <= INT32_MAX &&
+           header->linesOffset >= header->codeOffset + header->codeCount &&
+           header->linesOffset % IMAGE_ALIGNMENT == 0 &&
+           header->constantsOffset >= header->linesOffset + header->lineCount * sizeof(LineRun) &&
+           header->constantsOffset % IMAGE_ALIGNMENT == 0 &&
+           header->stringsOffset >= header->constantsOffset + header->constantCount * sizeof(Value) &&
+           header->stringsOffset % IMAGE_ALIGNMENT == 0 &&
+           header->stringsOffset + header->stringsSize == size;
+}
+
+/* quiet: a cache that can't be used is a miss, not an error */
+static bool mapImage(VM* vm, const char* path, Image* image, bool quiet, bool checkHash, uint64_t sourceHash)
+{
+    image->vm = vm;
+    image->base = NULL;
+    image->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        if (!quiet)
+        {
+            fprintf(stderr, "Could not open image \"%s\".\n", path);
+        }
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1 || fileStat.st_size <= 0)
+    {
+        fprintf(stderr, "Could not stat image \"%s\".\n", path);
+        close(fd);
+        return false;
+    }
+
+    /* Private and writable: relocating touches only the pages it patches, the rest stays shared with the page cache */
+    size_t size = (size_t)fileStat.st_size;
+    char* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map image \"%s\".\n", path);
+        return false;
+    }
+
+    ImageHeader* header = (ImageHeader*)base;
+    if (!validImage(header, size))
+    {
+        if (!quiet)
+        {
+            fprintf(stderr, "\"%s\" is not a clox image of this version.\n", path);
+        }
+        munmap(base, size);
+        return false;
+    }
+    /* Checked before relocating, a stale cache must not leave its strings behind in vm->strings */
+    if (checkHash && header->sourceHash != sourceHash)
+    {
+        munmap(base, size);
+        return false;
+    }
+
+    /* Check every constant before interning any, a corrupted image must not leave strings behind in vm->strings */
+    Value* constants = (Value*)(base + header->constantsOffset);
+    for (uint64_t i = 0; i < header->constantCount; i++)
+    {
+        if (constants[i].type != VAL_OBJ)
+        {
+            continue;
+        }
+        uint64_t offset = (uint64_t)(uintptr_t)constants[i].as.obj;
+        ObjString* string = (ObjString*)(base + offset);
+        if (offset < header->stringsOffset || offset + sizeof(ObjString) > size ||
+            offset + sizeof(ObjString) + (uint64_t)string->length + 1 > size || string->obj.type != OBJ_STRING)
+        {
+            if (!quiet)
+            {
+                fprintf(stderr, "Corrupted constant %llu in image \"%s\".\n", (unsigned long long)i, path);
+            }
+            munmap(base, size);
+            return false;
+        }
+    }
+
+    /* Relocate: string offsets become pointers, and the strings get interned */
+    for (uint64_t i = 0; i < header->constantCount; i++)
+    {
+        if (constants[i].type != VAL_OBJ)
+        {
+            continue;
+        }
+        ObjString* string = (ObjString*)(base + (uint64_t)(uintptr_t)constants[i].as.obj);
+        ObjString* interned = tableFindString(&(vm->strings), string->chars, string->length, string->hash);
+        if (interned == NULL)
+        {
+            tableSet(&(vm->strings), string, NUMBER_VAL(0));
+            interned = string;
+        }
+        constants[i].as.obj = (Obj*)interned;
+    }
+    image->base = base;
+    image->size = size;
+    image->sourceHash = header->sourceHash;
+    Chunk* chunk = &(image->chunk);
+    initChunkWith(chunk, NULL);
+    chunk->code = (uint8_t*)(base + header->codeOffset);
+    chunk->count = (int)header->codeCount;
+    chunk->capacity = chunk->count;
+    chunk->line = header->line;
+    chunk->pos = header->pos;
+    chunk->lines = (LineRun*)(base + header->linesOffset);
+    chunk->lineCount = (int)header->lineCount;
+    chunk->lineCapacity = chunk->lineCount;
+    chunk->constants.values = constants;
+    chunk->constants.count = (int)header->constantCount;
+    chunk->constants.capacity = chunk->constants.count;
+    return true;
+}
+
+bool loadImage(VM* vm, const char* path, Image* image)
+{
+    return mapImage(vm, path, image, false, false, 0);
+}
+
+bool loadCachedImage(VM* vm, const char* path, uint64_t sourceHash, Image* image)
+{
+    return mapImage(vm, path, image, true, true, sourceHash);
+}
+
+void freeImage(Image* image)
+{
+    if (image->base == NULL)
+    {
+        return;
+    }
+    char* end = (char*)image->base + image->size;
+    for (int i = 0; i < image->chunk.constants.count; i++)
+    {
+        Value constant = image->chunk.constants.values[i];
+        /* Only the ones that live in the image, some were already interned elsewhere */
+        if (IS_OBJ(constant) && (char*)AS_OBJ(constant) >= (char*)image->base && (char*)AS_OBJ(constant) < end)
+        {
+            tableDelete(&(image->vm->strings), AS_STRING(constant));
+        }
+    }
+    munmap(image->base, image->size);
+    image->base = NULL;
+    image->size = 0;
+}
\ No newline at end of file
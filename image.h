@@ -0,0 +1,64 @@
+#ifndef clox_image_h
+#define clox_image_h
+
+#include "chunk.h"
+
+#define IMAGE_MAGIC     "CLOXIMG"
+/* 3: OP_SLOT and the fiber opcodes renumbered the ones after them, 4: so did OP_SEND and OP_RECEIVE */
+#define IMAGE_VERSION   4
+/* Every section starts on this boundary, so objects in the image are aligned like heap objects */
+#define IMAGE_ALIGNMENT 16
+
+/*
+    Layout on disk, all positions are offsets from the start of the file:
+    header | code | lines | constants | strings
+    Object constants hold the offset of their ObjString instead of a pointer, which is all loadImage() has to patch
+*/
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    /* Refuse images from a build with a different Value or pointer layout */
+    uint32_t valueSize;
+    uint64_t imageSize;
+    uint64_t codeOffset;
+    uint64_t codeCount;
+    uint64_t linesOffset;
+    uint64_t lineCount;
+    uint64_t constantsOffset;
+    uint64_t constantCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    /* hashBytes() of the source it was compiled from, 0 if unknown. A .loxc cache is stale when it differs */
+    uint64_t sourceHash;
+    int32_t line;
+    int32_t pos;
+} ImageHeader;
+
+/* A loaded image, chunk points straight into the mapping */
+typedef struct
+{
+    /* Whose strings table the image's strings joined */
+    VM* vm;
+    void* base;
+    size_t size;
+    uint64_t sourceHash;
+    Chunk chunk;
+} Image;
+
+/*
+    Snapshot a compiled chunk with its line table and the strings its constants refer to (ropes are flattened).
+    Written to a temporary file and renamed, so a concurrent reader sees the old image or the new one, never half of one
+*/
+bool writeImage(VM* vm, const char* path, Chunk* chunk, uint64_t sourceHash);
+/*
+    mmap() the image copy-on-write and relocate it: code is used in place, only the constants page(s) get written.
+    Its strings join vm->strings without being copied and are never collected
+*/
+bool loadImage(VM* vm, const char* path, Image* image);
+/* loadImage() for a .loxc cache: false, quietly, when it is missing, from another version or not built from sourceHash */
+bool loadCachedImage(VM* vm, const char* path, uint64_t sourceHash, Image* image);
+/* Drops the image's strings from its VM's strings, nothing may refer to them afterwards */
+void freeImage(Image* image);
+
+#endif
\ No newline at end of file
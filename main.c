@@ -1,16 +1,40 @@
 #include "common.h"
+#include "batch.h"
 #include "chunk.h"
+#include "column.h"
 #include "debug.h"
+#include "hash.h"
+#include "image.h"
+#include "object.h"
+#include "parallel.h"
+#include "server.h"
 #include "vm.h"
 #include "compiler.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 void repl();
-void runFile(const char* filename);
+int runFile(const char* filename);
+void runPipe();
+static void printResult(InterpreterResult result);
+static int exitCode(InterpreterResult result);
+static void snapshotFile(const char* filename, const char* imagePath);
+static void runImage(const char* imagePath);
+static void compileFile(const char* filename);
+static void disassembleImage(const char* imagePath);
+static void runScripts(int workerCount, int fileCount, const char* filenames[]);
+static void evaluateColumns(const char* expression, const char* outputPath, int inputCount, const char* inputs[]);
+static void reduceColumn(const char* expression, const char* inputPath, double init);
+static bool mapColumn(const char* path, const double** column, size_t* size);
+static InterpreterResult runSource(const char* filename, const char* source, size_t length);
+static bool cachePath(const char* filename, char* path, size_t capacity);
 static void interpretCode(char* buffer);
 // void test(Chunk* chunk);
 bool containBackSlash(char* line, int maxLength);
@@ -29,28 +53,130 @@ int main(int argc, const char* argv[])
 
     cloxCodeBuffer = NULL;
 
+    /* Strip the options that combine with every mode, the rest is positional as before */
+    bool memStats = false;
+    bool memLines = false;
+    int status = 0;
+    const char* args[argc];
+    int argCount = 0;
+    for (int i = 0; i < argc; i++)
+    {
+        if (i > 0 && strcmp(argv[i], "--mem-stats") == 0)
+        {
+            memStats = true;
+        }
+        else if (i > 0 && strcmp(argv[i], "--mem-lines") == 0)
+        {
+            /* Attribution implies the dump */
+            memStats = true;
+            memLines = true;
+            enableLineAttribution(true);
+        }
+        else
+        {
+            args[argCount++] = argv[i];
+        }
+    }
+    argc = argCount;
+    argv = args;
+
+    /* Bytes of compiled chunks to keep around, 0 turns the cache off */
+    const char* cacheLimit = getenv("CLOX_CHUNK_CACHE");
+    if (cacheLimit != NULL)
+    {
+        setChunkCacheLimit(&vm.chunkCache, (size_t)strtoull(cacheLimit, NULL, 0));
+    }
+
     if (argc == 1)
     {
         /* No file loaded, jump into REPL */
         repl();
     }
+    else if (argc == 2 && strcmp(argv[1], "-") == 0)
+    {
+        /* Script piped into stdin, can be arbitrarily large */
+        InterpreterResult result = interpretStream(STDIN_FILENO);
+        printResult(result);
+        status = exitCode(result);
+    }
+    else if (argc == 2 && strcmp(argv[1], "--pipe") == 0)
+    {
+        /* One expression per line on stdin, one result per line on stdout */
+        runPipe();
+    }
+    else if (argc == 4 && strcmp(argv[1], "--snapshot") == 0)
+    {
+        /* Run a prelude once and keep the result as an image */
+        snapshotFile(argv[2], argv[3]);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--image") == 0)
+    {
+        runImage(argv[2]);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--compile") == 0)
+    {
+        /* Write the .loxc cache without running the script */
+        compileFile(argv[2]);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--disassemble") == 0)
+    {
+        disassembleImage(argv[2]);
+    }
+    else if (argc >= 4 && strcmp(argv[1], "-j") == 0 && atoi(argv[2]) > 0)
+    {
+        /* Many scripts at once, one VM per worker */
+        runScripts(atoi(argv[2]), argc - 3, argv + 3);
+    }
+    else if ((argc == 3 || argc == 4) && strcmp(argv[1], "--serve") == 0)
+    {
+        /* Daemon on a Unix socket, one warm VM per worker (one per core unless given) */
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int workers = argc == 4 ? atoi(argv[3]) : (int)(cores > 0 ? cores : 1);
+        serve(argv[2], workers > 0 ? workers : 1);
+    }
+    else if (argc >= 4 && strcmp(argv[1], "--columns") == 0)
+    {
+        /* One expression over every row of its input columns */
+        evaluateColumns(argv[2], argv[3], argc - 4, argv + 4);
+    }
+    else if ((argc == 4 || argc == 5) && strcmp(argv[1], "--reduce") == 0)
+    {
+        /* Fold a column with an associative expression of acc and x */
+        reduceColumn(argv[2], argv[3], argc == 5 ? strtod(argv[4], NULL) : 0);
+    }
     else if (argc == 2)
     {
         /* Need to load file */
-        runFile(argv[1]);
+        status = runFile(argv[1]);
     }
     else
     {
-        printf("USAGE: ./clox [filename]\n");
+        printf("USAGE: ./clox [--mem-stats] [--mem-lines] [filename | - | --pipe | --snapshot prelude image | --image image | --compile filename | --disassemble file.loxc | -j workers file... | --columns expression output.col [name=input.col]... | --reduce expression input.col [init] | --serve socket [workers]]\n");
     }
 
     // test(&chunk);
 
+    if (memStats)
+    {
+        /* Before freeVM(), so live bytes show what the VM was holding */
+        flushOutput(&vm.out);
+        dumpMemoryStats(stderr, "vm allocator", &(vm.allocator->stats));
+        dumpMemoryStats(stderr, "compile arena", &(vm.compileArena.allocator.stats));
+        dumpMemoryStats(stderr, "heap", &(vm.heap.allocator.stats));
+        dumpGCStats(&vm, stderr);
+        dumpStringStats(&vm, stderr);
+        dumpChunkCacheStats(stderr, &vm.chunkCache);
+        if (memLines)
+        {
+            dumpLineAttribution(stderr);
+        }
+    }
+
     /* Dial down all resources */
     freeVM();
     freeChunk(&chunk);
 
-    return 0;
+    return status;
 }
 
 // void test(Chunk* chunk)
@@ -131,35 +257,522 @@ void repl()
         cloxCodeBuffer = combineMultipleLine(cloxCodeBuffer, input, lineIndex);
 
         // interpretCode();
-        interpret(cloxCodeBuffer);
+        printResult(interpret(cloxCodeBuffer, strlen(cloxCodeBuffer)));
+        /* Interactive, the user wants to see the result now */
+        flushOutput(&vm.out);
         // compile(cloxCodeBuffer, );
         free(cloxCodeBuffer);
         cloxCodeBuffer = NULL;
     }
 }
 
-void runFile(const char* filename)
+int runFile(const char* filename)
 {
     /*
-        Load string stored in a script file into cloxCodeBuffer
+        Regular files are mapped read-only and handed to the scanner as they are, no copy and no '\0' needed.
+        Pipes and special files (and files mmap() refuses) are streamed through a bounded scanner buffer instead
     */
     int fd = open(filename, O_RDONLY);
-    int fileSize = lseek(fd, 0, SEEK_END);
-    lseek(fd, 0, SEEK_SET);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Could not open file \"%s\".\n", filename);
+        return 74;
+    }
 
-    cloxCodeBuffer = malloc(fileSize + 1);
-    if (read(fd, cloxCodeBuffer, fileSize) == -1)
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1)
     {
-        panic("Failed to read script file into buffer!\n");
+        fprintf(stderr, "Could not stat file \"%s\".\n", filename);
+        close(fd);
+        return 74;
     }
 
-    cloxCodeBuffer[fileSize] = '\0';
-    /* Debugging */
-    printf("%s\n", cloxCodeBuffer);
+    if (S_ISREG(fileStat.st_mode) && fileStat.st_size > 0)
+    {
+        size_t fileSize = (size_t)fileStat.st_size;
+        void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            /* The scanner walks the script front to back exactly once */
+            madvise(mapping, fileSize, MADV_SEQUENTIAL);
+            close(fd);
 
+            InterpreterResult result = runSource(filename, (const char*)mapping, fileSize);
+
+            munmap(mapping, fileSize);
+            return exitCode(result);
+        }
+    }
+
+    /* Not mappable, scan it through the streaming scanner instead */
+    InterpreterResult result = interpretStream(fd);
+    printResult(result);
     close(fd);
+    return exitCode(result);
+}
+
+void runPipe()
+{
+    /*
+        Every line of stdin is a record: interpret it, print the result.
+        A record seen before runs from the chunk cache; otherwise it is compiled in the arena, which keeps its block
+        between records, and getline() keeps its buffer, so there is no heap traffic per record either way.
+        A bad record prints "error" and we carry on with the next one
+    */
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    long records = 0;
+    long errors = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    return;
+    while ((length = getline(&line, &capacity, stdin)) != -1)
+    {
+        if (length > 0 && line[length - 1] == '\n')
+        {
+            length--;
+        }
+        if (length == 0)
+        {
+            continue;
+        }
+
+        InterpreterResult result = interpret(line, (size_t)length);
+        if (result == INTERPRET_OK)
+        {
+            printValue(&vm, &vm.out, vm.result);
+            writeOutputChar(&vm.out, '\n');
+        }
+        else
+        {
+            writeOutputString(&vm.out, "error\n");
+            errors++;
+        }
+        records++;
+    }
+
+    flushOutput(&vm.out);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "--pipe: %ld records, %ld errors in %.3fs (%.0f records/s)\n",
+            records, errors, seconds, seconds > 0 ? records / seconds : 0.0);
+
+    free(line);
+}
+
+static void snapshotFile(const char* filename, const char* imagePath)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat fileStat;
+    if (fd == -1 || fstat(fd, &fileStat) == -1 || !S_ISREG(fileStat.st_mode) || fileStat.st_size == 0)
+    {
+        fprintf(stderr, "Could not read prelude \"%s\".\n", filename);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return;
+    }
+    size_t fileSize = (size_t)fileStat.st_size;
+    void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map prelude \"%s\".\n", filename);
+        return;
+    }
+
+    /* Compiled outside the arena, the chunk has to outlive interpret() */
+    Chunk chunk;
+    initChunkWith(&chunk, vm.allocator);
+    InterpreterResult result = interpretChunk(&chunk, (const char*)mapping, fileSize);
+    printResult(result);
+    if (result == INTERPRET_OK && writeImage(&vm, imagePath, &chunk, hashBytes(mapping, fileSize, 0)))
+    {
+        fprintf(stderr, "Wrote image \"%s\".\n", imagePath);
+    }
+
+    freeChunk(&chunk);
+    munmap(mapping, fileSize);
+}
+
+static void runImage(const char* imagePath)
+{
+    Image image;
+    if (!loadImage(&vm, imagePath, &image))
+    {
+        return;
+    }
+    /* Nothing to scan or compile, the first instruction runs right away */
+    printResult(runChunk(&(image.chunk)));
+
+    /* The result may be one of the image's strings, it is in the output buffer by now */
+    vm.result = NUMBER_VAL(0);
+    freeImage(&image);
+}
+
+static bool cachePath(const char* filename, char* path, size_t capacity)
+{
+    /*
+        With CLOX_CACHE_DIR set the cache lives there, named after the script's absolute path.
+        Otherwise it sits next to the script: script.lox -> script.loxc
+    */
+    const char* cacheDir = getenv("CLOX_CACHE_DIR");
+    int written;
+    if (cacheDir != NULL && cacheDir[0] != '\0')
+    {
+        char absolute[PATH_MAX];
+        const char* key = realpath(filename, absolute) != NULL ? absolute : filename;
+        written = snprintf(path, capacity, "%s/%016llx.loxc", cacheDir,
+                           (unsigned long long)hashBytes(key, strlen(key), 0));
+    }
+    else
+    {
+        size_t length = strlen(filename);
+        if (length > 4 && strcmp(filename + length - 4, ".lox") == 0)
+        {
+            length -= 4;
+        }
+        written = snprintf(path, capacity, "%.*s.loxc", (int)length, filename);
+    }
+    return written > 0 && (size_t)written < capacity;
+}
+
+static InterpreterResult runSource(const char* filename, const char* source, size_t length)
+{
+    /*
+        The hash decides whether the .loxc is still good, hashing is a lot cheaper than scanning and compiling.
+        On a hit nothing is compiled; on a miss the cache is (re)written when there is a cache dir or a stale .loxc
+    */
+    uint64_t sourceHash = hashBytes(source, length, 0);
+    char path[PATH_MAX];
+    bool cacheable = cachePath(filename, path, sizeof(path));
+
+    Image image;
+    if (cacheable && loadCachedImage(&vm, path, sourceHash, &image))
+    {
+        InterpreterResult result = runChunk(&(image.chunk));
+        printResult(result);
+        /* Same as runImage(), the result may live in the image */
+        vm.result = NUMBER_VAL(0);
+        freeImage(&image);
+        return result;
+    }
+    bool writeCache = cacheable && (getenv("CLOX_CACHE_DIR") != NULL || access(path, F_OK) == 0);
+
+    Chunk chunk;
+    initChunkWith(&chunk, &vm.compileArena.allocator);
+    InterpreterResult result = INTERPRET_COMPILER_ERROR;
+    if (compile(source, length, &chunk))
+    {
+        if (writeCache)
+        {
+            writeImage(&vm, path, &chunk, sourceHash);
+        }
+        result = runChunk(&chunk);
+        printResult(result);
+    }
+    resetArena(&vm.compileArena);
+    return result;
+}
+
+static void compileFile(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat fileStat;
+    if (fd == -1 || fstat(fd, &fileStat) == -1 || !S_ISREG(fileStat.st_mode) || fileStat.st_size == 0)
+    {
+        fprintf(stderr, "Could not read script \"%s\".\n", filename);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return;
+    }
+    size_t fileSize = (size_t)fileStat.st_size;
+    void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map script \"%s\".\n", filename);
+        return;
+    }
+
+    char path[PATH_MAX];
+    Chunk chunk;
+    initChunkWith(&chunk, &vm.compileArena.allocator);
+    if (!cachePath(filename, path, sizeof(path)))
+    {
+        fprintf(stderr, "Cache path for \"%s\" is too long.\n", filename);
+    }
+    else if (compile((const char*)mapping, fileSize, &chunk) &&
+             writeImage(&vm, path, &chunk, hashBytes(mapping, fileSize, 0)))
+    {
+        fprintf(stderr, "Wrote \"%s\".\n", path);
+    }
+    resetArena(&vm.compileArena);
+    munmap(mapping, fileSize);
+}
+
+static void disassembleImage(const char* imagePath)
+{
+    Image image;
+    if (!loadImage(&vm, imagePath, &image))
+    {
+        return;
+    }
+    printOutput(&vm.out, "Source hash: %016llx\n", (unsigned long long)image.sourceHash);
+    disassembleChunk(&vm, &vm.out, &(image.chunk), imagePath);
+    flushOutput(&vm.out);
+    freeImage(&image);
+}
+
+static void runScripts(int workerCount, int fileCount, const char* filenames[])
+{
+    BatchJob* jobs = calloc((size_t)fileCount, sizeof(BatchJob));
+    if (jobs == NULL)
+    {
+        reportOutOfMemory((size_t)fileCount * sizeof(BatchJob));
+    }
+    for (int i = 0; i < fileCount; i++)
+    {
+        jobs[i].path = filenames[i];
+    }
+
+    /* Every worker gets a chunk cache as big as the main VM's */
+    BatchStats stats = runBatch(jobs, fileCount, workerCount, vm.chunkCache.limit);
+
+    /* In the order given, however the scripts were scheduled */
+    double scriptSeconds = 0;
+    for (int i = 0; i < fileCount; i++)
+    {
+        fwrite(jobs[i].output, 1, jobs[i].outputLength, stdout);
+        fprintf(stderr, "%10.3f ms  %-5s %s\n", jobs[i].seconds * 1e3, jobs[i].ok ? "ok" : "error", jobs[i].path);
+        scriptSeconds += jobs[i].seconds;
+        free(jobs[i].output);
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "-j %d: %d scripts, %d errors in %.3fs (%.0f scripts/s, %.3f ms per script), %llu steals\n",
+            workerCount, fileCount, stats.failed, stats.seconds, stats.seconds > 0 ? fileCount / stats.seconds : 0.0,
+            fileCount > 0 ? scriptSeconds * 1e3 / fileCount : 0.0, (unsigned long long)stats.steals);
+    free(jobs);
+}
+
+static void evaluateColumns(const char* expression, const char* outputPath, int inputCount, const char* inputs[])
+{
+    /*
+        Columns are plain files of native doubles, row after row, mapped and never copied.
+        Every input is name=path, the expression refers to it by name
+    */
+    if (inputCount > MAX_SLOTS)
+    {
+        fprintf(stderr, "At most %d input columns.\n", MAX_SLOTS);
+        return;
+    }
+    const char* names[MAX_SLOTS];
+    const double* columns[MAX_SLOTS];
+    size_t sizes[MAX_SLOTS];
+    char nameBuffer[PATH_MAX];
+    size_t nameLength = 0;
+    size_t rows = 0;
+    int mapped = 0;
+    bool ok = true;
+    for (; mapped < inputCount && ok; mapped++)
+    {
+        const char* equals = strchr(inputs[mapped], '=');
+        size_t length = equals != NULL ? (size_t)(equals - inputs[mapped]) : 0;
+        if (length == 0 || nameLength + length + 1 > sizeof(nameBuffer))
+        {
+            fprintf(stderr, "Expect name=path, got \"%s\".\n", inputs[mapped]);
+            ok = false;
+            break;
+        }
+        memcpy(nameBuffer + nameLength, inputs[mapped], length);
+        nameBuffer[nameLength + length] = '\0';
+        names[mapped] = nameBuffer + nameLength;
+        nameLength += length + 1;
+
+        if (!mapColumn(equals + 1, &columns[mapped], &sizes[mapped]) ||
+            (mapped > 0 && sizes[mapped] / sizeof(double) != rows))
+        {
+            fprintf(stderr, "Could not read column \"%s\", or its length differs.\n", equals + 1);
+            if (columns[mapped] != NULL)
+            {
+                munmap((void*)columns[mapped], sizes[mapped]);
+            }
+            ok = false;
+            break;
+        }
+        rows = sizes[mapped] / sizeof(double);
+    }
+
+    Chunk chunk;
+    initChunkWith(&chunk, &vm.compileArena.allocator);
+    Compiler compiler;
+    if (ok && compileSlotsWith(&compiler, &vm, expression, strlen(expression), names, inputCount, &chunk))
+    {
+        int fd = open(outputPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        size_t outputSize = rows * sizeof(double);
+        void* output = MAP_FAILED;
+        if (fd != -1 && ftruncate(fd, (off_t)outputSize) == 0 && outputSize > 0)
+        {
+            output = mmap(NULL, outputSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (fd == -1 || (outputSize > 0 && output == MAP_FAILED))
+        {
+            fprintf(stderr, "Could not write column \"%s\".\n", outputPath);
+        }
+        else
+        {
+            /* Shared read only by the pool's VMs, split in PARALLEL_CHUNK rows */
+            FrozenChunk* frozen = freezeChunk(&vm, &chunk);
+            ThreadPool* pool = defaultThreadPool();
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            bool evaluated = frozen != NULL &&
+                parallelMapWith(&vm, pool, frozen, columns, inputCount, outputSize > 0 ? output : NULL, rows);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+            if (evaluated)
+            {
+                fprintf(stderr, "--columns: %zu rows in %.3fs (%.0f rows/s, %d threads)\n",
+                        rows, seconds, seconds > 0 ? rows / seconds : 0.0, threadPoolSize(pool));
+            }
+            else
+            {
+                fprintf(stderr, "Only numbers can be written to a column.\n");
+            }
+            if (frozen != NULL)
+            {
+                releaseFrozenChunk(frozen);
+            }
+        }
+        if (output != MAP_FAILED)
+        {
+            munmap(output, outputSize);
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+    resetArena(&vm.compileArena);
+
+    for (int i = 0; i < mapped; i++)
+    {
+        if (columns[i] != NULL)
+        {
+            munmap((void*)columns[i], sizes[i]);
+        }
+    }
+}
+
+static void reduceColumn(const char* expression, const char* inputPath, double init)
+{
+    const double* column;
+    size_t size;
+    if (!mapColumn(inputPath, &column, &size))
+    {
+        fprintf(stderr, "Could not read column \"%s\".\n", inputPath);
+        return;
+    }
+
+    static const char* names[] = { "acc", "x" };
+    Chunk chunk;
+    initChunkWith(&chunk, &vm.compileArena.allocator);
+    Compiler compiler;
+    if (compileSlotsWith(&compiler, &vm, expression, strlen(expression), names, 2, &chunk))
+    {
+        FrozenChunk* frozen = freezeChunk(&vm, &chunk);
+        ThreadPool* pool = defaultThreadPool();
+        size_t rows = size / sizeof(double);
+        double result = init;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool reduced = frozen != NULL && parallelReduceWith(&vm, pool, frozen, column, rows, init, &result);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+        if (reduced)
+        {
+            printValue(&vm, &vm.out, NUMBER_VAL(result));
+            writeOutputChar(&vm.out, '\n');
+            fprintf(stderr, "--reduce: %zu rows in %.3fs (%.0f rows/s, %d threads)\n",
+                    rows, seconds, seconds > 0 ? rows / seconds : 0.0, threadPoolSize(pool));
+        }
+        else
+        {
+            fprintf(stderr, "The expression must give a number for every row.\n");
+        }
+        if (frozen != NULL)
+        {
+            releaseFrozenChunk(frozen);
+        }
+    }
+    resetArena(&vm.compileArena);
+    if (column != NULL)
+    {
+        munmap((void*)column, size);
+    }
+}
+
+/* A column file of native doubles, mapped read only. An empty one maps to NULL */
+static bool mapColumn(const char* path, const double** column, size_t* size)
+{
+    *column = NULL;
+    *size = 0;
+    int fd = open(path, O_RDONLY);
+    struct stat fileStat;
+    if (fd == -1 || fstat(fd, &fileStat) == -1 || fileStat.st_size % sizeof(double) != 0)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    *size = (size_t)fileStat.st_size;
+    bool ok = true;
+    if (*size > 0)
+    {
+        void* mapping = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = mapping != MAP_FAILED;
+        if (ok)
+        {
+            madvise(mapping, *size, MADV_SEQUENTIAL);
+            *column = mapping;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+static void printResult(InterpreterResult result)
+{
+    if (result == INTERPRET_OK)
+    {
+        printValue(&vm, &vm.out, vm.result);
+        writeOutputChar(&vm.out, '\n');
+    }
+}
+
+/* Exit status for a script, the same codes as the reference clox (sysexits.h EX_DATAERR and EX_SOFTWARE) */
+static int exitCode(InterpreterResult result)
+{
+    switch (result)
+    {
+        case INTERPRET_COMPILER_ERROR:
+            return 65;
+        case INTERPRET_RUNTIME_ERROR:
+            return 70;
+        default:
+            return 0;
+    }
 }
 
 static void interpretCode(char* buffer)
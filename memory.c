@@ -1,18 +1,269 @@
+/* For mremap() */
+#define _GNU_SOURCE
+
 #include "memory.h"
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void* defaultReallocate(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize);
+
+Allocator defaultAllocator = { .reallocate = defaultReallocate, .userData = NULL, .stats = { .tags = { { 0 } }, .total = { 0 } } };
+
+static const char* memoryTagNames[MEM_TAG_COUNT] = {
+    "chunk code", "constants", "vm stack", "scanner", "arena blocks", "heap objects", "tables", "chunk cache", "other"
+};
+
+/* Line attribution, only touched while enabled */
+/* Per thread, each thread compiles and runs its own VM */
+static _Thread_local bool lineAttribution = false;
+static _Thread_local int allocationLine = 0;
+static _Thread_local int64_t* lineBytes = NULL;
+static _Thread_local int lineCapacity = 0;
+
+static void countBytes(MemoryCounter* counter, size_t oldSize, size_t newSize)
+{
+    counter->liveBytes = counter->liveBytes - oldSize + newSize;
+    if (counter->liveBytes > counter->peakBytes)
+    {
+        counter->peakBytes = counter->liveBytes;
+    }
+    if (newSize > oldSize)
+    {
+        counter->allocations++;
+    }
+}
+
+/* Same for the stats every thread shares */
+static void countBytesAtomic(MemoryCounter* counter, size_t oldSize, size_t newSize)
+{
+    size_t live = __atomic_add_fetch(&(counter->liveBytes), newSize - oldSize, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&(counter->peakBytes), __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&(counter->peakBytes), &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    if (newSize > oldSize)
+    {
+        __atomic_add_fetch(&(counter->allocations), 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void chargeLine(size_t oldSize, size_t newSize)
+{
+    if (allocationLine >= lineCapacity)
+    {
+        /* Bookkeeping of the bookkeeping, kept out of the stats on purpose */
+        int newCapacity = lineCapacity < 64 ? 64 : lineCapacity;
+        while (newCapacity <= allocationLine)
+        {
+            newCapacity *= 2;
+        }
+        int64_t* grown = realloc(lineBytes, sizeof(int64_t) * newCapacity);
+        if (grown == NULL)
+        {
+            return;
+        }
+        memset(grown + lineCapacity, 0, sizeof(int64_t) * (newCapacity - lineCapacity));
+        lineBytes = grown;
+        lineCapacity = newCapacity;
+    }
+    lineBytes[allocationLine] += (int64_t)newSize - (int64_t)oldSize;
+}
+
+/* Any thread may run out of memory while another sets it */
+static void (*_Atomic outOfMemoryHook)(size_t size) = NULL;
+
+void setOutOfMemoryHook(void (*hook)(size_t size))
+{
+    atomic_store(&outOfMemoryHook, hook);
+}
+
+void reportOutOfMemory(size_t size)
+{
+    void (*hook)(size_t size) = atomic_load(&outOfMemoryHook);
+    if (hook != NULL)
+    {
+        hook(size);
+    }
+    fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+    exit(1);
+}
+
+void* reallocateWith(Allocator* allocator, MemoryTag tag, void* pointer, size_t oldSize, size_t newSize)
+{
+    void* result = allocator->reallocate(allocator, pointer, oldSize, newSize);
+    if (result == NULL && newSize > 0)
+    {
+        reportOutOfMemory(newSize);
+    }
+
+    /* A fresh allocation has no old size, whatever the caller says */
+    if (pointer == NULL)
+    {
+        oldSize = 0;
+    }
+    countMemory(allocator, tag, oldSize, newSize);
+    /* Only what the script itself causes, not the VM's and scanner's own buffers or arena blocks */
+    bool scriptAllocation = (tag == MEM_CHUNK_CODE || tag == MEM_CONSTANTS || tag == MEM_OBJECTS);
+    if (lineAttribution && scriptAllocation && newSize > oldSize)
+    {
+        chargeLine(oldSize, newSize);
+    }
+    return result;
+}
+
+void countMemory(Allocator* allocator, MemoryTag tag, size_t oldSize, size_t newSize)
+{
+    if (allocator == &defaultAllocator)
+    {
+        countBytesAtomic(&(allocator->stats.tags[tag]), oldSize, newSize);
+        countBytesAtomic(&(allocator->stats.total), oldSize, newSize);
+    }
+    else
+    {
+        countBytes(&(allocator->stats.tags[tag]), oldSize, newSize);
+        countBytes(&(allocator->stats.total), oldSize, newSize);
+    }
+}
+
+int clampCapacity(int capacity)
+{
+    if (capacity == INT_MAX)
+    {
+        /* No int count can go any further */
+        reportOutOfMemory((size_t)INT_MAX + 1);
+    }
+    return INT_MAX;
+}
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize)
 {
+    return reallocateWith(&defaultAllocator, MEM_OTHER, pointer, oldSize, newSize);
+}
+
+void resetMemoryStats(MemoryStats* stats)
+{
+    for (int i = 0; i < MEM_TAG_COUNT; i++)
+    {
+        stats->tags[i].liveBytes = 0;
+    }
+    stats->total.liveBytes = 0;
+}
+
+void dumpMemoryStats(FILE* stream, const char* title, MemoryStats* stats)
+{
+    fprintf(stream, "---------- MEMORY: %s ------------\n", title);
+    fprintf(stream, "%-14s %14s %14s %12s\n", "subsystem", "live bytes", "peak bytes", "allocations");
+    for (int i = 0; i < MEM_TAG_COUNT; i++)
+    {
+        MemoryCounter* counter = &(stats->tags[i]);
+        fprintf(stream, "%-14s %14zu %14zu %12zu\n", memoryTagNames[i],
+                counter->liveBytes, counter->peakBytes, counter->allocations);
+    }
+    fprintf(stream, "%-14s %14zu %14zu %12zu\n", "total",
+            stats->total.liveBytes, stats->total.peakBytes, stats->total.allocations);
+}
+
+void enableLineAttribution(bool enabled)
+{
+    lineAttribution = enabled;
+}
+
+void setAllocationLine(int line)
+{
+    allocationLine = line < 0 ? 0 : line;
+}
+
+void dumpLineAttribution(FILE* stream)
+{
+    fprintf(stream, "---------- MEMORY BY SOURCE LINE ------------\n");
+    for (int line = 0; line < lineCapacity; line++)
+    {
+        if (lineBytes[line] != 0)
+        {
+            /* Lines count from 1 for humans */
+            fprintf(stream, "line %6d: %12lld bytes\n", line + 1, (long long)lineBytes[line]);
+        }
+    }
+}
+
+static size_t pageRound(size_t size)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + pageSize - 1) & ~(pageSize - 1);
+}
+
+static void* mapBlock(size_t size)
+{
+    void* block = mmap(NULL, pageRound(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (block == MAP_FAILED) ? NULL : block;
+}
+
+/*
+    Small blocks live in malloc(), big ones in their own mapping. Which one a block is follows from
+    its size alone, so the callers passing the right oldSize is all the bookkeeping we need
+*/
+static void* defaultReallocate(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize)
+{
+    (void)allocator;
+    bool wasMapped = (pointer != NULL) && (oldSize >= MMAP_THRESHOLD);
+    bool mapped = (newSize >= MMAP_THRESHOLD);
+
     if (newSize == 0)
     {
-        free(pointer);
+        if (wasMapped)
+        {
+            munmap(pointer, pageRound(oldSize));
+        }
+        else
+        {
+            free(pointer);
+        }
         return NULL;
     }
 
-    void* temp = realloc(pointer, newSize);
-    if (temp == NULL)
+    if (wasMapped && mapped)
+    {
+#ifdef MREMAP_MAYMOVE
+        void* block = mremap(pointer, pageRound(oldSize), pageRound(newSize), MREMAP_MAYMOVE);
+        return (block == MAP_FAILED) ? NULL : block;
+#else
+        void* block = mapBlock(newSize);
+        if (block != NULL)
+        {
+            memcpy(block, pointer, oldSize < newSize ? oldSize : newSize);
+            munmap(pointer, pageRound(oldSize));
+        }
+        return block;
+#endif
+    }
+
+    if (mapped)
     {
-        exit(1);
+        /* Crossing the threshold upwards: one last copy out of the heap */
+        void* block = mapBlock(newSize);
+        if (block != NULL && pointer != NULL)
+        {
+            memcpy(block, pointer, oldSize);
+            free(pointer);
+        }
+        return block;
     }
-    return temp;
+
+    if (wasMapped)
+    {
+        /* Shrinking back under the threshold */
+        void* block = malloc(newSize);
+        if (block != NULL)
+        {
+            memcpy(block, pointer, newSize);
+            munmap(pointer, pageRound(oldSize));
+        }
+        return block;
+    }
+
+    return realloc(pointer, newSize);
 }
\ No newline at end of file
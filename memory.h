@@ -2,19 +2,109 @@
 #define clox_memory_h
 
 #include "common.h"
+#include <limits.h>
 
 #define CHUNK_INITIAL_CAPACITY  0x100
-#define CHUNK_GROWTH_EXP        0x2
+#define CHUNK_GROWTH_FACTOR     0x2
 
+/* Geometric growth, so n appends cost O(n) copies in total. Counts are ints, so it stops at INT_MAX */
 #define GROW_CAPACITY(capacity) \
-    (((capacity) < CHUNK_INITIAL_CAPACITY) ? CHUNK_INITIAL_CAPACITY : (CHUNK_INITIAL_CAPACITY * CHUNK_GROWTH_EXP))
+    (((capacity) < CHUNK_INITIAL_CAPACITY) ? CHUNK_INITIAL_CAPACITY : \
+     ((capacity) <= INT_MAX / CHUNK_GROWTH_FACTOR) ? ((capacity) * CHUNK_GROWTH_FACTOR) : clampCapacity(capacity))
 
-#define GROW_ARRAY(type, pointer, oldCapacity, newCapacity) \
-    (type*)reallocate(pointer, sizeof(type) * (oldCapacity), sizeof(type) * (newCapacity))
+/*
+    Blocks this big skip malloc() and are mmap()'ed directly, so growing them is a mremap()
+    (the kernel moves page table entries around) instead of a copy
+*/
+#define MMAP_THRESHOLD          0x100000
 
-#define FREE_ARRAY(type, pointer, oldCapacity) \
-    reallocate(pointer, sizeof(type) * (oldCapacity), 0)
+/* What an allocation is for, so memory can be accounted per subsystem */
+typedef enum
+{
+    MEM_CHUNK_CODE,
+    MEM_CONSTANTS,
+    MEM_VM_STACK,
+    MEM_SCANNER,
+    /* Blocks backing an Arena, the arena's own stats break them down */
+    MEM_ARENA,
+    MEM_OBJECTS,
+    MEM_TABLES,
+    /* Entries and sources of the chunk cache, its chunks count as code and constants */
+    MEM_CHUNK_CACHE,
+    MEM_OTHER,
+    MEM_TAG_COUNT
+} MemoryTag;
 
+typedef struct
+{
+    size_t liveBytes;
+    size_t peakBytes;
+    /* Calls that allocated or grew a block */
+    size_t allocations;
+} MemoryCounter;
+
+typedef struct
+{
+    MemoryCounter tags[MEM_TAG_COUNT];
+    MemoryCounter total;
+} MemoryStats;
+
+/*
+    Everything that allocates goes through one of these, so a host can plug in its own allocator
+    (jemalloc, mimalloc, a pool, an arena...) per VM or per compile.
+    reallocate() follows realloc(): pointer NULL allocates, newSize 0 frees.
+    oldSize is always the size the block was allocated with. Return NULL when out of memory
+*/
+typedef struct Allocator
+{
+    void* (*reallocate)(struct Allocator* allocator, void* pointer, size_t oldSize, size_t newSize);
+    /* Whatever the allocator needs, clox never looks at it */
+    void* userData;
+    /* Kept up to date by reallocateWith() from the sizes it is handed anyway */
+    MemoryStats stats;
+} Allocator;
+
+/*
+    libc, plus mmap()/mremap() for blocks of MMAP_THRESHOLD and up.
+    Shared by every thread, so reallocateWith() counts into its stats atomically. VMs have their own copy
+*/
+extern Allocator defaultAllocator;
+
+#define GROW_ARRAY(allocator, tag, type, pointer, oldCapacity, newCapacity) \
+    (type*)reallocateWith(allocator, tag, pointer, sizeof(type) * (oldCapacity), sizeof(type) * (newCapacity))
+
+#define FREE_ARRAY(allocator, tag, type, pointer, oldCapacity) \
+    reallocateWith(allocator, tag, pointer, sizeof(type) * (oldCapacity), 0)
+
+void* reallocateWith(Allocator* allocator, MemoryTag tag, void* pointer, size_t oldSize, size_t newSize);
+/*
+    Count a block the owner of allocator got some other way (e.g. mmap() for the alignment Allocator can't give),
+    so the stats still add up to everything it holds. Same arguments as reallocateWith()
+*/
+void countMemory(Allocator* allocator, MemoryTag tag, size_t oldSize, size_t newSize);
+/*
+    Called by reallocateWith() when the allocator comes back empty-handed, before it gives up with exit().
+    A hook that doesn't return (the VM's unwinds the run in progress) makes that a recoverable error.
+    Process wide, safe to set from any thread. The first initVMWith() installs the VM's
+*/
+void setOutOfMemoryHook(void (*hook)(size_t size));
+/* What reallocateWith() does when it comes back empty-handed, for memory that doesn't come from an Allocator */
+__attribute__((noreturn)) void reportOutOfMemory(size_t size);
+/* GROW_CAPACITY() past INT_MAX / 2: INT_MAX, and out of memory once there */
+int clampCapacity(int capacity);
+/* Same as reallocateWith(&defaultAllocator, MEM_OTHER, ...) */
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+/* Forget everything counted so far, e.g. when an arena drops all its blocks at once */
+void resetMemoryStats(MemoryStats* stats);
+void dumpMemoryStats(FILE* stream, const char* title, MemoryStats* stats);
+
+/*
+    Per-source-line attribution: while enabled, every byte the script causes (code, constants, objects)
+    is also charged to the line the compiler last reported through setAllocationLine()
+*/
+void enableLineAttribution(bool enabled);
+void setAllocationLine(int line);
+void dumpLineAttribution(FILE* stream);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,635 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+#include "number_powers.h"
+
+/* IEEE-754 binary64 */
+#define MANTISSA_EXPLICIT_BITS  52
+#define MINIMUM_EXPONENT        (-1023)
+#define INFINITE_POWER          0x7FF
+/* Digits that always fit into a uint64_t */
+#define MAX_DIGITS              19
+
+typedef struct
+{
+    uint64_t mantissa;
+    /* Biased binary exponent, -1 when the fast path can't decide */
+    int power2;
+} AdjustedMantissa;
+
+static const double exactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* A do-it-yourself floating point number f * 2^e, for Grisu */
+typedef struct
+{
+    uint64_t f;
+    int e;
+} DiyFp;
+
+static const uint32_t powersOfTen32[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static double slowParse(const char* start, int length);
+static AdjustedMantissa eiselLemire(int64_t q, uint64_t w);
+static double toDouble(AdjustedMantissa am);
+
+static bool grisu3(double value, char* digits, int* count, int* k);
+static int exactShortest(double value, int shortest, char* digits, int* k);
+static int prettify(char* buffer, int length, int k);
+
+/*
+    The lexeme is split into w * 10^q where w holds the first MAX_DIGITS significant digits.
+    Then, from cheapest to most expensive:
+    1. Integers and short decimals where w and 10^q are both exact doubles: one multiply/divide (Clinger)
+    2. Eisel-Lemire: multiply w by a 128-bit approximation of 5^q, exact in all but a few corner cases
+    3. More than MAX_DIGITS digits: if w and w+1 round the same way we are done, otherwise slowParse()
+*/
+double parseNumber(const char* start, int length)
+{
+    const char* current = start;
+    const char* end = start + length;
+
+    uint64_t w = 0;
+    int digits = 0;
+    int64_t q = 0;
+    bool truncated = false;
+
+    /* Leading zeros are not significant */
+    while (current < end && *current == '0')
+    {
+        current++;
+    }
+
+    for (; current < end && *current != '.'; current++)
+    {
+        if (digits < MAX_DIGITS)
+        {
+            w = w * 10 + (uint64_t)(*current - '0');
+            if (w != 0)
+            {
+                digits++;
+            }
+        }
+        else
+        {
+            /* Dropped integer digits still scale the result */
+            truncated |= (*current != '0');
+            q++;
+        }
+    }
+
+    if (current < end && *current == '.')
+    {
+        current++;
+        for (; current < end; current++)
+        {
+            if (digits < MAX_DIGITS)
+            {
+                w = w * 10 + (uint64_t)(*current - '0');
+                if (w != 0)
+                {
+                    digits++;
+                }
+                q--;
+            }
+            else
+            {
+                truncated |= (*current != '0');
+            }
+        }
+    }
+
+    if (w == 0)
+    {
+        return 0.0;
+    }
+
+    /* Clinger's fast path: both operands exact, so the one rounding is correct */
+    if (!truncated && w <= ((uint64_t)1 << 53) && q >= -22 && q <= 22)
+    {
+        double value = (double)w;
+        if (q < 0)
+        {
+            return value / exactPowersOfTen[-q];
+        }
+        return value * exactPowersOfTen[q];
+    }
+
+    AdjustedMantissa am = eiselLemire(q, w);
+    if (truncated && am.power2 >= 0)
+    {
+        /* The real value lies between w and w+1, only trust the result if both ends agree */
+        AdjustedMantissa upper = eiselLemire(q, w + 1);
+        if (upper.mantissa != am.mantissa || upper.power2 != am.power2)
+        {
+            am.power2 = -1;
+        }
+    }
+
+    if (am.power2 < 0)
+    {
+        return slowParse(start, length);
+    }
+    return toDouble(am);
+}
+
+/*
+    Eisel-Lemire, see Lemire, "Number Parsing at a Gigabyte per Second" (2021).
+    With the second product below it is exact for any w of at most 19 digits (Mushtak & Lemire, 2022)
+*/
+static AdjustedMantissa eiselLemire(int64_t q, uint64_t w)
+{
+    AdjustedMantissa answer;
+
+    if (q < NUMBER_SMALLEST_POWER)
+    {
+        answer.mantissa = 0;
+        answer.power2 = 0;
+        return answer;
+    }
+    if (q > NUMBER_LARGEST_POWER)
+    {
+        answer.mantissa = 0;
+        answer.power2 = INFINITE_POWER;
+        return answer;
+    }
+
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+
+    /* We need MANTISSA_EXPLICIT_BITS + 3 good bits of the product */
+    int index = 2 * (int)(q - NUMBER_SMALLEST_POWER);
+    unsigned __int128 first = (unsigned __int128)w * powersOfFive[index];
+    uint64_t high = (uint64_t)(first >> 64);
+    uint64_t low = (uint64_t)first;
+    const uint64_t precisionMask = UINT64_MAX >> (MANTISSA_EXPLICIT_BITS + 3);
+    if ((high & precisionMask) == precisionMask)
+    {
+        /* The truncated bits might carry into the ones we keep, look at the low half of 5^q as well */
+        unsigned __int128 second = (unsigned __int128)w * powersOfFive[index + 1];
+        uint64_t secondHigh = (uint64_t)(second >> 64);
+        low += secondHigh;
+        if (secondHigh > low)
+        {
+            high++;
+        }
+    }
+
+    int upperBit = (int)(high >> 63);
+    int shift = upperBit + 64 - MANTISSA_EXPLICIT_BITS - 3;
+    answer.mantissa = high >> shift;
+    /* floor(log2(10^q)) + 63, valid for |q| < 1233 */
+    int power = (int)((((152170 + 65536) * q) >> 16) + 63);
+    answer.power2 = power + upperBit - lz - MINIMUM_EXPONENT;
+
+    if (answer.power2 <= 0)
+    {
+        /* Subnormal */
+        if (-answer.power2 + 1 >= 64)
+        {
+            answer.mantissa = 0;
+            answer.power2 = 0;
+            return answer;
+        }
+        answer.mantissa >>= -answer.power2 + 1;
+        answer.mantissa += (answer.mantissa & 1);
+        answer.mantissa >>= 1;
+        answer.power2 = (answer.mantissa < ((uint64_t)1 << MANTISSA_EXPLICIT_BITS)) ? 0 : 1;
+        return answer;
+    }
+
+    /* Exactly halfway between two doubles can only happen for small q, round to even then */
+    if (low <= 1 && q >= -4 && q <= 23 && (answer.mantissa & 3) == 1)
+    {
+        if ((answer.mantissa << shift) == high)
+        {
+            answer.mantissa &= ~(uint64_t)1;
+        }
+    }
+
+    answer.mantissa += (answer.mantissa & 1);
+    answer.mantissa >>= 1;
+    if (answer.mantissa >= ((uint64_t)2 << MANTISSA_EXPLICIT_BITS))
+    {
+        answer.mantissa = (uint64_t)1 << MANTISSA_EXPLICIT_BITS;
+        answer.power2++;
+    }
+    answer.mantissa &= ~((uint64_t)1 << MANTISSA_EXPLICIT_BITS);
+
+    if (answer.power2 >= INFINITE_POWER)
+    {
+        answer.mantissa = 0;
+        answer.power2 = INFINITE_POWER;
+    }
+    return answer;
+}
+
+static double toDouble(AdjustedMantissa am)
+{
+    uint64_t bits = am.mantissa | ((uint64_t)am.power2 << MANTISSA_EXPLICIT_BITS);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/*
+    Last resort for long lexemes whose truncated digits decide the rounding.
+    The halfway points between doubles have at most 767 significant digits, so past the first SLOW_DIGITS all that
+    matters is whether anything nonzero follows. strtod() gets those digits, a sticky '1' for the rest and the
+    exponent spelled out: a fixed buffer whatever the length, nothing to allocate
+*/
+#define SLOW_DIGITS 800
+
+static double slowParse(const char* start, int length)
+{
+    /* Digits, the sticky digit, "e-2147483648" and '\0' */
+    char buffer[SLOW_DIGITS + 16];
+    int count = 0;
+    /* The value is buffer's digits * 10^exponent */
+    int exponent = 0;
+    bool sticky = false;
+    bool fraction = false;
+
+    for (const char* current = start; current < start + length; current++)
+    {
+        if (*current == '.')
+        {
+            fraction = true;
+        }
+        else if (count == 0 && *current == '0')
+        {
+            /* Leading zeros only move the exponent */
+            exponent -= fraction;
+        }
+        else if (count < SLOW_DIGITS)
+        {
+            buffer[count++] = *current;
+            exponent -= fraction;
+        }
+        else
+        {
+            sticky |= (*current != '0');
+            exponent += !fraction;
+        }
+    }
+
+    if (count == 0)
+    {
+        return 0.0;
+    }
+    if (sticky)
+    {
+        buffer[count++] = '1';
+        exponent--;
+    }
+    snprintf(buffer + count, sizeof(buffer) - count, "e%d", exponent);
+    return strtod(buffer, NULL);
+}
+
+
+/*
+    Grisu3, see Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers" (2010).
+    Always the shortest digits that round-trip, and of those the closest to value: Grisu3 knows when its
+    approximations can't tell, about 0.5% of doubles, and those go to exactShortest()
+*/
+int formatNumber(double value, char* buffer)
+{
+    int length = 0;
+
+    if (value != value)
+    {
+        memcpy(buffer, "nan", 3);
+        return 3;
+    }
+    if (signbit(value))
+    {
+        buffer[length++] = '-';
+        value = -value;
+    }
+    if (isinf(value))
+    {
+        memcpy(buffer + length, "inf", 3);
+        return length + 3;
+    }
+    if (value == 0.0)
+    {
+        buffer[length++] = '0';
+        return length;
+    }
+
+    /* Integers below 2^53 are common and need no Grisu at all */
+    if (value < 9007199254740992.0 && value == (double)(uint64_t)value)
+    {
+        char digits[NUMBER_BUFFER_SIZE];
+        int count = 0;
+        uint64_t integer = (uint64_t)value;
+        while (integer > 0)
+        {
+            digits[count++] = (char)('0' + integer % 10);
+            integer /= 10;
+        }
+        while (count > 0)
+        {
+            buffer[length++] = digits[--count];
+        }
+        return length;
+    }
+
+    int k = 0;
+    int count = 0;
+    if (!grisu3(value, buffer + length, &count, &k))
+    {
+        count = exactShortest(value, count, buffer + length, &k);
+    }
+    return length + prettify(buffer + length, count, k);
+}
+
+/*
+    The slow way, for the doubles Grisu3 gives up on. printf() rounds correctly, so "%.*e" is the closest decimal of
+    each length; the first length that parses back is the shortest. Sitting on a power of two the interval reaches
+    twice as far up as down, so when the closest falls short below, the next decimal up may still be in.
+    Grisu3's digits came from a wider interval than the real one, so there are no fewer than shortest of them
+*/
+static int exactShortest(double value, int shortest, char* digits, int* k)
+{
+    char text[40];
+    uint64_t w = 0;
+    int q = 0;
+    /* 17 digits always parse back */
+    for (int precision = shortest < 17 ? shortest : 17; precision <= 17; precision++)
+    {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+        w = 0;
+        const char* c = text;
+        for (; *c != 'e'; c++)
+        {
+            if (*c >= '0' && *c <= '9')
+            {
+                w = w * 10 + (uint64_t)(*c - '0');
+            }
+        }
+        q = atoi(c + 1) - (precision - 1);
+
+        /* No decimal point, so the locale doesn't matter */
+        snprintf(text, sizeof(text), "%llue%d", (unsigned long long)w, q);
+        double parsed = strtod(text, NULL);
+        if (parsed == value)
+        {
+            break;
+        }
+        snprintf(text, sizeof(text), "%llue%d", (unsigned long long)(w + 1), q);
+        if (parsed < value && strtod(text, NULL) == value)
+        {
+            w++;
+            break;
+        }
+    }
+
+    while (w % 10 == 0)
+    {
+        w /= 10;
+        q++;
+    }
+    char reversed[NUMBER_BUFFER_SIZE];
+    int count = 0;
+    while (w > 0)
+    {
+        reversed[count++] = (char)('0' + w % 10);
+        w /= 10;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        digits[i] = reversed[count - 1 - i];
+    }
+    *k = q;
+    return count;
+}
+
+static DiyFp diyFpFromDouble(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    DiyFp result;
+    uint64_t significand = bits & (((uint64_t)1 << MANTISSA_EXPLICIT_BITS) - 1);
+    int biasedExponent = (int)(bits >> MANTISSA_EXPLICIT_BITS);
+    if (biasedExponent != 0)
+    {
+        result.f = significand | ((uint64_t)1 << MANTISSA_EXPLICIT_BITS);
+        result.e = biasedExponent - 1075;
+    }
+    else
+    {
+        /* Subnormal */
+        result.f = significand;
+        result.e = 1 - 1075;
+    }
+    return result;
+}
+
+static DiyFp normalizeDiyFp(DiyFp value)
+{
+    int shift = __builtin_clzll(value.f);
+    value.f <<= shift;
+    value.e -= shift;
+    return value;
+}
+
+/* 64x64 multiply keeping the rounded upper half */
+static DiyFp multiplyDiyFp(DiyFp a, DiyFp b)
+{
+    unsigned __int128 product = (unsigned __int128)a.f * b.f;
+    DiyFp result;
+    result.f = (uint64_t)(product >> 64) + (((uint64_t)product >> 63) & 1);
+    result.e = a.e + b.e + 64;
+    return result;
+}
+
+/*
+    Walk the last digit down while that gets closer to value. Every quantity here is off by up to unit, so only
+    succeed when no value within unit of the real one could have come out differently
+*/
+static bool roundWeed(char* digits, int length, uint64_t distanceHigh, uint64_t unsafeInterval, uint64_t rest,
+                      uint64_t tenKappa, uint64_t unit)
+{
+    uint64_t smallDistance = distanceHigh - unit;
+    uint64_t bigDistance = distanceHigh + unit;
+    while (rest < smallDistance && unsafeInterval - rest >= tenKappa &&
+           (rest + tenKappa < smallDistance || smallDistance - rest >= rest + tenKappa - smallDistance))
+    {
+        digits[length - 1]--;
+        rest += tenKappa;
+    }
+    /* The real value might want one more step down */
+    if (rest < bigDistance && unsafeInterval - rest >= tenKappa &&
+        (rest + tenKappa < bigDistance || bigDistance - rest > rest + tenKappa - bigDistance))
+    {
+        return false;
+    }
+    /* And the digits must be inside the interval for sure */
+    return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+}
+
+/*
+    Produce the digits of value into digits (no sign, no dot) and the decimal exponent k, value ~= digits * 10^k.
+    Returns false when the result can't be proven shortest and closest
+*/
+static bool grisu3(double value, char* digits, int* count, int* k)
+{
+    DiyFp v = diyFpFromDouble(value);
+
+    /* The boundaries m- and m+ halfway to the neighbouring doubles, sharing m+'s exponent */
+    DiyFp plus = { (v.f << 1) + 1, v.e - 1 };
+    plus = normalizeDiyFp(plus);
+    DiyFp minus;
+    if (v.f == ((uint64_t)1 << MANTISSA_EXPLICIT_BITS) && v.e > 1 - 1075)
+    {
+        /* The next double down is closer when we sit on a power of two, unless it is a subnormal */
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    }
+    else
+    {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    /* Pick a cached 10^-k that moves the exponent of m+ into [-60, -32] */
+    double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0)
+    {
+        ik++;
+    }
+    int index = (ik >> 3) + 1;
+    *k = -(NUMBER_CACHED_POWER_MIN + index * 8);
+    DiyFp cached = { cachedPowersF[index], cachedPowersE[index] };
+
+    DiyFp w = multiplyDiyFp(normalizeDiyFp(v), cached);
+    DiyFp upper = multiplyDiyFp(plus, cached);
+    DiyFp lower = multiplyDiyFp(minus, cached);
+
+    /* The products may be off by one unit either way: widen to the unsafe interval, digits are cut from its top */
+    uint64_t unit = 1;
+    uint64_t tooHigh = upper.f + unit;
+    uint64_t unsafeInterval = tooHigh - (lower.f - unit);
+    DiyFp one = { (uint64_t)1 << -upper.e, upper.e };
+    uint32_t p1 = (uint32_t)(tooHigh >> -one.e);
+    uint64_t p2 = tooHigh & (one.f - 1);
+
+    int kappa = 1;
+    while (kappa < 10 && p1 >= powersOfTen32[kappa])
+    {
+        kappa++;
+    }
+
+    int length = 0;
+    /* Integral part */
+    while (kappa > 0)
+    {
+        uint32_t digit = p1 / powersOfTen32[kappa - 1];
+        p1 %= powersOfTen32[kappa - 1];
+        digits[length++] = (char)('0' + digit);
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest < unsafeInterval)
+        {
+            *k += kappa;
+            *count = length;
+            return roundWeed(digits, length, tooHigh - w.f, unsafeInterval, rest,
+                             (uint64_t)powersOfTen32[kappa] << -one.e, unit);
+        }
+    }
+
+    /* Fractional part, the error grows tenfold with every digit */
+    while (1)
+    {
+        p2 *= 10;
+        unit *= 10;
+        unsafeInterval *= 10;
+        uint32_t digit = (uint32_t)(p2 >> -one.e);
+        digits[length++] = (char)('0' + digit);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < unsafeInterval)
+        {
+            *k += kappa;
+            *count = length;
+            return roundWeed(digits, length, (tooHigh - w.f) * unit, unsafeInterval, p2, one.f, unit);
+        }
+    }
+}
+
+/* Turn digits * 10^k into the text we print, in place. Returns the new length */
+static int prettify(char* buffer, int length, int k)
+{
+    /* 10^(decimalPoint - 1) <= value < 10^decimalPoint */
+    int decimalPoint = length + k;
+
+    if (length <= decimalPoint && decimalPoint <= 21)
+    {
+        /* 1234e7 -> 12340000000 */
+        for (int i = length; i < decimalPoint; i++)
+        {
+            buffer[i] = '0';
+        }
+        return decimalPoint;
+    }
+    if (0 < decimalPoint && decimalPoint <= 21)
+    {
+        /* 1234e-2 -> 12.34 */
+        memmove(buffer + decimalPoint + 1, buffer + decimalPoint, length - decimalPoint);
+        buffer[decimalPoint] = '.';
+        return length + 1;
+    }
+    if (-6 < decimalPoint && decimalPoint <= 0)
+    {
+        /* 1234e-6 -> 0.001234 */
+        int shift = 2 - decimalPoint;
+        memmove(buffer + shift, buffer, length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        for (int i = 2; i < shift; i++)
+        {
+            buffer[i] = '0';
+        }
+        return length + shift;
+    }
+
+    /* Scientific: 1e+30, 1.234e-30 */
+    int position = 1;
+    if (length > 1)
+    {
+        memmove(buffer + 2, buffer + 1, length - 1);
+        buffer[1] = '.';
+        position = length + 1;
+    }
+    int exponent = decimalPoint - 1;
+    buffer[position++] = 'e';
+    buffer[position++] = exponent < 0 ? '-' : '+';
+    if (exponent < 0)
+    {
+        exponent = -exponent;
+    }
+    if (exponent >= 100)
+    {
+        buffer[position++] = (char)('0' + exponent / 100);
+        exponent %= 100;
+        buffer[position++] = (char)('0' + exponent / 10);
+    }
+    else if (exponent >= 10)
+    {
+        buffer[position++] = (char)('0' + exponent / 10);
+    }
+    buffer[position++] = (char)('0' + exponent % 10);
+    return position;
+}
\ No newline at end of file
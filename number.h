@@ -0,0 +1,24 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+/*
+    Convert a number lexeme (digits, optionally '.' and more digits) into the nearest double.
+    Works on the (start, length) span the scanner hands us, so no '\0' is needed and nothing is rescanned.
+    Correctly rounded, same bits as strtod() in the "C" locale, but never looks at the locale
+*/
+double parseNumber(const char* start, int length);
+
+/* Longest text formatNumber() can produce, e.g. "-2.2250738585072014e-308" plus room to spare */
+#define NUMBER_BUFFER_SIZE 32
+
+/*
+    Write the shortest decimal text that parses back to exactly value, the closest if there are several (Grisu3).
+    Returns its length.
+    Plain notation for 1e-6 <= |value| < 1e21, "1.5e+300" style outside of that, "nan"/"inf" like printf.
+    buffer needs NUMBER_BUFFER_SIZE bytes and is NOT NUL-terminated
+*/
+int formatNumber(double value, char* buffer);
+
+#endif
\ No newline at end of file
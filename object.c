@@ -0,0 +1,429 @@
+#include <limits.h>
+#include <string.h>
+
+#include "gc.h"
+#include "object.h"
+#include "vm.h"
+
+#define ALLOCATE_OBJ(type, objectType) \
+    (type*)allocateObject(vm, sizeof(type), objectType)
+
+static Obj* allocateObject(VM* vm, size_t size, ObjType type)
+{
+    Obj* object = gcAllocate(vm, size);
+    object->type = (uint8_t)type;
+    return object;
+}
+
+ObjArray* newArray(VM* vm)
+{
+    ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+    array->count = 0;
+    array->capacity = 0;
+    array->values = NULL;
+    /* Storage belongs to the array wherever it moves, the GC has to know if it dies young */
+    gcTrackStorage(vm, (Obj*)array);
+    return array;
+}
+
+uint32_t hashString(const char* chars, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static ObjString* allocateString(VM* vm, int length)
+{
+    ObjString* string = (ObjString*)allocateObject(vm, sizeof(ObjString) + length + 1, OBJ_STRING);
+    string->length = length;
+    string->hash = 0;
+    string->chars[length] = '\0';
+    return string;
+}
+
+/* string was just filled in: hand back the interned copy if there is one, otherwise intern it */
+static ObjString* internString(VM* vm, ObjString* string)
+{
+    string->hash = hashString(string->chars, string->length);
+    vm->internLookups++;
+    ObjString* interned = tableFindString(&(vm->strings), string->chars, string->length, string->hash);
+    if (interned != NULL)
+    {
+        vm->internHits++;
+        return interned;
+    }
+    tableSet(&(vm->strings), string, NUMBER_VAL(0));
+    gcTrackInterned(vm, string);
+    return string;
+}
+
+ObjString* copyString(VM* vm, const char* chars, int length)
+{
+    return copyHashedString(vm, chars, length, hashString(chars, length));
+}
+
+ObjString* copyHashedString(VM* vm, const char* chars, int length, uint32_t hash)
+{
+    vm->internLookups++;
+    ObjString* interned = tableFindString(&(vm->strings), chars, length, hash);
+    if (interned != NULL)
+    {
+        vm->internHits++;
+        return interned;
+    }
+
+    /* May collect, so don't look anything up in the table before this */
+    ObjString* string = allocateString(vm, length);
+    string->hash = hash;
+    memcpy(string->chars, chars, length);
+
+    /* The table doesn't keep it alive, the GC removes it once nothing else does */
+    tableSet(&(vm->strings), string, NUMBER_VAL(0));
+    gcTrackInterned(vm, string);
+    return string;
+}
+
+static ObjBuffer* newBuffer(VM* vm, int capacity)
+{
+    gcCheckHeapBudget(vm, (size_t)capacity);
+    ObjBuffer* buffer = ALLOCATE_OBJ(ObjBuffer, OBJ_BUFFER);
+    buffer->length = 0;
+    buffer->capacity = capacity;
+    buffer->chars = GROW_ARRAY(&(vm->heap.allocator), MEM_OBJECTS, char, NULL, 0, capacity);
+    gcTrackStorage(vm, (Obj*)buffer);
+    return buffer;
+}
+
+static void appendBuffer(VM* vm, ObjBuffer* buffer, const char* chars, int length)
+{
+    if (buffer->length + length > buffer->capacity)
+    {
+        int oldCapacity = buffer->capacity;
+        int capacity = oldCapacity;
+        while (capacity < buffer->length + length)
+        {
+            capacity *= 2;
+        }
+        if (capacity > ROPE_BUFFER_MAX)
+        {
+            capacity = ROPE_BUFFER_MAX;
+        }
+        /* Before anything changes, the buffer must stay whole if it panics */
+        gcCheckHeapBudget(vm, (size_t)(capacity - oldCapacity));
+        buffer->chars = GROW_ARRAY(&(vm->heap.allocator), MEM_OBJECTS, char, buffer->chars, oldCapacity, capacity);
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->chars + buffer->length, chars, length);
+    buffer->length += length;
+}
+
+static ObjRope* newRope(VM* vm, int length)
+{
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = length;
+    rope->left = NUMBER_VAL(0);
+    rope->right = NUMBER_VAL(0);
+    rope->flat = NUMBER_VAL(0);
+    return rope;
+}
+
+int textLength(Value text)
+{
+    return IS_STRING(text) ? AS_STRING(text)->length : AS_ROPE(text)->length;
+}
+
+Value concatenateText(VM* vm, Value* left, Value* right)
+{
+    int leftLength = textLength(*left);
+    int rightLength = textLength(*right);
+    if (rightLength > INT_MAX - leftLength)
+    {
+        panicWith(vm, "String too long.");
+    }
+    int length = leftLength + rightLength;
+
+    if (length < ROPE_MIN_LENGTH)
+    {
+        /* Ropes are never this short, so both are flat. On the C stack, nothing to free if copyString() panics */
+        char chars[ROPE_MIN_LENGTH];
+        memcpy(chars, AS_CSTRING(*left), leftLength);
+        memcpy(chars + leftLength, AS_CSTRING(*right), rightLength);
+        return OBJ_VAL(copyString(vm, chars, length));
+    }
+
+    if (IS_ROPE(*left) && IS_STRING(*right) && IS_BUFFER(AS_ROPE(*left)->right))
+    {
+        ObjRope* rope = AS_ROPE(*left);
+        ObjBuffer* buffer = AS_BUFFER(rope->right);
+        /* Only the newest rope on a buffer may append to it, older ones would see the new characters otherwise */
+        bool newest = (rope->length - textLength(rope->left)) == buffer->length;
+        if (newest && buffer->length + rightLength <= ROPE_BUFFER_MAX)
+        {
+            /* Never collects, and the buffer stays reachable through *left */
+            appendBuffer(vm, buffer, AS_CSTRING(*right), rightLength);
+            ObjRope* result = newRope(vm, length);
+            rope = AS_ROPE(*left);
+            result->left = rope->left;
+            result->right = rope->right;
+            return OBJ_VAL(result);
+        }
+    }
+
+    Value tail = *right;
+    if (IS_STRING(*right) && rightLength < ROPE_BUFFER_MAX)
+    {
+        /* Start a buffer that the following appends can go into */
+        int capacity = ROPE_MIN_LENGTH;
+        while (capacity < rightLength * 2 && capacity < ROPE_BUFFER_MAX)
+        {
+            capacity *= 2;
+        }
+        ObjBuffer* buffer = newBuffer(vm, capacity);
+        appendBuffer(vm, buffer, AS_CSTRING(*right), rightLength);
+        tail = OBJ_VAL(buffer);
+    }
+
+    gcPushRoot(vm, &tail);
+    ObjRope* result = newRope(vm, length);
+    gcPopRoot(vm);
+    result->left = *left;
+    result->right = tail;
+    return OBJ_VAL(result);
+}
+
+typedef struct
+{
+    Obj* text;
+    int length;
+} TextPiece;
+
+/* Iterative, `s = piece + s` makes ropes as deep as they are long */
+static void writeText(VM* vm, char* destination, Obj* text, int length)
+{
+    int capacity = 64;
+    int count = 0;
+    TextPiece* pieces = GROW_ARRAY(vm->allocator, MEM_OTHER, TextPiece, NULL, 0, capacity);
+    pieces[count++] = (TextPiece){ text, length };
+
+    while (count > 0)
+    {
+        TextPiece piece = pieces[--count];
+        switch (piece.text->type)
+        {
+            case OBJ_STRING:
+            {
+                memcpy(destination, ((ObjString*)piece.text)->chars, piece.length);
+                destination += piece.length;
+                break;
+            }
+            case OBJ_BUFFER:
+            {
+                memcpy(destination, ((ObjBuffer*)piece.text)->chars, piece.length);
+                destination += piece.length;
+                break;
+            }
+            case OBJ_ROPE:
+            {
+                ObjRope* rope = (ObjRope*)piece.text;
+                if (IS_OBJ(rope->flat))
+                {
+                    memcpy(destination, AS_CSTRING(rope->flat), piece.length);
+                    destination += piece.length;
+                    break;
+                }
+                if (count + 2 > capacity)
+                {
+                    int oldCapacity = capacity;
+                    capacity *= 2;
+                    pieces = GROW_ARRAY(vm->allocator, MEM_OTHER, TextPiece, pieces, oldCapacity, capacity);
+                }
+                /* Right first, so left comes out first */
+                int leftLength = textLength(rope->left);
+                pieces[count++] = (TextPiece){ AS_OBJ(rope->right), piece.length - leftLength };
+                pieces[count++] = (TextPiece){ AS_OBJ(rope->left), leftLength };
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    FREE_ARRAY(vm->allocator, MEM_OTHER, TextPiece, pieces, capacity);
+}
+
+ObjString* flattenText(VM* vm, Value* text)
+{
+    if (IS_STRING(*text))
+    {
+        return AS_STRING(*text);
+    }
+    if (IS_OBJ(AS_ROPE(*text)->flat))
+    {
+        return AS_STRING(AS_ROPE(*text)->flat);
+    }
+
+    /* May collect and move the rope */
+    ObjString* string = allocateString(vm, AS_ROPE(*text)->length);
+    ObjRope* rope = AS_ROPE(*text);
+    writeText(vm, string->chars, (Obj*)rope, rope->length);
+    string = internString(vm, string);
+
+    /* From now on the rope is just a name for the flat string, the tree can go */
+    gcWriteBarrier(vm, (Obj*)rope, 2, OBJ_VAL(string));
+    rope->flat = OBJ_VAL(string);
+    rope->left = NUMBER_VAL(0);
+    rope->right = NUMBER_VAL(0);
+    return string;
+}
+
+void dumpStringStats(VM* vm, FILE* stream)
+{
+    uint64_t lookups = vm->internLookups;
+    uint64_t hits = vm->internHits;
+    fprintf(stream, "---------- STRINGS ------------\n");
+    fprintf(stream, "%-20s %14d\n", "interned", vm->strings.count);
+    fprintf(stream, "%-20s %14llu\n", "lookups", (unsigned long long)lookups);
+    fprintf(stream, "%-20s %14llu\n", "hits", (unsigned long long)hits);
+    fprintf(stream, "%-20s %13.1f%%\n", "hit rate", lookups > 0 ? 100.0 * hits / lookups : 0.0);
+}
+
+void arrayPush(VM* vm, ObjArray* array, Value value)
+{
+    if (array->count == array->capacity)
+    {
+        /* Smaller start than chunks, most arrays are tiny */
+        int oldCapacity = array->capacity;
+        int capacity = oldCapacity < ARRAY_INITIAL_CAPACITY ? ARRAY_INITIAL_CAPACITY : oldCapacity * 2;
+        gcCheckHeapBudget(vm, sizeof(Value) * (size_t)(capacity - oldCapacity));
+        /* Straight from the heap allocator, this never triggers a collection */
+        array->values = GROW_ARRAY(&(vm->heap.allocator), MEM_OBJECTS, Value, array->values, oldCapacity, capacity);
+        array->capacity = capacity;
+    }
+    gcWriteBarrier(vm, (Obj*)array, array->count, value);
+    array->values[array->count] = value;
+    array->count++;
+}
+
+void arraySet(VM* vm, ObjArray* array, int index, Value value)
+{
+    gcWriteBarrier(vm, (Obj*)array, index, value);
+    array->values[index] = value;
+}
+
+Value* objectSlot(Obj* object, int slot)
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        {
+            return &(((ObjArray*)object)->values[slot]);
+        }
+        case OBJ_ROPE:
+        {
+            ObjRope* rope = (ObjRope*)object;
+            return slot == 0 ? &(rope->left) : slot == 1 ? &(rope->right) : &(rope->flat);
+        }
+        case OBJ_BUFFER:
+        case OBJ_STRING:
+        {
+            /* No references */
+            break;
+        }
+    }
+    return NULL;
+}
+
+void traceObject(VM* vm, Obj* object, void (*visit)(VM* vm, Value* slot))
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        {
+            ObjArray* array = (ObjArray*)object;
+            for (int i = 0; i < array->count; i++)
+            {
+                visit(vm, &(array->values[i]));
+            }
+            break;
+        }
+        case OBJ_ROPE:
+        {
+            ObjRope* rope = (ObjRope*)object;
+            visit(vm, &(rope->left));
+            visit(vm, &(rope->right));
+            visit(vm, &(rope->flat));
+            break;
+        }
+        case OBJ_BUFFER:
+        case OBJ_STRING:
+        {
+            break;
+        }
+    }
+}
+
+void freeObjectStorage(VM* vm, Obj* object)
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        {
+            ObjArray* array = (ObjArray*)object;
+            FREE_ARRAY(&(vm->heap.allocator), MEM_OBJECTS, Value, array->values, array->capacity);
+            array->values = NULL;
+            array->capacity = 0;
+            array->count = 0;
+            break;
+        }
+        case OBJ_BUFFER:
+        {
+            ObjBuffer* buffer = (ObjBuffer*)object;
+            FREE_ARRAY(&(vm->heap.allocator), MEM_OBJECTS, char, buffer->chars, buffer->capacity);
+            buffer->chars = NULL;
+            buffer->capacity = 0;
+            buffer->length = 0;
+            break;
+        }
+        case OBJ_ROPE:
+        case OBJ_STRING:
+        {
+            /* Characters are part of the object */
+            break;
+        }
+    }
+}
+
+void printObject(VM* vm, OutputBuffer* out, Value value)
+{
+    switch (OBJ_TYPE(value))
+    {
+        case OBJ_ARRAY:
+        {
+            /* Arrays can contain themselves, so no contents */
+            printOutput(out, "<array %d>", AS_ARRAY(value)->count);
+            break;
+        }
+        case OBJ_BUFFER:
+        {
+            printOutput(out, "<buffer %d>", AS_BUFFER(value)->length);
+            break;
+        }
+        case OBJ_ROPE:
+        case OBJ_STRING:
+        {
+            /* Printing is what ropes wait for */
+            gcPushRoot(vm, &value);
+            ObjString* string = flattenText(vm, &value);
+            gcPopRoot(vm);
+            writeOutput(out, string->chars, string->length);
+            break;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#ifndef clox_object_h
+#define clox_object_h
+
+#include "common.h"
+#include "value.h"
+
+#define OBJ_TYPE(value)     (AS_OBJ(value)->type)
+
+#define IS_ARRAY(value)     isObjType(value, OBJ_ARRAY)
+#define IS_BUFFER(value)    isObjType(value, OBJ_BUFFER)
+#define IS_ROPE(value)      isObjType(value, OBJ_ROPE)
+#define IS_STRING(value)    isObjType(value, OBJ_STRING)
+/* Anything the script sees as a string, flat or not */
+#define IS_TEXT(value)      (IS_STRING(value) || IS_ROPE(value))
+
+#define AS_ARRAY(value)     ((ObjArray*)AS_OBJ(value))
+#define AS_BUFFER(value)    ((ObjBuffer*)AS_OBJ(value))
+#define AS_ROPE(value)      ((ObjRope*)AS_OBJ(value))
+#define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
+#define AS_CSTRING(value)   (((ObjString*)AS_OBJ(value))->chars)
+
+#define ARRAY_INITIAL_CAPACITY 0x8
+
+/* Concatenations shorter than this stay flat strings */
+#define ROPE_MIN_LENGTH     0x100
+/* Ropes append into a buffer up to this size, then start a new one */
+#define ROPE_BUFFER_MAX     0x100000
+
+typedef enum
+{
+    OBJ_ARRAY,
+    OBJ_BUFFER,
+    OBJ_ROPE,
+    OBJ_STRING
+} ObjType;
+
+/* Bits of Obj.flags, owned by gc.c */
+#define OBJ_OLD         0x1
+#define OBJ_MARKED      0x2
+#define OBJ_FORWARDED   0x4
+/* Lives outside the heap (e.g. in a loaded image), the GC leaves it alone */
+#define OBJ_PERMANENT   0x8
+
+/*
+    Header of everything on the heap (of one VM, objects never cross VMs). Objects are born in the GC's nursery and may move once,
+    when they survive a minor collection, so don't keep an Obj* across an allocation unless it's rooted (gcPushRoot())
+*/
+struct Obj
+{
+    uint8_t type;
+    uint8_t flags;
+    /* Whole object in bytes, so the GC can copy and free without knowing the type */
+    uint32_t size;
+    /* Old generation: next object of the heap. Forwarded nursery object: where it moved to */
+    struct Obj* next;
+};
+
+/* Growable list of values, and the first object that can point to others */
+typedef struct
+{
+    Obj obj;
+    int count;
+    int capacity;
+    /* Out of line, allocated from the VM heap */
+    Value* values;
+} ObjArray;
+
+/*
+    Immutable and always interned (see copyString()), so equal strings are the same object.
+    The characters live right behind the header and are '\0' terminated
+*/
+struct ObjString
+{
+    Obj obj;
+    int length;
+    /* FNV-1a, computed once when interning */
+    uint32_t hash;
+    char chars[];
+};
+
+/* Characters appended by ropes, never seen by the script itself */
+typedef struct
+{
+    Obj obj;
+    int length;
+    int capacity;
+    /* Out of line, allocated from the VM heap */
+    char* chars;
+} ObjBuffer;
+
+/*
+    Lazy left + right, what OP_ADD makes once the result reaches ROPE_MIN_LENGTH.
+    right may be an ObjBuffer that newer ropes appended to in place, this rope only sees
+    its first length - (length of left) characters. That makes `s = s + piece` amortized O(1),
+    and the rope it replaces can die young.
+    The first time the characters are needed the rope is flattened (and interned) into flat,
+    and left and right are dropped
+*/
+typedef struct
+{
+    Obj obj;
+    int length;
+    Value left;
+    Value right;
+    /* A number until flattened */
+    Value flat;
+} ObjRope;
+
+ObjArray* newArray(VM* vm);
+/* Stores go through the write barrier, never write array->values[] directly */
+void arrayPush(VM* vm, ObjArray* array, Value value);
+void arraySet(VM* vm, ObjArray* array, int index, Value value);
+
+uint32_t hashString(const char* chars, int length);
+/* The interned string with these characters, made if there is none yet */
+ObjString* copyString(VM* vm, const char* chars, int length);
+/* Same, with hashString() of the characters already known (e.g. from another VM's copy) */
+ObjString* copyHashedString(VM* vm, const char* chars, int length, uint32_t hash);
+/* Length of a string or rope */
+int textLength(Value text);
+/* left + right, both strings or ropes. The slots must be rooted (e.g. on the VM stack), this allocates */
+Value concatenateText(VM* vm, Value* left, Value* right);
+/* The flat string with the text's characters, flattening a rope in place. Same rooting rule */
+ObjString* flattenText(VM* vm, Value* text);
+/* Interning lookups and how many found an existing string, see --mem-stats */
+void dumpStringStats(VM* vm, FILE* stream);
+
+/* Where the object keeps reference number slot, for the GC's remembered set */
+Value* objectSlot(Obj* object, int slot);
+/* Calls visit on every reference the object holds, vm is handed through */
+void traceObject(VM* vm, Obj* object, void (*visit)(VM* vm, Value* slot));
+/* Frees what the object owns besides itself (e.g. the values of an array) */
+void freeObjectStorage(VM* vm, Obj* object);
+void printObject(VM* vm, OutputBuffer* out, Value value);
+
+static inline bool isObjType(Value value, ObjType type)
+{
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "number.h"
+#include "output.h"
+
+void initOutput(OutputBuffer* out, FILE* stream)
+{
+    out->stream = stream;
+    out->count = 0;
+}
+
+void writeOutput(OutputBuffer* out, const char* bytes, size_t length)
+{
+    if (out->count + length > OUTPUT_BUFFER_SIZE)
+    {
+        flushOutput(out);
+        if (length > OUTPUT_BUFFER_SIZE)
+        {
+            /* Would not fit anyway, no point copying it */
+            fwrite(bytes, 1, length, out->stream);
+            return;
+        }
+    }
+    memcpy(out->data + out->count, bytes, length);
+    out->count += length;
+}
+
+void writeOutputChar(OutputBuffer* out, char c)
+{
+    if (out->count == OUTPUT_BUFFER_SIZE)
+    {
+        flushOutput(out);
+    }
+    out->data[out->count++] = c;
+}
+
+void writeOutputString(OutputBuffer* out, const char* string)
+{
+    writeOutput(out, string, strlen(string));
+}
+
+void writeOutputNumber(OutputBuffer* out, double number)
+{
+    if (out->count + NUMBER_BUFFER_SIZE > OUTPUT_BUFFER_SIZE)
+    {
+        flushOutput(out);
+    }
+    /* Format straight into the buffer */
+    out->count += formatNumber(number, out->data + out->count);
+}
+
+void printOutput(OutputBuffer* out, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t space = OUTPUT_BUFFER_SIZE - out->count;
+    int length = vsnprintf(out->data + out->count, space, format, args);
+    va_end(args);
+
+    if (length < 0)
+    {
+        return;
+    }
+    if ((size_t)length < space)
+    {
+        out->count += length;
+        return;
+    }
+
+    /* Didn't fit, make room and try again */
+    flushOutput(out);
+    va_start(args, format);
+    if ((size_t)length < OUTPUT_BUFFER_SIZE)
+    {
+        out->count += vsnprintf(out->data, OUTPUT_BUFFER_SIZE, format, args);
+    }
+    else
+    {
+        vfprintf(out->stream, format, args);
+    }
+    va_end(args);
+}
+
+void flushOutput(OutputBuffer* out)
+{
+    if (out->count > 0)
+    {
+        fwrite(out->data, 1, out->count, out->stream);
+        out->count = 0;
+    }
+    fflush(out->stream);
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include <stdarg.h>
+
+#include "common.h"
+
+/* 64K, big enough that an output-heavy script only hits the stream once in a long while */
+#define OUTPUT_BUFFER_SIZE 0x10000
+
+/*
+    Everything the VM prints (values, stack dumps, traces) is collected here
+    and handed to the stream in bulk instead of one printf() per item
+*/
+typedef struct
+{
+    FILE* stream;
+    size_t count;
+    char data[OUTPUT_BUFFER_SIZE];
+} OutputBuffer;
+
+void initOutput(OutputBuffer* out, FILE* stream);
+void writeOutput(OutputBuffer* out, const char* bytes, size_t length);
+void writeOutputChar(OutputBuffer* out, char c);
+void writeOutputString(OutputBuffer* out, const char* string);
+void writeOutputNumber(OutputBuffer* out, double number);
+/* printf() into the buffer, for the odd formatted debugging line */
+void printOutput(OutputBuffer* out, const char* format, ...);
+void flushOutput(OutputBuffer* out);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "column.h"
+#include "compiler.h"
+#include "parallel.h"
+#include "vm.h"
+
+typedef enum
+{
+    JOB_MAP,
+    JOB_REDUCE
+} JobKind;
+
+/* One parallelMap() or parallelReduce(), tasks are handed out by index so any worker may take any of them */
+typedef struct
+{
+    JobKind kind;
+    FrozenChunk* fn;
+    const double* const* inputs;
+    int inputCount;
+    double* output;
+    size_t rows;
+    /* Map over column kernels, no VM runs at all */
+    bool columnar;
+    /* Reduce: what every task folded its rows into, merged in task order at the end */
+    double* partials;
+    size_t taskCount;
+    atomic_size_t nextTask;
+    atomic_bool failed;
+} Job;
+
+struct ThreadPool
+{
+    int workerCount;
+    pthread_t* threads;
+    /* One job at a time, whichever host thread submits it */
+    pthread_mutex_t submit;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    Job* job;
+    /* Bumped for every job, so a worker never runs the same one twice */
+    uint64_t generation;
+    /* Workers still on the current job */
+    int busy;
+    bool stopping;
+};
+
+static void runTask(VM* vm, Job* job, size_t task)
+{
+    size_t first = task * PARALLEL_CHUNK;
+    size_t count = job->rows - first < PARALLEL_CHUNK ? job->rows - first : PARALLEL_CHUNK;
+    Chunk* chunk = &(job->fn->chunk);
+
+    if (job->columnar)
+    {
+        const double* columns[MAX_SLOTS];
+        for (int i = 0; i < job->inputCount; i++)
+        {
+            columns[i] = job->inputs[i] + first;
+        }
+        runColumnsWith(vm, chunk, columns, job->inputCount, job->output + first, count);
+        return;
+    }
+
+    /* Row by row on this worker's VM, the chunk itself is shared */
+    Value slots[MAX_SLOTS];
+    Value* savedSlots = vm->slots;
+    int savedSlotCount = vm->slotCount;
+    vm->slots = slots;
+    vm->slotCount = job->kind == JOB_MAP ? job->inputCount : 2;
+    if (job->kind == JOB_MAP)
+    {
+        for (size_t row = first; row < first + count; row++)
+        {
+            for (int i = 0; i < job->inputCount; i++)
+            {
+                slots[i] = NUMBER_VAL(job->inputs[i][row]);
+            }
+            if (runFrozenChunkWith(vm, job->fn) != INTERPRET_OK || !IS_NUMBER(vm->result))
+            {
+                atomic_store(&(job->failed), true);
+                break;
+            }
+            job->output[row] = AS_NUMBER(vm->result);
+        }
+    }
+    else
+    {
+        const double* input = job->inputs[0];
+        double acc = input[first];
+        for (size_t row = first + 1; row < first + count; row++)
+        {
+            slots[0] = NUMBER_VAL(acc);
+            slots[1] = NUMBER_VAL(input[row]);
+            if (runFrozenChunkWith(vm, job->fn) != INTERPRET_OK || !IS_NUMBER(vm->result))
+            {
+                atomic_store(&(job->failed), true);
+                break;
+            }
+            acc = AS_NUMBER(vm->result);
+        }
+        job->partials[task] = acc;
+    }
+    vm->slots = savedSlots;
+    vm->slotCount = savedSlotCount;
+}
+
+static void runTasks(VM* vm, Job* job)
+{
+    size_t task;
+    while ((task = atomic_fetch_add(&(job->nextTask), 1)) < job->taskCount && !atomic_load(&(job->failed)))
+    {
+        runTask(vm, job, task);
+    }
+}
+
+static void* work(void* argument)
+{
+    ThreadPool* pool = argument;
+    VM vm;
+    initVMWith(&vm);
+
+    uint64_t seen = 0;
+    pthread_mutex_lock(&(pool->lock));
+    while (true)
+    {
+        while (!pool->stopping && pool->generation == seen)
+        {
+            pthread_cond_wait(&(pool->wake), &(pool->lock));
+        }
+        if (pool->stopping)
+        {
+            break;
+        }
+        seen = pool->generation;
+        Job* job = pool->job;
+        pthread_mutex_unlock(&(pool->lock));
+
+        runTasks(&vm, job);
+        if (vm.error.kind == ERROR_OUT_OF_MEMORY)
+        {
+            /* Can't be trusted anymore, the next job gets a fresh one */
+            freeVMWith(&vm);
+            initVMWith(&vm);
+        }
+        else if (!job->columnar)
+        {
+            /* The host frees fn after the job, drop the reference runFrozenChunkWith() took */
+            freeFrozenTable(&vm, &(vm.frozenChunks));
+        }
+
+        pthread_mutex_lock(&(pool->lock));
+        if (--pool->busy == 0)
+        {
+            pthread_cond_signal(&(pool->done));
+        }
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    freeVMWith(&vm);
+    return NULL;
+}
+
+ThreadPool* startThreadPool(int workerCount)
+{
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    pool->workerCount = workerCount > 0 ? workerCount : 1;
+    pool->threads = calloc((size_t)pool->workerCount, sizeof(pthread_t));
+    pthread_mutex_init(&(pool->submit), NULL);
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->wake), NULL);
+    pthread_cond_init(&(pool->done), NULL);
+    /* The caller is worker 0 */
+    for (int i = 1; i < pool->workerCount; i++)
+    {
+        pthread_create(&(pool->threads[i]), NULL, work, pool);
+    }
+    return pool;
+}
+
+void stopThreadPool(ThreadPool* pool)
+{
+    pthread_mutex_lock(&(pool->lock));
+    pool->stopping = true;
+    pthread_cond_broadcast(&(pool->wake));
+    pthread_mutex_unlock(&(pool->lock));
+    for (int i = 1; i < pool->workerCount; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&(pool->done));
+    pthread_cond_destroy(&(pool->wake));
+    pthread_mutex_destroy(&(pool->lock));
+    pthread_mutex_destroy(&(pool->submit));
+    free(pool->threads);
+    free(pool);
+}
+
+int threadPoolSize(ThreadPool* pool)
+{
+    return pool->workerCount;
+}
+
+static ThreadPool* processPool = NULL;
+static pthread_once_t processPoolOnce = PTHREAD_ONCE_INIT;
+
+static void startProcessPool()
+{
+    const char* threads = getenv("CLOX_THREADS");
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workerCount = threads != NULL ? atoi(threads) : (int)(cores > 0 ? cores : 1);
+    processPool = startThreadPool(workerCount);
+}
+
+ThreadPool* defaultThreadPool()
+{
+    pthread_once(&processPoolOnce, startProcessPool);
+    return processPool;
+}
+
+static void runJob(VM* vm, ThreadPool* pool, Job* job)
+{
+    job->taskCount = (job->rows + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    atomic_init(&(job->nextTask), 0);
+    atomic_init(&(job->failed), false);
+    if (job->taskCount < 2 || pool->workerCount < 2)
+    {
+        /* Too small to be worth waking anybody */
+        runTasks(vm, job);
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->submit));
+    pthread_mutex_lock(&(pool->lock));
+    pool->job = job;
+    pool->busy = pool->workerCount - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&(pool->wake));
+    pthread_mutex_unlock(&(pool->lock));
+
+    runTasks(vm, job);
+
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->busy > 0)
+    {
+        pthread_cond_wait(&(pool->done), &(pool->lock));
+    }
+    pool->job = NULL;
+    pthread_mutex_unlock(&(pool->lock));
+    pthread_mutex_unlock(&(pool->submit));
+}
+
+bool parallelMapWith(VM* vm, ThreadPool* pool, FrozenChunk* fn, const double* const* inputs, int inputCount,
+                     double* output, size_t rows)
+{
+    Job job;
+    job.kind = JOB_MAP;
+    job.fn = fn;
+    job.inputs = inputs;
+    job.inputCount = inputCount < MAX_SLOTS ? inputCount : MAX_SLOTS;
+    job.output = output;
+    job.rows = rows;
+    /* No rows: only checks whether fn fits the column kernels */
+    job.columnar = runColumnsWith(vm, &(fn->chunk), inputs, job.inputCount, output, 0);
+    job.partials = NULL;
+    runJob(vm, pool, &job);
+    return !atomic_load(&(job.failed));
+}
+
+bool parallelReduceWith(VM* vm, ThreadPool* pool, FrozenChunk* fn, const double* input, size_t rows,
+                        double init, double* result)
+{
+    Job job;
+    job.kind = JOB_REDUCE;
+    job.fn = fn;
+    job.inputs = &input;
+    job.inputCount = 1;
+    job.output = NULL;
+    job.rows = rows;
+    job.columnar = false;
+    size_t taskCount = (rows + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    job.partials = malloc(sizeof(double) * (taskCount > 0 ? taskCount : 1));
+    runJob(vm, pool, &job);
+
+    /* The merge: init, then every task's fold in row order, on the caller */
+    double acc = init;
+    Value slots[2];
+    Value* savedSlots = vm->slots;
+    int savedSlotCount = vm->slotCount;
+    vm->slots = slots;
+    vm->slotCount = 2;
+    for (size_t task = 0; task < taskCount && !atomic_load(&(job.failed)); task++)
+    {
+        slots[0] = NUMBER_VAL(acc);
+        slots[1] = NUMBER_VAL(job.partials[task]);
+        if (runFrozenChunkWith(vm, fn) != INTERPRET_OK || !IS_NUMBER(vm->result))
+        {
+            atomic_store(&(job.failed), true);
+            break;
+        }
+        acc = AS_NUMBER(vm->result);
+    }
+    vm->slots = savedSlots;
+    vm->slotCount = savedSlotCount;
+    free(job.partials);
+
+    *result = acc;
+    return !atomic_load(&(job.failed));
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef clox_parallel_h
+#define clox_parallel_h
+
+#include "frozen.h"
+
+/*
+    Rows per task. Fixed, so how the rows are grouped (and so the rounding of a reduce) never depends on
+    the number of threads. Inputs of a single task run serially on the caller, the pool is not even woken
+*/
+#define PARALLEL_CHUNK      0x10000
+
+typedef struct ThreadPool ThreadPool;
+
+/*
+    workerCount - 1 threads, each with a VM of its own, waiting for work. The caller's thread is the last worker,
+    so a pool of 1 runs everything serially
+*/
+ThreadPool* startThreadPool(int workerCount);
+void stopThreadPool(ThreadPool* pool);
+int threadPoolSize(ThreadPool* pool);
+/* One per process, as many workers as cores (CLOX_THREADS overrides), started on first use */
+ThreadPool* defaultThreadPool();
+
+/*
+    parallelMap(columns, fn): output[row] is fn with slot i set to inputs[i][row], for fn compiled with
+    compileSlotsWith() and frozen. Numeric fns run as column kernels (see runColumnsWith()), anything else
+    row by row on the workers' VMs. False if a run fails or a result is not a number
+*/
+bool parallelMapWith(VM* vm, ThreadPool* pool, FrozenChunk* fn, const double* const* inputs, int inputCount,
+                     double* output, size_t rows);
+/*
+    parallelReduce(column, fn, init): fn is compiled with the slots acc and x, in that order, and must be
+    associative. Every task folds its rows, then the partial results are folded into init in row order,
+    so the result is the same for any pool (and for the serial fallback). False if a run fails or a result is not a number
+*/
+bool parallelReduceWith(VM* vm, ThreadPool* pool, FrozenChunk* fn, const double* input, size_t rows,
+                        double init, double* result);
+
+#endif
\ No newline at end of file
@@ -1,19 +1,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "memory.h"
 #include "scanner.h"
 
-typedef struct
-{
-    const char* start;
-    const char* current;
-    int line;
-    int offset; /* for debugging, we need to know the offset from the beginning of the line */
-} Scanner;
 
-Scanner scanner;
+/* Behind the old global API (initScanner(), scanToken(), ...) */
+static Scanner defaultScanner;
+
+static void advance(Scanner* scanner);
 
 const char* TokenTypeName[] = {
     /* Single-character tokens */
@@ -34,97 +33,217 @@ const char* TokenTypeName[] = {
     "TOKEN_FOR", "TOKEN_FUN", "TOKEN_IF", "TOKEN_NIL", "TOKEN_OR",
     "TOKEN_PRINT", "TOKEN_RETURN", "TOKEN_SUPER", "TOKEN_THIS",
     "TOKEN_TRUE", "TOKEN_VAR", "TOKEN_WHILE",
+    "TOKEN_SPAWN", "TOKEN_YIELD", "TOKEN_JOIN", "TOKEN_SEND", "TOKEN_RECEIVE",
 
     "TOKEN_ERROR", "TOKEN_EOF", "TOKEN_DUMMY"
 };
 
-void initScanner(const char* source)
+static bool refillBuffer(Scanner* scanner);
+static const char* copyLexeme(Scanner* scanner, const char* start, int length);
+
+void initScannerWith(Scanner* scanner, const char* source, size_t length)
+{
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + length;
+    scanner->line = 0;
+    scanner->offset = 0;
+    scanner->fd = -1;
+    scanner->eof = true;
+    scanner->overflow = false;
+    scanner->allocator = NULL;
+    scanner->buffer = NULL;
+    scanner->lexemes = NULL;
+    scanner->lexemeHalf = 0;
+    scanner->lexemeCount = 0;
+}
+
+void initScannerStreamWith(Scanner* scanner, int fd, Allocator* allocator)
+{
+    initScannerWith(scanner, NULL, 0);
+    scanner->fd = fd;
+    scanner->eof = false;
+    scanner->allocator = allocator;
+    scanner->buffer = reallocateWith(allocator, MEM_SCANNER, NULL, 0, SCANNER_BUFFER_SIZE);
+    scanner->lexemes = reallocateWith(allocator, MEM_SCANNER, NULL, 0, 2 * SCANNER_BUFFER_SIZE);
+    scanner->start = scanner->buffer;
+    scanner->current = scanner->buffer;
+    scanner->end = scanner->buffer;
+}
+
+void freeScannerWith(Scanner* scanner)
+{
+    if (scanner->fd != -1)
+    {
+        reallocateWith(scanner->allocator, MEM_SCANNER, scanner->buffer, SCANNER_BUFFER_SIZE, 0);
+        reallocateWith(scanner->allocator, MEM_SCANNER, scanner->lexemes, 2 * SCANNER_BUFFER_SIZE, 0);
+    }
+    initScannerWith(scanner, NULL, 0);
+}
+
+void initScanner(const char* source, size_t length)
+{
+    initScannerWith(&defaultScanner, source, length);
+}
+
+void initScannerStream(int fd)
 {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 0;
-    scanner.offset = 0;
+    initScannerStreamWith(&defaultScanner, fd, &defaultAllocator);
+}
+
+void freeScanner()
+{
+    freeScannerWith(&defaultScanner);
 }
 
 Token scanToken()
+{
+    return scanTokenWith(&defaultScanner);
+}
+
+/*
+    Slide the token in progress (scanner->start onwards) to the front of the buffer and read() behind it.
+    Returns false at EOF, on a read error, or when the token already fills the whole buffer
+*/
+static bool refillBuffer(Scanner* scanner)
+{
+    if (scanner->eof)
+    {
+        return false;
+    }
+
+    size_t keep = (size_t)(scanner->end - scanner->start);
+    if (keep == SCANNER_BUFFER_SIZE)
+    {
+        scanner->overflow = true;
+        return false;
+    }
+
+    size_t shift = (size_t)(scanner->start - scanner->buffer);
+    if (shift > 0)
+    {
+        memmove(scanner->buffer, scanner->start, keep);
+        scanner->start -= shift;
+        scanner->current -= shift;
+        scanner->end -= shift;
+    }
+
+    while (1)
+    {
+        ssize_t bytesRead = read(scanner->fd, scanner->buffer + keep, SCANNER_BUFFER_SIZE - keep);
+        if (bytesRead > 0)
+        {
+            scanner->end += bytesRead;
+            return true;
+        }
+        if (bytesRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        /* EOF, or an error we treat like one */
+        scanner->eof = true;
+        return false;
+    }
+}
+
+/*
+    The parser holds at most two tokens (previous and current), so two halves are enough:
+    when a lexeme doesn't fit in the active half we flip to the other one, which only holds tokens
+    older than the last one we returned
+*/
+static const char* copyLexeme(Scanner* scanner, const char* start, int length)
+{
+    if (scanner->lexemeCount + (size_t)length > SCANNER_BUFFER_SIZE)
+    {
+        scanner->lexemeHalf = 1 - scanner->lexemeHalf;
+        scanner->lexemeCount = 0;
+    }
+
+    char* lexeme = scanner->lexemes + scanner->lexemeHalf * SCANNER_BUFFER_SIZE + scanner->lexemeCount;
+    memcpy(lexeme, start, length);
+    scanner->lexemeCount += length;
+    return lexeme;
+}
+
+Token scanTokenWith(Scanner* scanner)
 {
     // printf("%s\n", __func__);
     /* Update state for WhiteSpaces and NewLines */
-    processNLWSC();
+    processNLWSC(scanner);
 
     /* At this point, current points to the first non-wsnl char */
-    scanner.start = scanner.current;
-    int offset = scanner.offset;
-    int line = scanner.line;
+    scanner->start = scanner->current;
+    int offset = scanner->offset;
+    int line = scanner->line;
 
-    if (isAtEnd())
+    if (isAtEnd(scanner))
     {
-        return makeToken(TOKEN_EOF, offset, line);
+        return makeToken(scanner, TOKEN_EOF, offset, line);
     }
     /* Note that we increment current pointer immedaitely after the read */
-    char firstChar = (char)(*(scanner.current));
+    char firstChar = (char)(*(scanner->current));
     
     /* Check for numericals */
     if (isNumerical(firstChar))
     {
-        return processNumerical(offset, line);
+        return processNumerical(scanner, offset, line);
     }
     /* Check for identifiers and keywords*/
     else if (isAlpha(firstChar))
     {
-        return processIdent(offset, line);
+        return processIdent(scanner, offset, line);
     }
     else
     {
         /* Default mode is to advance(), whic processNumerical() and processIdent() already take care of */
-        advance();
+        advance(scanner);
     }
 
     switch (firstChar)
     {
         case '(':
         {
-            return makeToken(TOKEN_LEFT_PAREN, offset, line);
+            return makeToken(scanner, TOKEN_LEFT_PAREN, offset, line);
         }
         case ')':
         {
-            return makeToken(TOKEN_RIGHT_PAREN, offset, line);
+            return makeToken(scanner, TOKEN_RIGHT_PAREN, offset, line);
         }
         case '{':
         {
-            return makeToken(TOKEN_LEFT_BRACE, offset, line);
+            return makeToken(scanner, TOKEN_LEFT_BRACE, offset, line);
         }
         case '}':
         {
-            return makeToken(TOKEN_RIGHT_BRACE, offset, line);
+            return makeToken(scanner, TOKEN_RIGHT_BRACE, offset, line);
         }
         case ',':
         {
-            return makeToken(TOKEN_COMMA, offset, line);
+            return makeToken(scanner, TOKEN_COMMA, offset, line);
         }
         case '.':
         {
-            return makeToken(TOKEN_DOT, offset, line);
+            return makeToken(scanner, TOKEN_DOT, offset, line);
         }
         case '-':
         {
-            return makeToken(TOKEN_MINUS, offset, line);
+            return makeToken(scanner, TOKEN_MINUS, offset, line);
         }
         case '+':
         {
-            return makeToken(TOKEN_PLUS, offset, line);
+            return makeToken(scanner, TOKEN_PLUS, offset, line);
         }
         case ';':
         {
-            return makeToken(TOKEN_SEMICOLON, offset, line);
+            return makeToken(scanner, TOKEN_SEMICOLON, offset, line);
         }
         case '/':
         {
-            return makeToken(TOKEN_SLASH, offset, line);
+            return makeToken(scanner, TOKEN_SLASH, offset, line);
         }
         case '*':
         {
-            return makeToken(TOKEN_STAR, offset, line);
+            return makeToken(scanner, TOKEN_STAR, offset, line);
         }
         case '"':
         {
@@ -135,90 +254,115 @@ Token scanToken()
                 - Multiple line string literal
             */
             /* Empty string */
-            if (*(scanner.current) == '"')
+            if (currentChar(scanner) == '"')
             {
-                advance();
+                advance(scanner);
             }
             /* Non-empty strings */
             else 
             {
-                while (peekChar() != '"')
+                while (peekChar(scanner) != '"')
                 {
-                    advance();
-                    if (isAtEnd())
+                    advance(scanner);
+                    if (isAtEnd(scanner))
                     {
                         printf("Error: Cannot locate end quote for string literal\n");
-                        return makeToken(TOKEN_ERROR, offset, line);
+                        return makeToken(scanner, TOKEN_ERROR, offset, line);
                     }
                 }
-                advance();  /* @ closing quote */
-                advance();
+                advance(scanner);  /* @ closing quote */
+                advance(scanner);
             }
-            return makeToken(TOKEN_STRING, offset, line);
+            return makeToken(scanner, TOKEN_STRING, offset, line);
 
         }
         default:
         {
             /* TODO: Think how do we architecture the codebase so that we can call panic() here */
-            return makeToken(TOKEN_ERROR, offset, line);
+            return makeToken(scanner, TOKEN_ERROR, offset, line);
         }
     }
 }
 
-Token makeToken(TokenType type, int offset, int line)
+Token makeToken(Scanner* scanner, TokenType type, int offset, int line)
 {
     // printf("%s\n", __func__);
     Token t;
     t.type = type;
-    t.start = scanner.start;
-    t.length = (int)(scanner.current - scanner.start);
+    t.start = scanner->start;
+    t.length = (int)(scanner->current - scanner->start);
     t.line = line;
     t.offset = offset;
 
+    if (scanner->overflow)
+    {
+        /* Drop what we have of the token, the rest of it gets scanned as garbage after the error */
+        scanner->overflow = false;
+        scanner->start = scanner->current;
+        t.type = TOKEN_ERROR;
+        t.start = "Token too long for the scanner buffer";
+        t.length = (int)strlen(t.start);
+        return t;
+    }
+
+    if (scanner->fd != -1)
+    {
+        /* The buffer will be overwritten by the next refill */
+        t.start = copyLexeme(scanner, t.start, t.length);
+    }
+
     return t;
 }
 
-bool isAtEnd()
+bool isAtEnd(Scanner* scanner)
 {
     // printf("%s\n", __func__);
-    return (*(scanner.current) == '\0');
+    if (scanner->current < scanner->end)
+    {
+        return false;
+    }
+    /* Streaming: the window ran out, but the input might not have */
+    return !refillBuffer(scanner);
 }
 
 /* Dealing with newline, whitespaces and comments */
-void processNLWSC()
+void processNLWSC(Scanner* scanner)
 {
     while (1)
     {
-        char currentChar = *(scanner.current);
-        // printf("Current Char -> %c, %d\n", currentChar, (int)currentChar);
-        switch (currentChar)
+        /* Whitespaces and comments are not part of any token, so a refill may drop them */
+        scanner->start = scanner->current;
+        if (isAtEnd(scanner))
+        {
+            return;
+        }
+        char c = currentChar(scanner);
+        // printf("Current Char -> %c, %d\n", c, (int)c);
+        switch (c)
         {
-            case 'q':
-            {
-                exit(0);
-            }
             case '\n':
             {
-                advance();
+                advance(scanner);
                 break;
             }
             case ' ':
             case '\r':
             case '\t':
             {
-                advance();
+                advance(scanner);
                 break;
             }
             case '/':
             {
-                if (peekChar() == '/')
+                if (peekChar(scanner) == '/')
                 {
                     /* Skip to the next line */
-                    while (*(scanner.current) != '\n' && (!isAtEnd()))
+                    while ((!isAtEnd(scanner)) && *(scanner->current) != '\n')
                     {
-                        // printf("Skipping: %c\n", *(scanner.current));
-                        scanner.current ++;
-                        scanner.offset ++;
+                        // printf("Skipping: %c\n", *(scanner->current));
+                        scanner->current ++;
+                        scanner->offset ++;
+                        scanner->start = scanner->current;
                     }
                     /* Now current points to '\n' which will be dealt by next loop */
                 }
@@ -236,25 +380,44 @@ void processNLWSC()
     }
 }
 
+/* Return the char under the current pointer, '\0' once we run off the end */
+char currentChar(Scanner* scanner)
+{
+    if (isAtEnd(scanner))
+    {
+        return '\0';
+    }
+    return *(scanner->current);
+}
+
 /* Return the next char without moving the current pointer */
 
-char peekChar()
+char peekChar(Scanner* scanner)
 {
-    return *(scanner.current + 1);
+    if (scanner->current + 1 >= scanner->end && !refillBuffer(scanner))
+    {
+        return '\0';
+    }
+    return *(scanner->current + 1);
 }
 
-static void advance()
+static void advance(Scanner* scanner)
 {
-    if (*(scanner.current) == '\n')
+    if (isAtEnd(scanner))
     {
-        scanner.offset = 0;
-        scanner.line += 1;
+        /* Never walk past the end of the source, there might not be a '\0' there */
+        return;
+    }
+    if (*(scanner->current) == '\n')
+    {
+        scanner->offset = 0;
+        scanner->line += 1;
     }
     else 
     {
-        scanner.offset ++;
+        scanner->offset ++;
     }
-    scanner.current ++;
+    scanner->current ++;
 }
 
 bool isNumerical(char c)
@@ -262,27 +425,27 @@ bool isNumerical(char c)
     return ((c >= '0') && (c <= '9'));
 }
 
-Token processNumerical(int offset, int line)
+Token processNumerical(Scanner* scanner, int offset, int line)
 {
     /* We first exhaust all numbers, and then find a decimal point, if found we again exhaust all numbers */
-    while (isNumerical(peekChar()))
+    while (isNumerical(peekChar(scanner)))
     {
-        advance();
+        advance(scanner);
     }
 
-    if (peekChar() == '.')
+    if (peekChar(scanner) == '.')
     {
-        advance();
-        while (isNumerical(peekChar()))
+        advance(scanner);
+        while (isNumerical(peekChar(scanner)))
         {
-            advance();
+            advance(scanner);
         }
     }
 
     /* Make sure current char points to the first non-numerical char */
-    advance();
+    advance(scanner);
 
-    return makeToken(TOKEN_NUMBER, offset, line);
+    return makeToken(scanner, TOKEN_NUMBER, offset, line);
 }
 
 bool isAlpha(char c)
@@ -290,145 +453,174 @@ bool isAlpha(char c)
     return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '_'));
 }
 
-Token processIdent(int offset, int line)
+Token processIdent(Scanner* scanner, int offset, int line)
 {
     /* once the first char is confirmed, the rest can be numerical or alpha or underscore, like a123_45z */
-    while (isNumerical(peekChar()) || isAlpha(peekChar()))
+    while (isNumerical(peekChar(scanner)) || isAlpha(peekChar(scanner)))
     {
-        advance();
+        advance(scanner);
     }
 
     /* Make sure current char points to the first non-numerical char */
-    advance();
+    advance(scanner);
 
     /* Check for keywords */
 
-    char leadingChar = *(scanner.start);
-    int len = scanner.current - scanner.start;
+    char leadingChar = *(scanner->start);
+    int len = scanner->current - scanner->start;
     switch(leadingChar)
     {
         case 'a':
         {
-            if (scanner.current - scanner.start == strlen("and") && memcmp(scanner.start, "and", strlen("and")) == 0)
+            if (scanner->current - scanner->start == strlen("and") && memcmp(scanner->start, "and", strlen("and")) == 0)
             {
-                return makeToken(TOKEN_AND, offset, line);;
+                return makeToken(scanner, TOKEN_AND, offset, line);;
             }
             break;
         }
         case 'c':
         {
-            if (scanner.current - scanner.start == strlen("class") && memcmp(scanner.start, "class", strlen("class")) == 0)
+            if (scanner->current - scanner->start == strlen("class") && memcmp(scanner->start, "class", strlen("class")) == 0)
             {
-                return makeToken(TOKEN_CLASS, offset, line);;
+                return makeToken(scanner, TOKEN_CLASS, offset, line);;
             }
             break;
         }
         case 'e':
         {
-            if (scanner.current - scanner.start == strlen("else") && memcmp(scanner.start, "else", strlen("else")) == 0)
+            if (scanner->current - scanner->start == strlen("else") && memcmp(scanner->start, "else", strlen("else")) == 0)
             {
-                return makeToken(TOKEN_ELSE, offset, line);;
+                return makeToken(scanner, TOKEN_ELSE, offset, line);;
             }
             break;
         }
         case 'f':
         {
-            if (scanner.current - scanner.start == strlen("for") && memcmp(scanner.start, "for", strlen("for")) == 0)
+            if (scanner->current - scanner->start == strlen("for") && memcmp(scanner->start, "for", strlen("for")) == 0)
             {
-                return makeToken(TOKEN_FOR, offset, line);;
+                return makeToken(scanner, TOKEN_FOR, offset, line);;
             }
-            if (scanner.current - scanner.start == strlen("fun") && memcmp(scanner.start, "fun", strlen("fun")) == 0)
+            if (scanner->current - scanner->start == strlen("fun") && memcmp(scanner->start, "fun", strlen("fun")) == 0)
             {
-                return makeToken(TOKEN_FUN, offset, line);;
+                return makeToken(scanner, TOKEN_FUN, offset, line);;
             }
-            if (scanner.current - scanner.start == strlen("false") && memcmp(scanner.start, "false", strlen("false")) == 0)
+            if (scanner->current - scanner->start == strlen("false") && memcmp(scanner->start, "false", strlen("false")) == 0)
             {
-                return makeToken(TOKEN_FALSE, offset, line);;
+                return makeToken(scanner, TOKEN_FALSE, offset, line);;
             }
             break;
         }
         case 'i':
         {
-            if (scanner.current - scanner.start == strlen("if") && memcmp(scanner.start, "if", strlen("if")) == 0)
+            if (scanner->current - scanner->start == strlen("if") && memcmp(scanner->start, "if", strlen("if")) == 0)
             {
-                return makeToken(TOKEN_IF, offset, line);;
+                return makeToken(scanner, TOKEN_IF, offset, line);;
+            }
+            break;
+        }
+        case 'j':
+        {
+            if (scanner->current - scanner->start == strlen("join") && memcmp(scanner->start, "join", strlen("join")) == 0)
+            {
+                return makeToken(scanner, TOKEN_JOIN, offset, line);
             }
             break;
         }
         case 'n':
         {
-            if (scanner.current - scanner.start == strlen("nil") && memcmp(scanner.start, "nil", strlen("nil")) == 0)
+            if (scanner->current - scanner->start == strlen("nil") && memcmp(scanner->start, "nil", strlen("nil")) == 0)
             {
-                return makeToken(TOKEN_NIL, offset, line);;
+                return makeToken(scanner, TOKEN_NIL, offset, line);;
             }
             break;
         }
         case 'o':
         {
-            if (scanner.current - scanner.start == strlen("or") && memcmp(scanner.start, "or", strlen("or")) == 0)
+            if (scanner->current - scanner->start == strlen("or") && memcmp(scanner->start, "or", strlen("or")) == 0)
             {
-                return makeToken(TOKEN_OR, offset, line);;
+                return makeToken(scanner, TOKEN_OR, offset, line);;
             }
             break;
         }
         case 'p':
         {
-            if (scanner.current - scanner.start == strlen("print") && memcmp(scanner.start, "print", strlen("print")) == 0)
+            if (scanner->current - scanner->start == strlen("print") && memcmp(scanner->start, "print", strlen("print")) == 0)
             {
-                return makeToken(TOKEN_PRINT, offset, line);;
+                return makeToken(scanner, TOKEN_PRINT, offset, line);;
             }
             break;
         }
         case 'r':
         {
-            if (scanner.current - scanner.start == strlen("return") && memcmp(scanner.start, "return", strlen("return")) == 0)
+            if (scanner->current - scanner->start == strlen("return") && memcmp(scanner->start, "return", strlen("return")) == 0)
             {
-                return makeToken(TOKEN_RETURN, offset, line);;
+                return makeToken(scanner, TOKEN_RETURN, offset, line);;
+            }
+            if (scanner->current - scanner->start == strlen("receive") && memcmp(scanner->start, "receive", strlen("receive")) == 0)
+            {
+                return makeToken(scanner, TOKEN_RECEIVE, offset, line);
             }
             break;
         }
         case 's':
         {
-            if (scanner.current - scanner.start == strlen("super") && memcmp(scanner.start, "super", strlen("super")) == 0)
+            if (scanner->current - scanner->start == strlen("super") && memcmp(scanner->start, "super", strlen("super")) == 0)
+            {
+                return makeToken(scanner, TOKEN_RETURN, offset, line);;
+            }
+            if (scanner->current - scanner->start == strlen("spawn") && memcmp(scanner->start, "spawn", strlen("spawn")) == 0)
+            {
+                return makeToken(scanner, TOKEN_SPAWN, offset, line);
+            }
+            if (scanner->current - scanner->start == strlen("send") && memcmp(scanner->start, "send", strlen("send")) == 0)
             {
-                return makeToken(TOKEN_RETURN, offset, line);;
+                return makeToken(scanner, TOKEN_SEND, offset, line);
             }
             break;
         }
         case 't':
         {
-            if (scanner.current - scanner.start == strlen("this") && memcmp(scanner.start, "this", strlen("this")) == 0)
+            if (scanner->current - scanner->start == strlen("this") && memcmp(scanner->start, "this", strlen("this")) == 0)
             {
-                return makeToken(TOKEN_RETURN, offset, line);;
+                return makeToken(scanner, TOKEN_RETURN, offset, line);;
             }
-            if (scanner.current - scanner.start == strlen("true") && memcmp(scanner.start, "true", strlen("true")) == 0)
+            if (scanner->current - scanner->start == strlen("true") && memcmp(scanner->start, "true", strlen("true")) == 0)
             {
-                return makeToken(TOKEN_TRUE, offset, line);;
+                return makeToken(scanner, TOKEN_TRUE, offset, line);;
             }
             break;
         }
         case 'v':
         {
-            if (scanner.current - scanner.start == strlen("var") && memcmp(scanner.start, "var", strlen("var")) == 0)
+            if (scanner->current - scanner->start == strlen("var") && memcmp(scanner->start, "var", strlen("var")) == 0)
             {
-                return makeToken(TOKEN_VAR, offset, line);;
+                return makeToken(scanner, TOKEN_VAR, offset, line);;
             }
             break;
         }
         case 'w':
         {
-            if (scanner.current - scanner.start == strlen("while") && memcmp(scanner.start, "while", strlen("while")) == 0)
+            if (scanner->current - scanner->start == strlen("while") && memcmp(scanner->start, "while", strlen("while")) == 0)
+            {
+                return makeToken(scanner, TOKEN_WHILE, offset, line);;
+            }
+            break;
+        }
+        case 'y':
+        {
+            if (scanner->current - scanner->start == strlen("yield") && memcmp(scanner->start, "yield", strlen("yield")) == 0)
             {
-                return makeToken(TOKEN_WHILE, offset, line);;
+                return makeToken(scanner, TOKEN_YIELD, offset, line);
             }
             break;
         }
         default:
         {
-            return makeToken(TOKEN_IDENTIFIER, offset, line);
             break;
         }
     }
+    /* Not a keyword after all, e.g. "a" or "foo" */
+    return makeToken(scanner, TOKEN_IDENTIFIER, offset, line);
 }
 
 void dumpToken(Token t, const char* source)
@@ -1,8 +1,14 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "common.h"
+#include "memory.h"
+
 #define SCANNER_INFO_VERBOSE true
 
+/* Window size for streaming mode, also the longest token we can scan from a stream */
+#define SCANNER_BUFFER_SIZE 0x10000
+
 typedef enum {
     /* Single-character tokens */
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
@@ -22,6 +28,7 @@ typedef enum {
     TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
     TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
     TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
+    TOKEN_SPAWN, TOKEN_YIELD, TOKEN_JOIN, TOKEN_SEND, TOKEN_RECEIVE,
 
     TOKEN_ERROR, TOKEN_EOF, TOKEN_DUMMY
 } TokenType;
@@ -36,30 +43,77 @@ typedef struct
     int offset; /* line and offset are both for debugging */
 } Token;
 
-void initScanner(const char* source);
+/* All of the scanner's state, one per compile, so any number can scan at once */
+typedef struct
+{
+    const char* start;
+    const char* current;
+    /* One past the last char of the source, there is no '\0' to look for */
+    const char* end;
+    int line;
+    int offset; /* for debugging, we need to know the offset from the beginning of the line */
+
+    /*
+        Streaming mode (initScannerStreamWith()), fd is -1 for in-memory sources
+        buffer holds a window of the input, refillBuffer() slides the unfinished token to the front and reads more,
+        so a token is always contiguous in the buffer
+    */
+    int fd;
+    bool eof;
+    /* The current token does not fit into the buffer */
+    bool overflow;
+    /* Buffer and lexemes come from here */
+    Allocator* allocator;
+    char* buffer;
+    /*
+        Lexemes have to outlive the window (the parser keeps previous and current tokens around),
+        so they are copied into one of two halves of this arena. See copyLexeme()
+    */
+    char* lexemes;
+    int lexemeHalf;
+    size_t lexemeCount;
+} Scanner;
+
+/*
+    source does NOT need to be NUL-terminated (e.g. it can be a read-only mmap of a script),
+    the scanner stops at source + length
+*/
+void initScannerWith(Scanner* scanner, const char* source, size_t length);
+/*
+    Scan straight from a file descriptor (pipes, stdin) through a fixed window of SCANNER_BUFFER_SIZE bytes,
+    so memory use does not depend on the size of the input. Call freeScannerWith() when done
+*/
+void initScannerStreamWith(Scanner* scanner, int fd, Allocator* allocator);
+void freeScannerWith(Scanner* scanner);
+Token scanTokenWith(Scanner* scanner);
+Token makeToken(Scanner* scanner, TokenType type, int offset, int line);
+
+/* The old single-scanner API, on a scanner of its own (stream buffers from the default allocator) */
+void initScanner(const char* source, size_t length);
+void initScannerStream(int fd);
+void freeScanner();
 Token scanToken();
-Token makeToken(TokenType type, int offset, int line);
 
 /* Dealing with EOF */
-bool isAtEnd();
+bool isAtEnd(Scanner* scanner);
 
 /* 
     Dealing with newline, whitespaces and comments
     NOTE: You have to use one function to deal with both,
     otherwise things like <WH><NL><WH> is going to break
 */
-void processNLWSC();
+void processNLWSC(Scanner* scanner);
 
-char peekChar();
-static void advance();
+char currentChar(Scanner* scanner);
+char peekChar(Scanner* scanner);
 
 /* Dealing with numericals */
 bool isNumerical(char c);
-Token processNumerical(int offset, int line);
+Token processNumerical(Scanner* scanner, int offset, int line);
 
 /* Dealing with variables +  */
 bool isAlpha(char c);
-Token processIdent(int offset, int line);
+Token processIdent(Scanner* scanner, int offset, int line);
 
 /* Debugging */
 void dumpToken(Token t, const char* source);
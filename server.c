@@ -0,0 +1,482 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "compiler.h"
+#include "frozen.h"
+#include "hash.h"
+#include "server.h"
+#include "vm.h"
+
+/* Bytes of a request header after its length field */
+#define HEADER_REST (sizeof(RequestHeader) - sizeof(uint32_t))
+
+typedef struct Server Server;
+
+/* Shared by its reader thread and every request still in flight, the last one closes it */
+typedef struct
+{
+    Server* server;
+    int fd;
+    atomic_int refCount;
+    /* Workers answer in any order, one response at a time */
+    pthread_mutex_t writeLock;
+} Connection;
+
+typedef struct
+{
+    Connection* connection;
+    RequestHeader header;
+    double args[SERVER_MAX_ARGS];
+    char* source;
+    size_t sourceLength;
+    uint64_t enqueuedNs;
+} Request;
+
+typedef struct
+{
+    uint64_t id;
+    FrozenChunk* frozen;
+} Script;
+
+struct Server
+{
+    /* Ring of waiting requests */
+    Request* queue[SERVER_QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_mutex_t queueLock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    /* Compiled scripts by id, open addressing, kept at most half full */
+    Script scripts[SERVER_SCRIPT_CACHE];
+    int scriptCount;
+    pthread_mutex_t scriptLock;
+    /* Bumped whenever the cache is dropped, workers then let go of the chunks they hold too */
+    atomic_uint epoch;
+
+    atomic_ullong requests;
+    atomic_ullong failed;
+};
+
+static const char* argNames[SERVER_MAX_ARGS] = {
+    "arg0", "arg1", "arg2", "arg3", "arg4", "arg5", "arg6", "arg7",
+    "arg8", "arg9", "arg10", "arg11", "arg12", "arg13", "arg14", "arg15"
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static uint64_t nowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static bool readFully(int fd, void* buffer, size_t length)
+{
+    char* bytes = buffer;
+    while (length > 0)
+    {
+        ssize_t got = read(fd, bytes, length);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        bytes += got;
+        length -= (size_t)got;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void* buffer, size_t length)
+{
+    const char* bytes = buffer;
+    while (length > 0)
+    {
+        /* A client that went away must not kill the server with SIGPIPE */
+        ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+static void releaseConnection(Connection* connection)
+{
+    if (atomic_fetch_sub(&(connection->refCount), 1) == 1)
+    {
+        close(connection->fd);
+        pthread_mutex_destroy(&(connection->writeLock));
+        free(connection);
+    }
+}
+
+static void freeRequest(Request* request)
+{
+    releaseConnection(request->connection);
+    free(request->source);
+    free(request);
+}
+
+/* Blocks while the queue is full: the reader stops reading, the socket fills up, the client slows down */
+static void pushRequest(Server* server, Request* request)
+{
+    pthread_mutex_lock(&(server->queueLock));
+    while (server->count == SERVER_QUEUE_SIZE)
+    {
+        pthread_cond_wait(&(server->notFull), &(server->queueLock));
+    }
+    server->queue[(server->head + server->count) % SERVER_QUEUE_SIZE] = request;
+    server->count++;
+    pthread_cond_signal(&(server->notEmpty));
+    pthread_mutex_unlock(&(server->queueLock));
+}
+
+static Request* popRequest(Server* server)
+{
+    pthread_mutex_lock(&(server->queueLock));
+    while (server->count == 0)
+    {
+        pthread_cond_wait(&(server->notEmpty), &(server->queueLock));
+    }
+    Request* request = server->queue[server->head];
+    server->head = (server->head + 1) % SERVER_QUEUE_SIZE;
+    server->count--;
+    pthread_cond_signal(&(server->notFull));
+    pthread_mutex_unlock(&(server->queueLock));
+    return request;
+}
+
+static Script* findScript(Server* server, uint64_t id)
+{
+    uint32_t index = (uint32_t)id & (SERVER_SCRIPT_CACHE - 1);
+    while (server->scripts[index].frozen != NULL && server->scripts[index].id != id)
+    {
+        index = (index + 1) & (SERVER_SCRIPT_CACHE - 1);
+    }
+    return &(server->scripts[index]);
+}
+
+/* The script under id with a reference for the caller, or NULL */
+static FrozenChunk* lookupScript(Server* server, uint64_t id)
+{
+    pthread_mutex_lock(&(server->scriptLock));
+    Script* script = findScript(server, id);
+    FrozenChunk* frozen = script->frozen != NULL ? retainFrozenChunk(script->frozen) : NULL;
+    pthread_mutex_unlock(&(server->scriptLock));
+    return frozen;
+}
+
+/* Keeps frozen under id unless another worker got there first, either way the caller gets the one that stays */
+static FrozenChunk* storeScript(Server* server, uint64_t id, FrozenChunk* frozen)
+{
+    pthread_mutex_lock(&(server->scriptLock));
+    Script* script = findScript(server, id);
+    if (script->frozen == NULL)
+    {
+        if (server->scriptCount + 1 > SERVER_SCRIPT_CACHE / 2)
+        {
+            /* Full: start over, running requests hold references of their own */
+            for (int i = 0; i < SERVER_SCRIPT_CACHE; i++)
+            {
+                if (server->scripts[i].frozen != NULL)
+                {
+                    releaseFrozenChunk(server->scripts[i].frozen);
+                    server->scripts[i].frozen = NULL;
+                }
+            }
+            server->scriptCount = 0;
+            atomic_fetch_add(&(server->epoch), 1);
+            script = findScript(server, id);
+        }
+        script->id = id;
+        script->frozen = retainFrozenChunk(frozen);
+        server->scriptCount++;
+    }
+    else
+    {
+        releaseFrozenChunk(frozen);
+        frozen = retainFrozenChunk(script->frozen);
+    }
+    pthread_mutex_unlock(&(server->scriptLock));
+    return frozen;
+}
+
+static ResponseStatus handleRequest(Server* server, VM* vm, Request* request, uint64_t* scriptId)
+{
+    FrozenChunk* frozen = NULL;
+    if (request->header.kind == REQUEST_SCRIPT)
+    {
+        *scriptId = request->header.scriptId;
+        frozen = lookupScript(server, *scriptId);
+        if (frozen == NULL)
+        {
+            return RESPONSE_UNKNOWN_SCRIPT;
+        }
+    }
+    else if (request->header.kind == REQUEST_SOURCE)
+    {
+        *scriptId = hashBytes(request->source, request->sourceLength, 0);
+        frozen = lookupScript(server, *scriptId);
+        if (frozen == NULL)
+        {
+            /* First time: compile in the arena, freeze, and share it with the other workers */
+            Chunk chunk;
+            initChunkWith(&chunk, &(vm->compileArena.allocator));
+            Compiler compiler;
+            if (compileSlotsWith(&compiler, vm, request->source, request->sourceLength,
+                                 argNames, SERVER_MAX_ARGS, &chunk))
+            {
+                frozen = freezeChunk(vm, &chunk);
+            }
+            resetArena(&(vm->compileArena));
+            if (frozen == NULL)
+            {
+                printErrorWith(vm, &(vm->out));
+                return RESPONSE_COMPILE_ERROR;
+            }
+            frozen = storeScript(server, *scriptId, frozen);
+        }
+    }
+    else
+    {
+        return RESPONSE_BAD_REQUEST;
+    }
+
+    for (int i = 0; i < SERVER_MAX_ARGS; i++)
+    {
+        vm->slots[i] = NUMBER_VAL(i < request->header.argCount ? request->args[i] : 0);
+    }
+    InterpreterResult result = runFrozenChunkWith(vm, frozen);
+    releaseFrozenChunk(frozen);
+    if (result == INTERPRET_OK)
+    {
+        printValue(vm, &(vm->out), vm->result);
+    }
+    /* The result may be a string of a chunk that is about to go */
+    vm->result = NUMBER_VAL(0);
+    return result == INTERPRET_OK ? RESPONSE_OK : RESPONSE_RUNTIME_ERROR;
+}
+
+static void* work(void* argument)
+{
+    Server* server = argument;
+
+    /* Warm before the first request: stack, heap and output are set up once and reused */
+    VM vm;
+    initVMWith(&vm);
+    Value slots[SERVER_MAX_ARGS];
+    vm.slots = slots;
+    vm.slotCount = SERVER_MAX_ARGS;
+    char* output = NULL;
+    size_t outputLength = 0;
+    FILE* stream = open_memstream(&output, &outputLength);
+    if (stream == NULL)
+    {
+        fprintf(stderr, "Out of memory starting a worker.\n");
+        return NULL;
+    }
+    initOutput(&(vm.out), stream);
+    unsigned epoch = atomic_load(&(server->epoch));
+
+    while (1)
+    {
+        Request* request = popRequest(server);
+        uint64_t start = nowNs();
+
+        if (atomic_load(&(server->epoch)) != epoch)
+        {
+            /* The shared cache was dropped, so let go of this VM's references too */
+            epoch = atomic_load(&(server->epoch));
+            freeFrozenTable(&vm, &(vm.frozenChunks));
+        }
+
+        /* Rewinding keeps the stream's buffer, the output of the last request is simply overwritten */
+        fseeko(stream, 0, SEEK_SET);
+        uint64_t scriptId = 0;
+        ResponseStatus status = handleRequest(server, &vm, request, &scriptId);
+        flushOutput(&(vm.out));
+        /* The error message of a failed request is its output too */
+        bool hasOutput = status == RESPONSE_OK || status == RESPONSE_COMPILE_ERROR || status == RESPONSE_RUNTIME_ERROR;
+        size_t resultLength = hasOutput ? outputLength : 0;
+
+        ResponseHeader header;
+        memset(&header, 0, sizeof(ResponseHeader));
+        header.length = (uint32_t)(sizeof(ResponseHeader) - sizeof(uint32_t) + resultLength);
+        header.requestId = request->header.requestId;
+        header.scriptId = scriptId;
+        header.queueNs = start - request->enqueuedNs;
+        header.runNs = nowNs() - start;
+        header.status = (uint8_t)status;
+
+        Connection* connection = request->connection;
+        pthread_mutex_lock(&(connection->writeLock));
+        if (writeFully(connection->fd, &header, sizeof(ResponseHeader)))
+        {
+            writeFully(connection->fd, output, resultLength);
+        }
+        pthread_mutex_unlock(&(connection->writeLock));
+
+        atomic_fetch_add(&(server->requests), 1);
+        if (status != RESPONSE_OK)
+        {
+            atomic_fetch_add(&(server->failed), 1);
+        }
+        freeRequest(request);
+
+        if (vm.error.kind == ERROR_OUT_OF_MEMORY)
+        {
+            /* Can't be trusted anymore, a fresh VM is still far cheaper than a fresh process */
+            freeVMWith(&vm);
+            initVMWith(&vm);
+            vm.slots = slots;
+            vm.slotCount = SERVER_MAX_ARGS;
+            initOutput(&(vm.out), stream);
+        }
+    }
+    return NULL;
+}
+
+static void* readConnection(void* argument)
+{
+    Connection* connection = argument;
+    Server* server = connection->server;
+
+    while (1)
+    {
+        RequestHeader header;
+        if (!readFully(connection->fd, &header, sizeof(RequestHeader)))
+        {
+            break;
+        }
+        size_t argBytes = sizeof(double) * header.argCount;
+        if (header.length < HEADER_REST + argBytes || header.length > SERVER_MAX_FRAME ||
+            header.argCount > SERVER_MAX_ARGS)
+        {
+            fprintf(stderr, "--serve: malformed request, closing the connection.\n");
+            break;
+        }
+
+        Request* request = malloc(sizeof(Request));
+        request->header = header;
+        request->sourceLength = header.length - HEADER_REST - argBytes;
+        request->source = malloc(request->sourceLength > 0 ? request->sourceLength : 1);
+        if (!readFully(connection->fd, request->args, argBytes) ||
+            !readFully(connection->fd, request->source, request->sourceLength))
+        {
+            free(request->source);
+            free(request);
+            break;
+        }
+        atomic_fetch_add(&(connection->refCount), 1);
+        request->connection = connection;
+        request->enqueuedNs = nowNs();
+        pushRequest(server, request);
+    }
+
+    releaseConnection(connection);
+    return NULL;
+}
+
+static void stop(int number)
+{
+    (void)number;
+    stopping = 1;
+}
+
+int serve(const char* path, int workerCount)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    /* A socket left behind by an earlier run */
+    unlink(path);
+    if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+        listen(listener, SERVER_QUEUE_SIZE) == -1)
+    {
+        fprintf(stderr, "Could not listen on \"%s\".\n", path);
+        return 1;
+    }
+
+    /* No SA_RESTART, so accept() returns and we get to clean up */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    Server* server = calloc(1, sizeof(Server));
+    pthread_mutex_init(&(server->queueLock), NULL);
+    pthread_cond_init(&(server->notEmpty), NULL);
+    pthread_cond_init(&(server->notFull), NULL);
+    pthread_mutex_init(&(server->scriptLock), NULL);
+    for (int i = 0; i < workerCount; i++)
+    {
+        pthread_t thread;
+        pthread_create(&thread, NULL, work, server);
+        pthread_detach(thread);
+    }
+    fprintf(stderr, "--serve: listening on %s with %d workers\n", path, workerCount);
+
+    while (!stopping)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+        Connection* connection = malloc(sizeof(Connection));
+        connection->server = server;
+        connection->fd = fd;
+        atomic_init(&(connection->refCount), 1);
+        pthread_mutex_init(&(connection->writeLock), NULL);
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, readConnection, connection) != 0)
+        {
+            releaseConnection(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(listener);
+    unlink(path);
+    fprintf(stderr, "--serve: %llu requests, %llu failed\n",
+            (unsigned long long)atomic_load(&(server->requests)), (unsigned long long)atomic_load(&(server->failed)));
+    /* Workers may still be in the middle of a request, the server goes away with the process */
+    return 0;
+}
\ No newline at end of file
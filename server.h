@@ -0,0 +1,66 @@
+#ifndef clox_server_h
+#define clox_server_h
+
+#include "common.h"
+
+/* Requests accepted but not yet picked up by a worker, a full queue stops the readers */
+#define SERVER_QUEUE_SIZE       0x100
+/* Compiled scripts kept by id, the whole cache is dropped when it fills up */
+#define SERVER_SCRIPT_CACHE     0x1000
+/* Arguments bind to the inputs arg0 .. arg15, missing ones are 0 */
+#define SERVER_MAX_ARGS         16
+/* Anything longer closes the connection */
+#define SERVER_MAX_FRAME        0x100000
+
+/* What a request asks for */
+typedef enum
+{
+    /* Compile (or find in the cache) the source that follows the arguments and run it */
+    REQUEST_SOURCE,
+    /* Run the script compiled before under scriptId */
+    REQUEST_SCRIPT
+} RequestKind;
+
+typedef enum
+{
+    RESPONSE_OK,
+    RESPONSE_COMPILE_ERROR,
+    RESPONSE_RUNTIME_ERROR,
+    RESPONSE_UNKNOWN_SCRIPT,
+    RESPONSE_BAD_REQUEST
+} ResponseStatus;
+
+/*
+    Frames are native endian, length counts the bytes after the length field itself.
+    Request:  RequestHeader | double args[argCount] | source (REQUEST_SOURCE only)
+    Response: ResponseHeader | the result, printed like the CLI does, or for an error, what went wrong and where
+    Responses of one connection may come back in any order, requestId tells them apart
+*/
+typedef struct
+{
+    uint32_t length;
+    uint32_t requestId;
+    uint64_t scriptId;
+    uint8_t kind;
+    uint8_t argCount;
+    uint16_t reserved;
+    uint32_t reserved2;
+} RequestHeader;
+
+typedef struct
+{
+    uint32_t length;
+    uint32_t requestId;
+    /* Id to send REQUEST_SCRIPT with next time, the hash of the source */
+    uint64_t scriptId;
+    /* Time spent waiting in the queue, and compiling plus running */
+    uint64_t queueNs;
+    uint64_t runNs;
+    uint8_t status;
+    uint8_t reserved[7];
+} ResponseHeader;
+
+/* Listen on the Unix socket at path until SIGINT or SIGTERM, with workerCount warm VMs */
+int serve(const char* path, int workerCount);
+
+#endif
\ No newline at end of file
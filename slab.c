@@ -0,0 +1,312 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+static void* slabReallocate(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize);
+
+/* First object sits on a cache line boundary after the header */
+#define SLAB_HEADER_SIZE (((sizeof(Slab) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE)
+#define SLAB_OF(pointer) ((Slab*)((uintptr_t)(pointer) & ~(uintptr_t)(SLAB_SIZE - 1)))
+#define CLASS_OF(size) (((size) + 15) / 16 - 1)
+
+void initSlabAllocator(SlabAllocator* slabs, Allocator* parent)
+{
+    slabs->allocator.reallocate = slabReallocate;
+    slabs->allocator.userData = NULL;
+    memset(&(slabs->allocator.stats), 0, sizeof(MemoryStats));
+    slabs->parent = parent;
+    slabs->large = NULL;
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        slabs->classes[i].objectSize = (size_t)(i + 1) * 16;
+        slabs->classes[i].partial = NULL;
+        slabs->classes[i].full = NULL;
+    }
+    slabs->spare = NULL;
+    slabs->slabCount = 0;
+}
+
+/*
+    SLAB_SIZE-aligned mapping: map twice the size and trim both ends. Allocator can't align, so slabs don't come from
+    the parent, but they are counted in its stats like the large objects that do
+*/
+static Slab* mapSlab(SlabAllocator* slabs)
+{
+    char* region = mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+    {
+        return NULL;
+    }
+    char* aligned = (char*)(((uintptr_t)region + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (aligned > region)
+    {
+        munmap(region, aligned - region);
+    }
+    munmap(aligned + SLAB_SIZE, (region + 2 * SLAB_SIZE) - (aligned + SLAB_SIZE));
+    countMemory(slabs->parent, MEM_OBJECTS, 0, SLAB_SIZE);
+    slabs->slabCount++;
+    return (Slab*)aligned;
+}
+
+static void unmapSlab(SlabAllocator* slabs, Slab* slab)
+{
+    munmap(slab, SLAB_SIZE);
+    countMemory(slabs->parent, MEM_OBJECTS, SLAB_SIZE, 0);
+    slabs->slabCount--;
+}
+
+static void unlinkSlab(Slab** list, Slab* slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void pushSlab(Slab** list, Slab* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL)
+    {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+static Slab* newSlab(SlabAllocator* slabs, int classIndex)
+{
+    Slab* slab = slabs->spare;
+    if (slab != NULL)
+    {
+        slabs->spare = NULL;
+    }
+    else
+    {
+        slab = mapSlab(slabs);
+        if (slab == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    size_t objectSize = slabs->classes[classIndex].objectSize;
+    slab->next = NULL;
+    slab->prev = NULL;
+    slab->freeList = NULL;
+    slab->bump = (char*)slab + SLAB_HEADER_SIZE;
+    /* Whole objects only */
+    slab->limit = slab->bump + ((SLAB_SIZE - SLAB_HEADER_SIZE) / objectSize) * objectSize;
+    slab->live = 0;
+    slab->classIndex = (uint32_t)classIndex;
+    return slab;
+}
+
+static void* allocateObject(SlabAllocator* slabs, size_t size)
+{
+    int classIndex = (int)CLASS_OF(size);
+    SizeClass* sizeClass = &(slabs->classes[classIndex]);
+
+    Slab* slab = sizeClass->partial;
+    if (slab == NULL)
+    {
+        slab = newSlab(slabs, classIndex);
+        if (slab == NULL)
+        {
+            return NULL;
+        }
+        pushSlab(&(sizeClass->partial), slab);
+    }
+
+    void* object;
+    if (slab->freeList != NULL)
+    {
+        object = slab->freeList;
+        slab->freeList = *(void**)object;
+    }
+    else
+    {
+        object = slab->bump;
+        slab->bump += sizeClass->objectSize;
+    }
+    slab->live++;
+
+    if (slab->freeList == NULL && slab->bump == slab->limit)
+    {
+        unlinkSlab(&(sizeClass->partial), slab);
+        pushSlab(&(sizeClass->full), slab);
+    }
+    return object;
+}
+
+static void freeObject(SlabAllocator* slabs, void* object)
+{
+    Slab* slab = SLAB_OF(object);
+    SizeClass* sizeClass = &(slabs->classes[slab->classIndex]);
+
+    bool wasFull = (slab->freeList == NULL && slab->bump == slab->limit);
+    *(void**)object = slab->freeList;
+    slab->freeList = object;
+    slab->live--;
+
+    if (wasFull)
+    {
+        unlinkSlab(&(sizeClass->full), slab);
+        pushSlab(&(sizeClass->partial), slab);
+    }
+
+    if (slab->live == 0)
+    {
+        /* Empty: keep one around for the next burst, give the rest back to the OS */
+        unlinkSlab(&(sizeClass->partial), slab);
+        if (slabs->spare == NULL)
+        {
+            slabs->spare = slab;
+        }
+        else
+        {
+            unmapSlab(slabs, slab);
+        }
+    }
+}
+
+/*
+    Large objects live in the parent allocator, behind a LargeBlock. The block stays on the list until the parent
+    comes through: running out of memory unwinds right out of reallocateWith(), and freeSlabAllocator() must still find it
+*/
+static void* reallocateLarge(SlabAllocator* slabs, void* pointer, size_t oldSize, size_t newSize)
+{
+    LargeBlock* block = (pointer != NULL) ? (LargeBlock*)pointer - 1 : NULL;
+    LargeBlock* prev = (block != NULL) ? block->prev : NULL;
+    LargeBlock* next = (block != NULL) ? block->next : slabs->large;
+
+    size_t oldBlockSize = (pointer != NULL) ? sizeof(LargeBlock) + oldSize : 0;
+    size_t newBlockSize = (newSize > 0) ? sizeof(LargeBlock) + newSize : 0;
+    /* Through reallocateWith(), so large objects show up in the parent's stats with the rest of the heap */
+    block = reallocateWith(slabs->parent, MEM_OBJECTS, block, oldBlockSize, newBlockSize);
+    if (newBlockSize == 0)
+    {
+        /* Freed, the neighbours close ranks */
+        if (prev != NULL)
+        {
+            prev->next = next;
+        }
+        else
+        {
+            slabs->large = next;
+        }
+        if (next != NULL)
+        {
+            next->prev = prev;
+        }
+        return NULL;
+    }
+
+    /* New or moved, either way it takes the old one's place (or the head) */
+    block->size = newSize;
+    block->prev = prev;
+    block->next = next;
+    if (prev != NULL)
+    {
+        prev->next = block;
+    }
+    else
+    {
+        slabs->large = block;
+    }
+    if (next != NULL)
+    {
+        next->prev = block;
+    }
+    return block + 1;
+}
+
+static void* slabReallocate(Allocator* allocator, void* pointer, size_t oldSize, size_t newSize)
+{
+    /* allocator is the first member of the SlabAllocator */
+    SlabAllocator* slabs = (SlabAllocator*)allocator;
+    bool wasSmall = (pointer != NULL) && (oldSize <= SLAB_MAX_OBJECT);
+    bool small = (newSize > 0) && (newSize <= SLAB_MAX_OBJECT);
+
+    if (!wasSmall && !small)
+    {
+        /* Large to large (or large free) */
+        if (pointer == NULL && newSize == 0)
+        {
+            return NULL;
+        }
+        return reallocateLarge(slabs, pointer, oldSize, newSize);
+    }
+    if (wasSmall && small && CLASS_OF(oldSize) == CLASS_OF(newSize))
+    {
+        /* Still fits its slot */
+        return pointer;
+    }
+
+    void* result = NULL;
+    if (small)
+    {
+        result = allocateObject(slabs, newSize);
+    }
+    else if (newSize > 0)
+    {
+        result = reallocateLarge(slabs, NULL, 0, newSize);
+    }
+
+    if (pointer != NULL)
+    {
+        if (result != NULL)
+        {
+            memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+        }
+        if (wasSmall)
+        {
+            freeObject(slabs, pointer);
+        }
+        else
+        {
+            reallocateLarge(slabs, pointer, oldSize, 0);
+        }
+    }
+    return result;
+}
+
+void freeSlabAllocator(SlabAllocator* slabs)
+{
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+    {
+        Slab* lists[2] = { slabs->classes[i].partial, slabs->classes[i].full };
+        for (int j = 0; j < 2; j++)
+        {
+            Slab* slab = lists[j];
+            while (slab != NULL)
+            {
+                Slab* next = slab->next;
+                unmapSlab(slabs, slab);
+                slab = next;
+            }
+        }
+    }
+    if (slabs->spare != NULL)
+    {
+        unmapSlab(slabs, slabs->spare);
+    }
+    while (slabs->large != NULL)
+    {
+        LargeBlock* next = slabs->large->next;
+        reallocateWith(slabs->parent, MEM_OBJECTS, slabs->large, sizeof(LargeBlock) + slabs->large->size, 0);
+        slabs->large = next;
+    }
+    initSlabAllocator(slabs, slabs->parent);
+}
\ No newline at end of file
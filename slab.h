@@ -0,0 +1,70 @@
+#ifndef clox_slab_h
+#define clox_slab_h
+
+#include "common.h"
+#include "memory.h"
+
+/*
+    Slabs are SLAB_SIZE bytes and aligned to SLAB_SIZE, so the slab owning an object is found by masking its address.
+    Objects up to SLAB_MAX_OBJECT bytes are served from size classes 16 bytes apart, bigger ones go to the parent allocator
+*/
+#define SLAB_SIZE           0x10000
+#define SLAB_MAX_OBJECT     256
+#define SLAB_CLASS_COUNT    (SLAB_MAX_OBJECT / 16)
+#define CACHE_LINE_SIZE     64
+
+typedef struct Slab
+{
+    struct Slab* next;
+    struct Slab* prev;
+    /* Objects given back, reused before bumping */
+    void* freeList;
+    /* Never handed out yet */
+    char* bump;
+    char* limit;
+    uint32_t live;
+    uint32_t classIndex;
+} Slab;
+
+/* Header in front of every large object, so freeSlabAllocator() can drop them too */
+typedef struct LargeBlock
+{
+    struct LargeBlock* next;
+    struct LargeBlock* prev;
+    size_t size;
+    /* Keeps the object behind it 16-byte aligned */
+    size_t padding;
+} LargeBlock;
+
+typedef struct
+{
+    size_t objectSize;
+    /* Slabs with at least one free slot, we allocate from the head */
+    Slab* partial;
+    /* Kept so teardown can find them */
+    Slab* full;
+} SizeClass;
+
+/*
+    Pool allocator for the VM heap: small fixed-size objects are packed into cache-line aligned slabs per size class.
+    Each VM owns one and only its thread touches it, so the free lists need no locks (they are thread-local by construction).
+    A slab that empties goes back to the OS (one is kept as a spare), and freeSlabAllocator() releases
+    the whole heap slab by slab without looking at a single object.
+    Like Arena it IS an Allocator, allocate through it with reallocateWith(&slabs.allocator, MEM_OBJECTS, ...)
+*/
+typedef struct
+{
+    Allocator allocator;
+    /* For objects bigger than SLAB_MAX_OBJECT */
+    Allocator* parent;
+    LargeBlock* large;
+    SizeClass classes[SLAB_CLASS_COUNT];
+    Slab* spare;
+    size_t slabCount;
+} SlabAllocator;
+
+void initSlabAllocator(SlabAllocator* slabs, Allocator* parent);
+/* Drops every object at once, O(slabs + large objects) */
+void freeSlabAllocator(SlabAllocator* slabs);
+
+#endif
\ No newline at end of file
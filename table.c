@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "object.h"
+#include "table.h"
+
+/* Empty and deleted entries both have no key, a tombstone is told apart by its value */
+#define IS_TOMBSTONE(entry) ((entry)->key == NULL && AS_NUMBER((entry)->value) != 0)
+
+void initTable(Table* table, Allocator* allocator)
+{
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+    table->allocator = allocator;
+}
+
+void freeTable(Table* table)
+{
+    FREE_ARRAY(table->allocator, MEM_TABLES, Entry, table->entries, table->capacity);
+    initTable(table, table->allocator);
+}
+
+static Entry* findEntry(Entry* entries, int capacity, ObjString* key, uint32_t hash)
+{
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t index = hash & mask;
+    Entry* tombstone = NULL;
+
+    while (1)
+    {
+        Entry* entry = &entries[index];
+        if (entry->key == key)
+        {
+            return entry;
+        }
+        if (entry->key == NULL)
+        {
+            if (!IS_TOMBSTONE(entry))
+            {
+                /* Reuse the first tombstone we passed, if any */
+                return tombstone != NULL ? tombstone : entry;
+            }
+            if (tombstone == NULL)
+            {
+                tombstone = entry;
+            }
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void adjustCapacity(Table* table, int capacity)
+{
+    Entry* entries = GROW_ARRAY(table->allocator, MEM_TABLES, Entry, NULL, 0, capacity);
+    for (int i = 0; i < capacity; i++)
+    {
+        entries[i].key = NULL;
+        entries[i].hash = 0;
+        entries[i].value = NUMBER_VAL(0);
+    }
+
+    /* Tombstones are left behind, so count again */
+    table->count = 0;
+    for (int i = 0; i < table->capacity; i++)
+    {
+        Entry* entry = &(table->entries[i]);
+        if (entry->key == NULL)
+        {
+            continue;
+        }
+        Entry* destination = findEntry(entries, capacity, entry->key, entry->hash);
+        *destination = *entry;
+        table->count++;
+    }
+
+    FREE_ARRAY(table->allocator, MEM_TABLES, Entry, table->entries, table->capacity);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+bool tableGet(Table* table, ObjString* key, Value* value)
+{
+    if (table->count == 0)
+    {
+        return false;
+    }
+    Entry* entry = findEntry(table->entries, table->capacity, key, key->hash);
+    if (entry->key == NULL)
+    {
+        return false;
+    }
+    *value = entry->value;
+    return true;
+}
+
+bool tableSet(Table* table, ObjString* key, Value value)
+{
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    {
+        int capacity = table->capacity < TABLE_INITIAL_CAPACITY ? TABLE_INITIAL_CAPACITY : table->capacity * 2;
+        adjustCapacity(table, capacity);
+    }
+
+    Entry* entry = findEntry(table->entries, table->capacity, key, key->hash);
+    bool isNewKey = entry->key == NULL;
+    /* A reused tombstone is already counted */
+    if (isNewKey && !IS_TOMBSTONE(entry))
+    {
+        table->count++;
+    }
+    entry->key = key;
+    entry->hash = key->hash;
+    entry->value = value;
+    return isNewKey;
+}
+
+bool tableDelete(Table* table, ObjString* key)
+{
+    if (table->count == 0)
+    {
+        return false;
+    }
+    Entry* entry = findEntry(table->entries, table->capacity, key, key->hash);
+    if (entry->key == NULL)
+    {
+        return false;
+    }
+    entry->key = NULL;
+    entry->value = NUMBER_VAL(1);
+    return true;
+}
+
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash)
+{
+    if (table->count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t index = hash & mask;
+    while (1)
+    {
+        Entry* entry = &(table->entries[index]);
+        if (entry->key == NULL)
+        {
+            if (!IS_TOMBSTONE(entry))
+            {
+                return NULL;
+            }
+        }
+        else if (entry->hash == hash && entry->key->length == length &&
+                 memcmp(entry->key->chars, chars, length) == 0)
+        {
+            return entry->key;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void tableReplaceKey(Table* table, ObjString* key, ObjString* moved)
+{
+    if (table->count == 0)
+    {
+        return;
+    }
+    Entry* entry = findEntry(table->entries, table->capacity, key, key->hash);
+    if (entry->key == key)
+    {
+        entry->key = moved;
+    }
+}
+
+void tableRemoveWhite(Table* table)
+{
+    for (int i = 0; i < table->capacity; i++)
+    {
+        Entry* entry = &(table->entries[i]);
+        if (entry->key != NULL && !(entry->key->obj.flags & (OBJ_MARKED | OBJ_PERMANENT)))
+        {
+            entry->key = NULL;
+            entry->value = NUMBER_VAL(1);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "common.h"
+#include "memory.h"
+#include "value.h"
+
+#define TABLE_INITIAL_CAPACITY  0x8
+#define TABLE_MAX_LOAD          0.75
+
+typedef struct
+{
+    /* Interned, so two keys are the same key exactly when the pointers are */
+    ObjString* key;
+    /* Copy of key->hash, probing never has to touch the string */
+    uint32_t hash;
+    Value value;
+} Entry;
+
+/* Open addressing with linear probing, capacity is always a power of two */
+typedef struct
+{
+    int count;
+    int capacity;
+    Entry* entries;
+    Allocator* allocator;
+} Table;
+
+void initTable(Table* table, Allocator* allocator);
+void freeTable(Table* table);
+bool tableGet(Table* table, ObjString* key, Value* value);
+/* True if key is new */
+bool tableSet(Table* table, ObjString* key, Value value);
+bool tableDelete(Table* table, ObjString* key);
+/* The only lookup that compares characters, used for interning */
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+/* Same slot, new pointer: for the GC when it moves a key */
+void tableReplaceKey(Table* table, ObjString* key, ObjString* moved);
+/* Drops every entry whose key wasn't marked, for weak tables at the end of marking */
+void tableRemoveWhite(Table* table);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,370 @@
+/*
+    parseNumber() against strtod() on a corpus of lexemes, bit for bit: random digit strings, the exact values and
+    the halfway points of random doubles (subnormals too), overflow and underflow.
+    formatNumber() against known answers, then against printf() on random doubles and every power of two: every
+    output must parse back to the same bits and be the shortest and closest decimal that does, digit for digit
+
+    USAGE: ./tests/number_test [random doubles]
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../number.h"
+
+static int failures = 0;
+
+static void expect(double value, const char* expected)
+{
+    char buffer[NUMBER_BUFFER_SIZE + 1];
+    int length = formatNumber(value, buffer);
+    buffer[length] = '\0';
+    if (strcmp(buffer, expected) != 0)
+    {
+        printf("FAIL %.17g: got %s, expected %s\n", value, buffer, expected);
+        failures++;
+    }
+}
+
+/* Only the significant digits of text, e.g. "1.25e-07" -> "125" */
+static int significantDigits(const char* text, char* digits)
+{
+    int length = 0;
+    for (const char* c = text; *c != '\0' && *c != 'e'; c++)
+    {
+        if (*c >= '0' && *c <= '9' && (length > 0 || *c != '0'))
+        {
+            digits[length++] = *c;
+        }
+    }
+    while (length > 1 && digits[length - 1] == '0')
+    {
+        length--;
+    }
+    digits[length] = '\0';
+    return length;
+}
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t nextRandom()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/* Room for the 1075 fractional digits of a subnormal's halfway point, and the 309 integer digits of DBL_MAX */
+#define LEXEME_SIZE 1600
+
+static long parsed = 0;
+static long parseMismatches = 0;
+
+static void checkParse(const char* lexeme)
+{
+    /* parseNumber() gets exactly the lexeme, without the '\0' */
+    int length = (int)strlen(lexeme);
+    char* copy = malloc(length > 0 ? length : 1);
+    memcpy(copy, lexeme, length);
+    double ours = parseNumber(copy, length);
+    double theirs = strtod(lexeme, NULL);
+    free(copy);
+
+    parsed++;
+    if (memcmp(&ours, &theirs, sizeof(double)) != 0)
+    {
+        if (parseMismatches++ < 10)
+        {
+            printf("FAIL parse %.60s%s (%d bytes): got %.17g, strtod() %.17g\n", lexeme, length > 60 ? "..." : "",
+                   length, ours, theirs);
+        }
+    }
+}
+
+/* The exact decimal value of x, which the scanner could hand over: no exponent, no trailing zeros */
+static void exactLexeme(long double x, char* lexeme)
+{
+    snprintf(lexeme, LEXEME_SIZE, "%.1100Lf", x);
+    int length = (int)strlen(lexeme);
+    while (lexeme[length - 1] == '0')
+    {
+        length--;
+    }
+    if (lexeme[length - 1] == '.')
+    {
+        length--;
+    }
+    lexeme[length] = '\0';
+}
+
+/* value itself, the halfway point to the next double up and both sides of it */
+static void checkNeighbourhood(double value)
+{
+    char lexeme[LEXEME_SIZE + 2];
+    exactLexeme(value, lexeme);
+    checkParse(lexeme);
+
+    /* One more bit than a double, which a long double (64 bits) holds exactly. Past DBL_MAX this is where inf starts */
+    long double ulp = (long double)value - (long double)nextafter(value, 0);
+    if (nextafter(value, INFINITY) - value != INFINITY)
+    {
+        ulp = (long double)nextafter(value, INFINITY) - (long double)value;
+    }
+    long double halfway = (long double)value + ulp / 2;
+    exactLexeme(halfway, lexeme);
+    checkParse(lexeme);
+
+    int length = (int)strlen(lexeme);
+    char halfwayDigit = lexeme[length - 1];
+    if (strchr(lexeme, '.') != NULL)
+    {
+        /* Just above and just below, far past the 19 digits of the fast paths */
+        strcat(lexeme, "1");
+        checkParse(lexeme);
+        lexeme[length - 1] = '\0';
+        checkParse(lexeme);
+        /* Above by less than the 800th significant digit, only a sticky digit remembers it */
+        lexeme[length - 1] = halfwayDigit;
+        memset(lexeme + length, '0', 100);
+        strcpy(lexeme + length + 100, "1");
+        checkParse(lexeme);
+    }
+    else
+    {
+        strcat(lexeme, ".1");
+        checkParse(lexeme);
+    }
+}
+
+static void parseCorpus(long count)
+{
+    const char* fixed[] = {
+        "0", "0.0", "000", "0.000000", "1", "1.0", "007.2500", "0.1", "0.30000000000000004", "123456789012345678",
+        "1234567890123456789", "12345678901234567890", "18446744073709551615", "18446744073709551616",
+        "9007199254740992", "9007199254740993", "9007199254740993.0000000000000000001", "9007199254740995",
+        "2.2250738585072011", "2.2250738585072012", "0.4999999999999999722444243843710864894092082977294921875",
+        "1797693134862315708145274237317043567980705675258449965989174768031572607800285387605895586327668781715404"
+        "5895351438246423432132688946418276846754670353751698604991057655128207624549009038932894407586850845513394"
+        "2304583236903222948165808559332123348274797826204144723168738177180919299881250404026184124858368",
+        "1797693134862315807937289714053034150799341327100378269361737789804449682927647509466490179775872070963302"
+        "8641669288791094655554785194040263065748867150582068190890200070838367627385484581771153176447573027006985"
+        "099187464220453911506155680098464617963245712418224694306185574101127138658944802784780996044800"
+    };
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+    {
+        checkParse(fixed[i]);
+    }
+
+    const double edges[] = { 5e-324, 1e-323, 2.2250738585072009e-308, 2.2250738585072014e-308, 0.5, 1, 1e22, 1e23,
+                             9007199254740992.0, 1.7976931348623157e308 };
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    {
+        checkNeighbourhood(edges[i]);
+    }
+
+    char lexeme[LEXEME_SIZE + 2];
+    for (long i = 0; i < count; i++)
+    {
+        /* Any double, with subnormals a quarter of the time */
+        uint64_t bits = nextRandom() & 0x7FFFFFFFFFFFFFFFull;
+        if ((bits & 3) == 0)
+        {
+            bits &= 0x000FFFFFFFFFFFFFull;
+        }
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value - value == 0)
+        {
+            checkNeighbourhood(value);
+        }
+
+        /* Random digits, 1 to 40 of them, leading zeros and a point anywhere */
+        int length = 0;
+        int zeros = (int)(nextRandom() % 4);
+        int digits = 1 + (int)(nextRandom() % 40);
+        int point = (int)(nextRandom() % (zeros + digits + 1));
+        for (int d = 0; d < zeros + digits; d++)
+        {
+            if (d == point && d > 0)
+            {
+                lexeme[length++] = '.';
+            }
+            lexeme[length++] = d < zeros ? '0' : (char)('0' + nextRandom() % 10);
+        }
+        lexeme[length] = '\0';
+        checkParse(lexeme);
+
+        /* Exponent overflow and underflow: 1 and up to 30 digits, scaled around 10^308 and 10^-324 */
+        int scale = 280 + (int)(nextRandom() % 60);
+        digits = 1 + (int)(nextRandom() % 30);
+        length = 0;
+        for (int d = 0; d < digits; d++)
+        {
+            lexeme[length++] = (char)('1' + nextRandom() % 9);
+        }
+        memset(lexeme + length, '0', scale);
+        lexeme[length + scale] = '\0';
+        checkParse(lexeme);
+
+        length = snprintf(lexeme, sizeof(lexeme), "0.");
+        memset(lexeme + length, '0', scale + 20);
+        length += scale + 20;
+        for (int d = 0; d < digits; d++)
+        {
+            lexeme[length++] = (char)('1' + nextRandom() % 9);
+        }
+        lexeme[length] = '\0';
+        checkParse(lexeme);
+    }
+
+    printf("%ld lexemes: %ld parse differently from strtod()\n", parsed, parseMismatches);
+    if (parseMismatches > 0)
+    {
+        failures++;
+    }
+}
+
+static long wrong = 0;
+static long longer = 0;
+static long notClosest = 0;
+
+static bool parsesBack(uint64_t w, int q, double value)
+{
+    char text[40];
+    snprintf(text, sizeof(text), "%llue%d", (unsigned long long)w, q);
+    return strtod(text, NULL) == value;
+}
+
+/*
+    printf() rounds correctly, so "%.*e" is the closest decimal of each length. Of the decimals one unit away on
+    either side, at most one can also be in the rounding interval, and only when the closest is not
+*/
+static void shortestDecimal(double value, char* digits)
+{
+    char text[40];
+    for (int precision = 1; precision <= 17; precision++)
+    {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+        uint64_t w = 0;
+        const char* c = text;
+        for (; *c != 'e'; c++)
+        {
+            if (*c >= '0' && *c <= '9')
+            {
+                w = w * 10 + (uint64_t)(*c - '0');
+            }
+        }
+        int q = atoi(c + 1) - (precision - 1);
+        if (!parsesBack(w, q, value))
+        {
+            if (parsesBack(w + 1, q, value))
+            {
+                w++;
+            }
+            else if (w > 1 && parsesBack(w - 1, q, value))
+            {
+                w--;
+            }
+            else
+            {
+                continue;
+            }
+        }
+        snprintf(text, sizeof(text), "%llu", (unsigned long long)w);
+        significantDigits(text, digits);
+        return;
+    }
+}
+
+static void checkFormat(double value)
+{
+    char buffer[NUMBER_BUFFER_SIZE + 1];
+    buffer[formatNumber(value, buffer)] = '\0';
+    if (strtod(buffer, NULL) != value)
+    {
+        if (wrong++ < 10)
+        {
+            printf("FAIL %.17g: %s does not parse back\n", value, buffer);
+        }
+        return;
+    }
+
+    char ours[40], theirs[40];
+    int ourLength = significantDigits(buffer, ours);
+    shortestDecimal(fabs(value), theirs);
+    int theirLength = (int)strlen(theirs);
+    if (ourLength > theirLength || strcmp(ours, theirs) != 0)
+    {
+        if (longer + notClosest < 10)
+        {
+            printf("FAIL %.17g: %s, expected the digits %s\n", value, buffer, theirs);
+        }
+        if (ourLength > theirLength)
+        {
+            longer++;
+        }
+        else
+        {
+            notClosest++;
+        }
+    }
+}
+
+/* Every output parses back, none longer than the shortest, none farther than the closest */
+static void reportFormat()
+{
+    printf("%ld do not parse back, %ld longer than needed, %ld not the closest\n", wrong, longer, notClosest);
+    if (wrong > 0 || longer > 0 || notClosest > 0)
+    {
+        failures++;
+    }
+    wrong = 0;
+    longer = 0;
+    notClosest = 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    long count = argc > 1 ? atol(argv[1]) : 200000;
+
+    parseCorpus(count / 10);
+
+    expect(0.1 + 0.2, "0.30000000000000004");
+    expect(1e23, "1e+23");
+    expect(5e-324, "5e-324");
+    expect(0.1, "0.1");
+    expect(1.0 / 3, "0.3333333333333333");
+    expect(2.2250738585072014e-308, "2.2250738585072014e-308");
+    expect(1.7976931348623157e308, "1.7976931348623157e+308");
+    expect(123456, "123456");
+    expect(-1.5, "-1.5");
+
+    for (long i = 0; i < count; i++)
+    {
+        uint64_t bits = nextRandom();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value || value - value != 0)
+        {
+            /* nan and inf */
+            i--;
+            continue;
+        }
+        checkFormat(value);
+    }
+    printf("%ld random doubles: ", count);
+    reportFormat();
+
+    /* Powers of two have twice as much room above as below, the shortest may be the second closest decimal */
+    for (int exponent = -1074; exponent <= 1023; exponent++)
+    {
+        checkFormat(ldexp(1.0, exponent));
+    }
+    printf("%d powers of two: ", 1023 + 1074 + 1);
+    reportFormat();
+
+    printf("%s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
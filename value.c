@@ -1,11 +1,18 @@
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 
 void initValueArray(ValueArray* array)
+{
+    initValueArrayWith(array, &defaultAllocator);
+}
+
+void initValueArrayWith(ValueArray* array, Allocator* allocator)
 {
     array->count = 0;
     array->capacity = 0;
     array->values = NULL;
+    array->allocator = allocator;
 }
 
 void writeValueArray(ValueArray* array, Value value)
@@ -14,7 +21,7 @@ void writeValueArray(ValueArray* array, Value value)
     {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+        array->values = GROW_ARRAY(array->allocator, MEM_CONSTANTS, Value, array->values, oldCapacity, array->capacity);
     }
 
     array->values[array->count] = value;
@@ -23,11 +30,24 @@ void writeValueArray(ValueArray* array, Value value)
 
 void freeValueArray(ValueArray* array)
 {
-    FREE_ARRAY(Value, array->values, array->capacity);
-    initValueArray(array);
+    FREE_ARRAY(array->allocator, MEM_CONSTANTS, Value, array->values, array->capacity);
+    initValueArrayWith(array, array->allocator);
 }
 
-void printValue(Value value)
+void printValue(VM* vm, OutputBuffer* out, Value value)
 {
-    printf("%g", value);
+    switch (value.type)
+    {
+        case VAL_NUMBER:
+        {
+            /* Shortest text that reads back as the same double, see formatNumber() */
+            writeOutputNumber(out, AS_NUMBER(value));
+            break;
+        }
+        case VAL_OBJ:
+        {
+            printObject(vm, out, value);
+            break;
+        }
+    }
 }
\ No newline at end of file
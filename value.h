@@ -2,8 +2,39 @@
 #define clox_value_h
 
 #include "common.h"
+#include "memory.h"
+#include "output.h"
 
-typedef double Value;
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+/* The interpreter instance, see vm.h */
+typedef struct VM VM;
+
+typedef enum
+{
+    VAL_NUMBER,
+    /* Lives on the GC heap, see object.h */
+    VAL_OBJ
+} ValueType;
+
+typedef struct
+{
+    ValueType type;
+    union
+    {
+        double number;
+        Obj* obj;
+    } as;
+} Value;
+
+#define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
+#define IS_OBJ(value)       ((value).type == VAL_OBJ)
+
+#define AS_NUMBER(value)    ((value).as.number)
+#define AS_OBJ(value)       ((value).as.obj)
+
+#define NUMBER_VAL(value)   ((Value){ VAL_NUMBER, { .number = (value) } })
+#define OBJ_VAL(object)     ((Value){ VAL_OBJ, { .obj = (Obj*)(object) } })
 
 /*
     We'll put all constants in sort of a Value pool,
@@ -15,11 +46,15 @@ typedef struct
     int capacity;
     int count;
     Value* values;
+    Allocator* allocator;
 } ValueArray;
 
+/* Uses the default allocator */
 void initValueArray(ValueArray* array);
+void initValueArrayWith(ValueArray* array, Allocator* allocator);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
-void printValue(Value value);
+/* Objects may need vm, printing a rope flattens it */
+void printValue(VM* vm, OutputBuffer* out, Value value);
 
 #endif
\ No newline at end of file
@@ -1,194 +1,721 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "hash.h"
+#include "object.h"
 #include "vm.h"
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
-/* Global variable just to keep simple */
+/* Global variable just to keep simple, the old API works on it */
 VM vm;
 
-void initVM()
+/* The VM running or compiling on this thread, an allocation failure unwinds it */
+static _Thread_local VM* protectedVM = NULL;
+
+static InterpreterResult run(VM* vm);
+static void saveFiber(VM* vm);
+static bool switchFiber(VM* vm);
+static bool switchFiberMetered(VM* vm);
+static inline bool enterNextFiber(VM* vm);
+static void growStack(VM* vm);
+static Channel* channelOperand(VM* vm, Value value);
+static void waitForChannel(VM* vm, Channel* channel, bool sending);
+static void outOfMemory(size_t size);
+static void installOutOfMemoryHook();
+static void concatenate(VM* vm);
+static void BinaryOP(VM* vm, Opcode op);
+
+void initVMWith(VM* vm)
 {
-    vm.stackTop = vm.stack;
+    /* Its own copy, so stats of VMs on different threads don't race. Not a struct copy, other threads may be counting */
+    vm->systemAllocator = (Allocator){ .reallocate = defaultAllocator.reallocate, .userData = NULL };
+    vm->allocator = &(vm->systemAllocator);
+    /* No stack until a fiber runs, each has its own */
+    vm->stack = NULL;
+    vm->stackTop = NULL;
+    vm->stackCapacity = 0;
+    vm->ip = NULL;
+    initFiberTable(&(vm->fibers), vm->allocator);
+    initChannelTable(&(vm->channels), vm->allocator);
+    vm->inbox.chars = NULL;
+    initBudgetMeter(&(vm->budget), defaultBudget());
+    initArena(&(vm->compileArena), vm->allocator);
+    initSlabAllocator(&(vm->heap), vm->allocator);
+    initGC(vm);
+    initTable(&(vm->strings), vm->allocator);
+    vm->internLookups = 0;
+    vm->internHits = 0;
+    initChunkCache(&(vm->chunkCache), vm->allocator, CHUNK_CACHE_DEFAULT_LIMIT);
+    initFrozenTable(&(vm->frozenChunks), vm->allocator);
+    vm->chunk = NULL;
+    vm->slots = NULL;
+    vm->slotCount = 0;
+    vm->result = NUMBER_VAL(0);
+    vm->compiler = NULL;
+    initOutput(&(vm->out), stdout);
+    vm->errorHandler = NULL;
+    vm->error.kind = ERROR_NONE;
+    /* The hook is process wide and VMs start on many threads at once, only the first one sets it */
+    static pthread_once_t outOfMemoryHookOnce = PTHREAD_ONCE_INIT;
+    pthread_once(&outOfMemoryHookOnce, installOutOfMemoryHook);
 }
 
-void freeVM()
+void freeVMWith(VM* vm)
 {
+    flushOutput(&(vm->out));
+    freeArena(&(vm->compileArena));
+    freeChunkCache(&(vm->chunkCache));
+    freeFrozenTable(vm, &(vm->frozenChunks));
+    freeTable(&(vm->strings));
+    freeGC(vm);
+    freeSlabAllocator(&(vm->heap));
+    freeFiberTable(&(vm->fibers));
+    freeChannelTable(&(vm->channels));
+}
 
+void setVMAllocatorWith(VM* vm, Allocator* allocator)
+{
+    size_t cacheLimit = vm->chunkCache.limit;
+    freeArena(&(vm->compileArena));
+    freeChunkCache(&(vm->chunkCache));
+    freeFrozenTable(vm, &(vm->frozenChunks));
+    freeTable(&(vm->strings));
+    freeGC(vm);
+    freeSlabAllocator(&(vm->heap));
+    freeFiberTable(&(vm->fibers));
+    freeChannelTable(&(vm->channels));
+    vm->allocator = allocator;
+    initFiberTable(&(vm->fibers), allocator);
+    initChannelTable(&(vm->channels), allocator);
+    initArena(&(vm->compileArena), allocator);
+    initSlabAllocator(&(vm->heap), allocator);
+    initGC(vm);
+    initTable(&(vm->strings), allocator);
+    initChunkCache(&(vm->chunkCache), allocator, cacheLimit);
+    initFrozenTable(&(vm->frozenChunks), allocator);
 }
 
-InterpreterResult interpret(const char* source)
+
+InterpreterResult interpretWith(VM* vm, const char* source, size_t length)
 {
+    uint64_t hash = 0;
+    if (vm->chunkCache.limit > 0)
+    {
+        hash = hashBytes(source, length, 0);
+        Chunk* cached = lookupChunk(&(vm->chunkCache), source, length, hash);
+        if (cached != NULL)
+        {
+            /* No scanning, no compiling */
+            return runChunkWith(vm, cached);
+        }
+    }
+
+    /* Otherwise the chunk is run straight out of the arena, the cache keeps a copy of its own */
     Chunk chunk;
-    initChunk(&chunk);
+    initChunkWith(&chunk, &(vm->compileArena.allocator));
 
-    if (!compile(source, &chunk))
+    InterpreterResult result = INTERPRET_COMPILER_ERROR;
+    Compiler compiler;
+    if (compileWith(&compiler, vm, source, length, &chunk))
+    {
+        if (vm->chunkCache.limit > 0)
+        {
+            storeChunk(&(vm->chunkCache), source, length, hash, &chunk);
+        }
+        result = runChunkWith(vm, &chunk);
+    }
+
+    /* Frees code, constants and anything else the compile allocated in one go */
+    resetArena(&(vm->compileArena));
+    return result;
+}
+
+InterpreterResult interpretChunkWith(VM* vm, Chunk* chunk, const char* source, size_t length)
+{
+    Compiler compiler;
+    if (!compileWith(&compiler, vm, source, length, chunk))
     {
-        freeChunk(&chunk);
         return INTERPRET_COMPILER_ERROR;
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+    return runChunkWith(vm, chunk);
+}
+
+InterpreterResult interpretStreamWith(VM* vm, int fd)
+{
+    Chunk chunk;
+    initChunkWith(&chunk, &(vm->compileArena.allocator));
 
-    InterpreterResult result = run();
+    InterpreterResult result = INTERPRET_COMPILER_ERROR;
+    Compiler compiler;
+    if (compileStreamWith(&compiler, vm, fd, &chunk))
+    {
+        result = runChunkWith(vm, &chunk);
+    }
 
-    freeChunk(&chunk);
+    resetArena(&(vm->compileArena));
     return result;
 }
 
+InterpreterResult runChunkWith(VM* vm, Chunk* chunk)
+{
+    /* The script itself is fiber 0, whatever it spawns comes after it */
+    resetFiberTable(&(vm->fibers));
+    int script = newFiber(&(vm->fibers), chunk, chunk->code);
+    InterpreterResult result = runFibersWith(vm);
+    vm->result = result == INTERPRET_OK ? vm->fibers.fibers[script].result : NUMBER_VAL(0);
+    return result;
+}
+
+InterpreterResult runFrozenChunkWith(VM* vm, FrozenChunk* frozen)
+{
+    /* Counters and such go to the VM's side table, the chunk is shared */
+    FrozenUse* use = attachFrozenChunk(vm, &(vm->frozenChunks), frozen);
+    use->runs++;
+    return runChunkWith(vm, &(frozen->chunk));
+}
+
+int spawnFiberWith(VM* vm, Chunk* chunk)
+{
+    return newFiber(&(vm->fibers), chunk, chunk->code);
+}
+
+/* Back from panicWith(): note where it happened, then drop whatever the run left behind */
+static void recoverFromError(VM* vm)
+{
+    VMError* error = &(vm->error);
+    error->fiber = vm->fibers.current;
+    error->line = -1;
+    error->pos = -1;
+    error->stackDepth = 0;
+    if (vm->chunk != NULL && vm->ip > vm->chunk->code)
+    {
+        /* ip is past the opcode, any byte of the instruction has its position */
+        LineRun position = getLineRun(vm->chunk, (int)(vm->ip - vm->chunk->code) - 1);
+        error->line = position.line;
+        error->pos = position.pos;
+    }
+    if (error->fiber != FIBER_NONE)
+    {
+        /* Otherwise the registers may point to the stack of a fiber that is done and gone */
+        error->stackDepth = (int)(vm->stackTop - vm->stack);
+        for (int i = 0; i < error->stackDepth && i < ERROR_STACK_MAX; i++)
+        {
+            error->stack[i] = vm->stackTop[-1 - i];
+        }
+        saveFiber(vm);
+    }
+    resetFiberTable(&(vm->fibers));
+    freeMessage(&(vm->inbox));
+    /* It goes with the script's output, a server sends it back with the response */
+    printErrorWith(vm, &(vm->out));
+}
+
+InterpreterResult runFibersWith(VM* vm)
+{
+    if (vm->budget.enabled)
+    {
+        startBudgetMeter(&(vm->budget));
+    }
+    /* Nothing in run() checks for errors, panicWith() jumps straight back here */
+    ErrorHandler handler;
+    InterpreterResult result = INTERPRET_RUNTIME_ERROR;
+    enterProtectedWith(vm, &handler);
+    if (catchError(handler.jump) == 0)
+    {
+        result = switchFiber(vm) ? run(vm) : INTERPRET_OK;
+    }
+    else
+    {
+        result = INTERPRET_RUNTIME_ERROR;
+        recoverFromError(vm);
+    }
+    leaveProtectedWith(vm, &handler);
+    /* Nothing runs anymore, and the caller may be about to free the chunks, so they are no GC roots */
+    vm->chunk = NULL;
+    vm->ip = NULL;
+    vm->stack = NULL;
+    vm->stackTop = NULL;
+    vm->stackCapacity = 0;
+    return result;
+}
+
+Value fiberResultWith(VM* vm, int id)
+{
+    return vm->fibers.fibers[id].result;
+}
+
+void setBudgetWith(VM* vm, Budget budget)
+{
+    initBudgetMeter(&(vm->budget), budget);
+}
+
+/* The registers back into the running fiber, before it stops running */
+static void saveFiber(VM* vm)
+{
+    Fiber* fiber = &(vm->fibers.fibers[vm->fibers.current]);
+    fiber->chunk = vm->chunk;
+    fiber->ip = vm->ip;
+    fiber->stack = vm->stack;
+    fiber->stackTop = vm->stackTop;
+    fiber->stackCapacity = vm->stackCapacity;
+}
+
+/*
+    The scheduler: the next ready fiber goes into the registers, a switch is just that, no OS involved.
+    False when no fiber is ready, which is the end of the run unless some are still waiting.
+    Every switch is a checkpoint of the budget (see budget.h), out of line so runs without one pay a branch.
+    While the collector marks, the fiber stopping is marked here, so marking needn't look at its stack again
+*/
+static bool switchFiber(VM* vm)
+{
+    if (vm->gc.phase == GC_MARK)
+    {
+        gcStopFiber(vm, vm->fibers.current);
+    }
+    if (vm->budget.enabled)
+    {
+        return switchFiberMetered(vm);
+    }
+    return enterNextFiber(vm);
+}
+
+__attribute__((noinline)) static bool switchFiberMetered(VM* vm)
+{
+    FiberTable* fibers = &(vm->fibers);
+    if (!checkBudgetMeter(&(vm->budget), vm->ip, fibers->readyHead == FIBER_NONE))
+    {
+        /* The caller saved the fiber (or it is done), nothing is running */
+        fibers->current = FIBER_NONE;
+        panicWith(vm, budgetMessage(vm->budget.status));
+    }
+    bool switched = enterNextFiber(vm);
+    vm->budget.segmentStart = vm->ip;
+    return switched;
+}
+
+static inline bool enterNextFiber(VM* vm)
+{
+    FiberTable* fibers = &(vm->fibers);
+    int id = nextReadyFiber(fibers);
+    if (id == FIBER_NONE)
+    {
+        fibers->current = FIBER_NONE;
+        if (fibers->waitingCount > 0)
+        {
+            panicWith(vm, "Deadlock: every fiber left is waiting in join().");
+        }
+        return false;
+    }
+
+    Fiber* fiber = &(fibers->fibers[id]);
+    fiber->state = FIBER_RUNNING;
+    fibers->current = id;
+    fibers->switches++;
+    vm->chunk = fiber->chunk;
+    vm->ip = fiber->ip;
+    vm->stack = fiber->stack;
+    vm->stackTop = fiber->stackTop;
+    vm->stackCapacity = fiber->stackCapacity;
+    return true;
+}
+
 /*
-    The core of the VM, just execute code and manage IP
+    The core of the VM, just execute code and manage IP.
+    Out of line: inlined into runFibersWith() it gets compiled worse, about 10% on tiny scripts
 */
-static InterpreterResult run()
+__attribute__((noinline)) static InterpreterResult run(VM* vm)
 {
     while (1)
     {
         #ifdef DEBUG_TRACE_EXECUTION
             /* NOTE: second argument is the offset */
-            disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+            disassembleInstruction(vm, &(vm->out), vm->chunk, (int)(vm->ip - vm->chunk->code));
         #endif
         /* NOTE: Always point ip to the next byte */
-        switch(*(vm.ip++))
+        switch(*(vm->ip++))
         {
             case OP_RETURN:
             {
-                /* NOTE: Temp pop and print, will change later */
-                // printValue(pop());
-                DumpStack(DUMP_CONSOLE);
-                printf("\n");
-                return INTERPRET_OK;
+                #ifdef DEBUG_TRACE_EXECUTION
+                    dumpStackWith(vm, DUMP_CONSOLE);
+                    writeOutputChar(&(vm->out), '\n');
+                #endif
+                /* The value of the expression is the fiber's result, runChunkWith() hands the script's to the caller */
+                Value result = (vm->stackTop > vm->stack) ? popWith(vm) : NUMBER_VAL(0);
+                saveFiber(vm);
+                finishFiber(&(vm->fibers), vm->fibers.current, result);
+                if (!switchFiber(vm))
+                {
+                    return INTERPRET_OK;
+                }
+                break;
             }
             case OP_CONSTANT:
             {
-                int constantIndex = *(vm.ip++);
-                printf("OP_CONSTANT: Index %d\n", constantIndex);
-                printValue(vm.chunk->constants.values[constantIndex]);
-                printf("\n");
-                push((vm.chunk->constants.values)[constantIndex]);
+                int constantIndex = *(vm->ip++);
+                #ifdef DEBUG_TRACE_EXECUTION
+                    printOutput(&(vm->out), "OP_CONSTANT: Index %d\n", constantIndex);
+                    printValue(vm, &(vm->out), vm->chunk->constants.values[constantIndex]);
+                    writeOutputChar(&(vm->out), '\n');
+                #endif
+                pushWith(vm, (vm->chunk->constants.values)[constantIndex]);
                 break;
             }
             case OP_CONSTANT_LONG:
             {
-                int constantIndex = (*(vm.ip) << 16) + (*(vm.ip + 1) << 8) + *(vm.ip + 2);
-                printf("OP_CONSTANT_LONG: Index %d\n", constantIndex);
-                printValue(vm.chunk->constants.values[constantIndex]);
-                printf("\n");
-                push((vm.chunk->constants.values)[constantIndex]);
-                vm.ip += 3;
+                int constantIndex = (*(vm->ip) << 16) + (*(vm->ip + 1) << 8) + *(vm->ip + 2);
+                #ifdef DEBUG_TRACE_EXECUTION
+                    printOutput(&(vm->out), "OP_CONSTANT_LONG: Index %d\n", constantIndex);
+                    printValue(vm, &(vm->out), vm->chunk->constants.values[constantIndex]);
+                    writeOutputChar(&(vm->out), '\n');
+                #endif
+                pushWith(vm, (vm->chunk->constants.values)[constantIndex]);
+                vm->ip += 3;
+                break;
+            }
+            case OP_SLOT:
+            {
+                int slot = *(vm->ip++);
+                if (slot >= vm->slotCount)
+                {
+                    panicWith(vm, "No value for input slot.");
+                }
+                pushWith(vm, vm->slots[slot]);
+                break;
+            }
+            case OP_SPAWN:
+            {
+                /* The child's code follows inline and ends with its own OP_RETURN, the parent skips it */
+                int length = (*(vm->ip) << 8) + *(vm->ip + 1);
+                vm->ip += 2;
+                int id = newFiber(&(vm->fibers), vm->chunk, vm->ip);
+                vm->ip += length;
+                /* The child's code is charged to the child */
+                if (vm->budget.enabled)
+                {
+                    vm->budget.segmentStart += length;
+                }
+                pushWith(vm, NUMBER_VAL(id));
+                break;
+            }
+            case OP_YIELD:
+            {
+                /* The operand stays on the stack as the value of yield(). Nobody else ready, nothing to switch to */
+                if (vm->fibers.readyHead != FIBER_NONE)
+                {
+                    saveFiber(vm);
+                    readyFiber(&(vm->fibers), vm->fibers.current);
+                    switchFiber(vm);
+                }
+                break;
+            }
+            case OP_JOIN:
+            {
+                Value target = peekWith(vm, 0);
+                double number = IS_NUMBER(target) ? AS_NUMBER(target) : -1;
+                int id = (int)number;
+                if (number < 0 || number >= vm->fibers.count || id != number)
+                {
+                    panicWith(vm, "join() takes a fiber.");
+                }
+                Fiber* fiber = &(vm->fibers.fibers[id]);
+                if (fiber->state == FIBER_DONE)
+                {
+                    vm->stackTop[-1] = fiber->result;
+                    break;
+                }
+                /* Blocked: back onto OP_JOIN, it runs again once the fiber is done */
+                vm->ip--;
+                saveFiber(vm);
+                waitForFiber(&(vm->fibers), vm->fibers.current, id);
+                switchFiber(vm);
+                break;
+            }
+            case OP_SEND:
+            {
+                /* send(channel, value) is value, sent as a copy */
+                Channel* channel = channelOperand(vm, peekWith(vm, 1));
+                Message message;
+                if (!messageFromValue(vm, vm->stackTop - 1, &message))
+                {
+                    panicWith(vm, "Only numbers and strings can be sent.");
+                }
+                if (!trySendMessage(channel, &message))
+                {
+                    freeMessage(&message);
+                    waitForChannel(vm, channel, true);
+                    break;
+                }
+                vm->stackTop[-2] = vm->stackTop[-1];
+                vm->stackTop--;
+                break;
+            }
+            case OP_RECEIVE:
+            {
+                Channel* channel = channelOperand(vm, peekWith(vm, 0));
+                if (!tryReceiveMessage(channel, &(vm->inbox)))
+                {
+                    waitForChannel(vm, channel, false);
+                    break;
+                }
+                /* Popped only once the string is in this VM's heap, the channel id is harmless to the GC */
+                Value value = valueFromMessage(vm, &(vm->inbox));
+                vm->stackTop[-1] = value;
                 break;
             }
             /* Unary */
             case OP_NEGATE:
             {
+                if (!IS_NUMBER(*(vm->stackTop - 1)))
+                {
+                    panicWith(vm, "Operand must be a number.");
+                }
                 /* No need to push/pop, just mutate */
                 // push(-pop());
-                *(vm.stackTop - 1) = (*vm.stackTop - 1) * -1;
+                AS_NUMBER(*(vm->stackTop - 1)) = -AS_NUMBER(*(vm->stackTop - 1));
                 break;
             }
             /* Binary a op b */
             case OP_ADD:
             {
-                BinaryOP(OP_ADD);
+                if (IS_TEXT(peekWith(vm, 0)) && IS_TEXT(peekWith(vm, 1)))
+                {
+                    concatenate(vm);
+                }
+                else
+                {
+                    BinaryOP(vm, OP_ADD);
+                }
                 break;
             }
             case OP_SUB:
             {
-                BinaryOP(OP_SUB);
+                BinaryOP(vm, OP_SUB);
                 break;
             }
             case OP_MUL:
             {
-                BinaryOP(OP_MUL);
+                BinaryOP(vm, OP_MUL);
                 break;
             }
             case OP_DIV:
             {
-                BinaryOP(OP_DIV);
+                BinaryOP(vm, OP_DIV);
                 break;
             }
         }
     }
 }
 
-void push(Value value)
+static Channel* channelOperand(VM* vm, Value value)
 {
-    if ((int)(vm.stackTop - vm.stack) >= STACK_MAX)
+    double number = IS_NUMBER(value) ? AS_NUMBER(value) : -1;
+    int id = (int)number;
+    if (number < 0 || number >= vm->channels.count || id != number)
     {
-        panic("Stack overflow");
+        panicWith(vm, "Not a channel.");
     }
-    *(vm.stackTop) = value;
-    vm.stackTop ++;
+    return vm->channels.channels[id];
 }
 
-Value pop()
+/*
+    The channel is full (sending) or empty: the instruction runs again later. Other fibers ready to run get to first,
+    only a VM with nothing else to do blocks its thread on the channel, until the budget's deadline at most
+*/
+static void waitForChannel(VM* vm, Channel* channel, bool sending)
+{
+    vm->ip--;
+    if (vm->fibers.readyHead != FIBER_NONE)
+    {
+        saveFiber(vm);
+        readyFiber(&(vm->fibers), vm->fibers.current);
+        switchFiber(vm);
+        return;
+    }
+    uint64_t deadline = budgetDeadline(&(vm->budget));
+    bool inTime = sending ? waitToSend(channel, deadline) : waitToReceive(channel, deadline);
+    if (!inTime)
+    {
+        vm->budget.status = BUDGET_DEADLINE;
+        panicWith(vm, budgetMessage(BUDGET_DEADLINE));
+    }
+}
+
+void pushWith(VM* vm, Value value)
+{
+    if ((int)(vm->stackTop - vm->stack) >= vm->stackCapacity)
+    {
+        growStack(vm);
+    }
+    *(vm->stackTop) = value;
+    vm->stackTop ++;
+}
+
+/*
+    Fibers start with a small stack, it doubles whenever it fills up.
+    Kept out of line, so pushWith() stays small enough to be inlined into run() (30% on bench-cache)
+*/
+__attribute__((noinline)) static void growStack(VM* vm)
+{
+    if (vm->stackCapacity >= STACK_MAX)
+    {
+        panicWith(vm, "Stack overflow");
+    }
+    int count = (int)(vm->stackTop - vm->stack);
+    int capacity = vm->stackCapacity < FIBER_STACK_INITIAL ? FIBER_STACK_INITIAL : vm->stackCapacity * 2;
+    capacity = capacity < STACK_MAX ? capacity : STACK_MAX;
+    vm->stack = GROW_ARRAY(vm->allocator, MEM_VM_STACK, Value, vm->stack, vm->stackCapacity, capacity);
+    vm->stackTop = vm->stack + count;
+    vm->stackCapacity = capacity;
+}
+
+Value popWith(VM* vm)
 {
     /* Note: It's OK to reduce stackTop first, because it is always pointing to the next available index */
-    vm.stackTop --;
-    if (vm.stackTop < vm.stack)
+    vm->stackTop --;
+    if (vm->stackTop < vm->stack)
     {
         /* Stack underflow */
-        panic("pop(): Stack Underflow!\n");
+        panicWith(vm, "pop(): Stack Underflow!\n");
     }
-    return *(vm.stackTop);
+    return *(vm->stackTop);
 }
 
-Value peek()
+Value peekWith(VM* vm, int distance)
 {
-    /* Note: Fetch top stack item without removing it */
-    return *(vm.stackTop);
+    /* Note: Fetch a stack item without removing it, stackTop points past the top */
+    return vm->stackTop[-1 - distance];
 }
 
 /* Operations */
-static void BinaryOP(Opcode op)
+static void concatenate(VM* vm)
+{
+    /* Both stay on the stack until the result exists, it may collect */
+    Value result = concatenateText(vm, vm->stackTop - 2, vm->stackTop - 1);
+    popWith(vm);
+    popWith(vm);
+    pushWith(vm, result);
+}
+
+static void BinaryOP(VM* vm, Opcode op)
 {
-    Value rightOperand = pop();
-    Value leftOperand = pop();
+    /* Still on the stack if it panics, so the error shows them */
+    if (!IS_NUMBER(peekWith(vm, 1)) || !IS_NUMBER(peekWith(vm, 0)))
+    {
+        panicWith(vm, "Operands must be numbers.");
+    }
+    Value rightOperand = popWith(vm);
+    Value leftOperand = popWith(vm);
+    double right = AS_NUMBER(rightOperand);
+    double left = AS_NUMBER(leftOperand);
     
     switch(op)
     {
         case (OP_ADD):
         {
-            push(leftOperand + rightOperand);
+            pushWith(vm, NUMBER_VAL(left + right));
             break;
         }
         case (OP_SUB):
         {
-            push(leftOperand - rightOperand);
+            pushWith(vm, NUMBER_VAL(left - right));
             break;
         }
         case (OP_MUL):
         {
-            push(leftOperand * rightOperand);
+            pushWith(vm, NUMBER_VAL(left * right));
             break;
         }
         case (OP_DIV):
         {
-            push(leftOperand / rightOperand);
+            pushWith(vm, NUMBER_VAL(left / right));
             break;
         }
         default:
         {
-            printf("Unknown Binary OpCode %d\n", op);
+            printOutput(&(vm->out), "Unknown Binary OpCode %d\n", op);
         }
     }
 }
 
-void panic(char* panicMessage)
+__attribute__((noreturn)) static void raiseError(VM* vm, ErrorKind kind, const char* message)
 {
+    vm->error.kind = kind;
+    vm->error.message = message;
+    throwError(vm->errorHandler->jump);
+}
+
+void panicWith(VM* vm, const char* panicMessage)
+{
+    if (vm->errorHandler != NULL)
+    {
+        raiseError(vm, vm->compiler != NULL ? ERROR_COMPILE : ERROR_RUNTIME, panicMessage);
+    }
+    /* Whatever the script printed so far should still come out, and before the message */
+    flushOutput(&(vm->out));
     printf("%s\n", panicMessage);
-    /* TODO: Design different panic code */
     exit(1);
 }
 
-void DumpStack(DumpTarget target)
+static void outOfMemory(size_t size)
+{
+    (void)size;
+    if (protectedVM != NULL)
+    {
+        raiseError(protectedVM, ERROR_OUT_OF_MEMORY, "Out of memory.");
+    }
+}
+
+static void installOutOfMemoryHook()
+{
+    setOutOfMemoryHook(outOfMemory);
+}
+
+void enterProtectedWith(VM* vm, ErrorHandler* handler)
+{
+    handler->enclosing = vm->errorHandler;
+    handler->enclosingVM = protectedVM;
+    handler->rootCount = vm->gc.rootCount;
+    vm->errorHandler = handler;
+    protectedVM = vm;
+    vm->error.kind = ERROR_NONE;
+}
+
+void leaveProtectedWith(VM* vm, ErrorHandler* handler)
+{
+    vm->errorHandler = handler->enclosing;
+    protectedVM = handler->enclosingVM;
+    vm->gc.rootCount = handler->rootCount;
+}
+
+void printErrorWith(VM* vm, OutputBuffer* out)
+{
+    VMError* error = &(vm->error);
+    if (error->kind == ERROR_NONE)
+    {
+        return;
+    }
+    if (error->line >= 0)
+    {
+        printOutput(out, "%s [line %d, pos %d]\n", error->message, error->line, error->pos);
+    }
+    else
+    {
+        printOutput(out, "%s\n", error->message);
+    }
+}
+
+void dumpStackWith(VM* vm, DumpTarget target)
 {
     if (target == DUMP_CONSOLE)
     {
         /* Just print to terminal window */
         /* We want number of elements, list of elements in order, etc. */
-        printf("---------- BEGIN STACK DUMP ------------\n");
-        printf("Number of elements: %d\n", (int)(vm.stackTop - vm.stack));
+        printOutput(&(vm->out), "---------- BEGIN STACK DUMP ------------\n");
+        printOutput(&(vm->out), "Number of elements: %d\n", (int)(vm->stackTop - vm->stack));
 
         // for (int i = 0; i < (int)(vm.stackTop - vm.stack); i++)
         // {
@@ -198,19 +725,89 @@ void DumpStack(DumpTarget target)
         // }
 
         /* The book's version is much better */
-        for (Value* index = vm.stack; index < vm.stackTop; index++)
+        for (Value* index = vm->stack; index < vm->stackTop; index++)
         {
-            printf("Index %d ->", (int)(index - vm.stack));
-            printValue(*(index));
-            printf("\n");
+            printOutput(&(vm->out), "Index %d ->", (int)(index - vm->stack));
+            printValue(vm, &(vm->out), *(index));
+            writeOutputChar(&(vm->out), '\n');
         }
 
-        printf("Top of Stack ->\n");
+        printOutput(&(vm->out), "Top of Stack ->\n");
 
-        printf("---------- END STACK DUMP ------------\n");
+        printOutput(&(vm->out), "---------- END STACK DUMP ------------\n");
     }
     else if (target == DUMP_FILE)
     {
         /* Create and replace ./stack.dump */
     }
+}
+
+void initVM()
+{
+    initVMWith(&vm);
+}
+
+void freeVM()
+{
+    freeVMWith(&vm);
+}
+
+void setVMAllocator(Allocator* allocator)
+{
+    setVMAllocatorWith(&vm, allocator);
+}
+
+InterpreterResult interpret(const char* source, size_t length)
+{
+    return interpretWith(&vm, source, length);
+}
+
+InterpreterResult interpretChunk(Chunk* chunk, const char* source, size_t length)
+{
+    return interpretChunkWith(&vm, chunk, source, length);
+}
+
+InterpreterResult interpretStream(int fd)
+{
+    return interpretStreamWith(&vm, fd);
+}
+
+InterpreterResult runChunk(Chunk* chunk)
+{
+    return runChunkWith(&vm, chunk);
+}
+
+void setBudget(Budget budget)
+{
+    setBudgetWith(&vm, budget);
+}
+
+InterpreterResult runFrozenChunk(FrozenChunk* frozen)
+{
+    return runFrozenChunkWith(&vm, frozen);
+}
+
+void push(Value value)
+{
+    pushWith(&vm, value);
+}
+
+Value pop()
+{
+    return popWith(&vm);
+}
+
+Value peek(int distance)
+{
+    return peekWith(&vm, distance);
+}
+
+void panic(const char* panicMessage)
+{
+    panicWith(&vm, panicMessage);
+}
+
+void DumpStack(DumpTarget target)
+{
+    dumpStackWith(&vm, target);
 }
\ No newline at end of file
@@ -1,18 +1,129 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <setjmp.h>
+
+#include "arena.h"
+#include "budget.h"
+#include "cache.h"
+#include "channel.h"
 #include "chunk.h"
+#include "fiber.h"
+#include "frozen.h"
+#include "gc.h"
+#include "slab.h"
+#include "table.h"
 
+/* Deepest a fiber's stack grows, see FIBER_STACK_INITIAL */
 #define STACK_MAX 256
 
+typedef struct Compiler Compiler;
+
+/* Values of the stack kept in a VMError, from the top */
+#define ERROR_STACK_MAX 8
+
+typedef enum
+{
+    ERROR_NONE,
+    ERROR_COMPILE,
+    ERROR_RUNTIME,
+    /* The allocator gave up, possibly half way through a collection: free the VM, don't run it again */
+    ERROR_OUT_OF_MEMORY
+} ErrorKind;
+
+/* What went wrong in the last compile or run, see vm->error */
 typedef struct
 {
+    ErrorKind kind;
+    /* Static, panicWith() and errorAt() take literals */
+    const char* message;
+    /* Of the instruction (or token) at fault, -1 if there was none */
+    int line;
+    int pos;
+    /* FIBER_NONE if none was running, e.g. a deadlock */
+    int fiber;
+    /* The fiber's stack at the time: its depth, and the values on top. Strings live until the next run */
+    int stackDepth;
+    Value stack[ERROR_STACK_MAX];
+} VMError;
+
+/*
+    GCC's own setjmp only keeps the frame, the stack pointer and where to go on, at a third of the cost of setjmp().
+    Every run pays for one
+*/
+#if defined(__GNUC__)
+    typedef struct { void* registers[5]; } ErrorJump;
+    #define catchError(jump)    __builtin_setjmp((jump).registers)
+    #define throwError(jump)    __builtin_longjmp((jump).registers, 1)
+#else
+    typedef struct { jmp_buf registers; } ErrorJump;
+    #define catchError(jump)    setjmp((jump).registers)
+    #define throwError(jump)    longjmp((jump).registers, 1)
+#endif
+
+/* A run or compile in progress, errors unwind to the innermost one. See enterProtectedWith() */
+typedef struct ErrorHandler
+{
+    ErrorJump jump;
+    struct ErrorHandler* enclosing;
+    VM* enclosingVM;
+    /* C frames unwound by an error don't pop their GC roots, this is where to cut them back to */
+    int rootCount;
+} ErrorHandler;
+
+/*
+    Everything one interpreter instance owns. Instances share nothing, so each thread can run its own.
+    The ...With() functions take the instance explicitly, the old API (interpret(), push(), ...) works on the global vm
+*/
+struct VM
+{
+    /* Registers of the running fiber, see fibers. Only valid during a run */
     Chunk* chunk;
     uint8_t* ip;
-    /* Stack for e.g. expression evaluation */
-    Value stack[STACK_MAX];
+    /* Stack for e.g. expression evaluation, grown by pushWith() */
+    Value* stack;
     Value* stackTop;
-} VM;
+    int stackCapacity;
+    /* Green threads of the current run, switched at yield() and join() */
+    FiberTable fibers;
+    /* Channels to other VMs the host attached, what send() and receive() take */
+    ChannelTable channels;
+    /* A received message until it is in the heap, freed if that panics */
+    Message inbox;
+    /* Limits on every run, checked whenever fibers switch or the heap grows */
+    BudgetMeter budget;
+    /* Long-lived allocations come from here, hosts swap in their own with setVMAllocator() */
+    Allocator* allocator;
+    /* The default, malloc() like defaultAllocator but counting into this VM's own stats */
+    Allocator systemAllocator;
+    /* Scratch space of one interpret(), reset as soon as it returns */
+    Arena compileArena;
+    /* Heap objects, freed all at once by freeVM() */
+    SlabAllocator heap;
+    /* Decides when objects in the heap die, see gc.h */
+    GC gc;
+    /* Every live string, for interning. Weak, see gcTrackInterned() */
+    Table strings;
+    uint64_t internLookups;
+    uint64_t internHits;
+    /* Compiled chunks of sources interpret() has seen before */
+    ChunkCache chunkCache;
+    /* Frozen chunks this VM runs, and what it keeps about each of them */
+    FrozenTable frozenChunks;
+    /* What OP_SLOT i reads, set by the host before running a chunk compiled with compileSlotsWith() */
+    Value* slots;
+    int slotCount;
+    /* Value of the last expression run, set by OP_RETURN */
+    Value result;
+    /* The compile in progress, its constants are GC roots */
+    Compiler* compiler;
+    /* All output goes through here, see flushOutput() */
+    OutputBuffer out;
+    /* Where panicWith() unwinds to, NULL when nothing runs or compiles */
+    ErrorHandler* errorHandler;
+    /* Set by the last compile or run that failed, cleared by the next one */
+    VMError error;
+};
 
 typedef enum
 {
@@ -27,21 +138,78 @@ typedef enum
     DUMP_FILE
 } DumpTarget;
 
+/* The instance behind the old global API */
+extern VM vm;
+
+void initVMWith(VM* vm);
+void freeVMWith(VM* vm);
+/* Call before running anything, the compile arena, the heap and the GC move over to the new allocator too */
+void setVMAllocatorWith(VM* vm, Allocator* allocator);
+/* Runs straight from vm->chunkCache when source was compiled before */
+InterpreterResult interpretWith(VM* vm, const char* source, size_t length);
+/*
+    Compile into a caller-owned chunk and run it. The chunk is not freed,
+    so it can be resetChunk()'ed and reused for the next source
+*/
+InterpreterResult interpretChunkWith(VM* vm, Chunk* chunk, const char* source, size_t length);
+/* Compile from a stream (pipe, stdin) with bounded memory, then run */
+InterpreterResult interpretStreamWith(VM* vm, int fd);
+/* Run an already compiled chunk (e.g. from an image), the caller owns it */
+InterpreterResult runChunkWith(VM* vm, Chunk* chunk);
+/* Run a chunk shared with other VMs, see freezeChunk(). The VM holds a reference until freeVMWith() */
+InterpreterResult runFrozenChunkWith(VM* vm, FrozenChunk* frozen);
+/*
+    Host side of spawn(): a fiber that runs chunk from the start once runFibersWith() is called.
+    Returns its id, the caller keeps chunk alive until the fibers are done
+*/
+int spawnFiberWith(VM* vm, Chunk* chunk);
+/* Run every fiber to completion, cooperatively on this thread. runChunkWith() starts over with no fibers */
+InterpreterResult runFibersWith(VM* vm);
+/* The result of a finished fiber */
+Value fiberResultWith(VM* vm, int id);
+/*
+    Limits for every run from now on, see budget.h. A run over budget stops with INTERPRET_RUNTIME_ERROR,
+    vm->budget.status says which limit it hit, and the VM is good for the next run.
+    initVMWith() starts out with defaultBudget()
+*/
+void setBudgetWith(VM* vm, Budget budget);
+void pushWith(VM* vm, Value value);
+Value popWith(VM* vm);
+/* distance 0 is the top */
+Value peekWith(VM* vm, int distance);
+/*
+    A runtime error: fills vm->error and unwinds to the run (or compile) in progress, which returns
+    INTERPRET_RUNTIME_ERROR and leaves the VM ready for the next one. Like a kernel panic, exit(), outside of them
+*/
+__attribute__((noreturn)) void panicWith(VM* vm, const char* panicMessage);
+/*
+    Errors from here on unwind to handler, until leaveProtectedWith(). The catch has to happen in the frame that
+    stays, and setjmp() may only stand alone in a condition (C11 7.13.1.1):
+        enterProtectedWith(vm, &handler);
+        if (catchError(handler.jump) == 0) { ... } else { ... }
+        leaveProtectedWith(vm, &handler);
+*/
+void enterProtectedWith(VM* vm, ErrorHandler* handler);
+void leaveProtectedWith(VM* vm, ErrorHandler* handler);
+/* The error the last compile or run left in vm->error, one line with where it happened */
+void printErrorWith(VM* vm, OutputBuffer* out);
+/* For debugging */
+void dumpStackWith(VM* vm, DumpTarget target);
+
+/* The same on the global vm */
 void initVM();
 void freeVM();
-InterpreterResult interpret(const char* source);
-static InterpreterResult run();
+void setVMAllocator(Allocator* allocator);
+InterpreterResult interpret(const char* source, size_t length);
+InterpreterResult interpretChunk(Chunk* chunk, const char* source, size_t length);
+InterpreterResult interpretStream(int fd);
+InterpreterResult runChunk(Chunk* chunk);
+InterpreterResult runFrozenChunk(FrozenChunk* frozen);
+void setBudget(Budget budget);
 void push(Value value);
 Value pop();
-Value peek();
-
-/* Operations */
-static void BinaryOP(Opcode op);
-
-/* Like a kernel panic */
-void panic(char* panicMessage);
-
-/* For debugging */
+Value peek(int distance);
+__attribute__((noreturn)) void panic(const char* panicMessage);
 void DumpStack(DumpTarget target);
 
 #endif
\ No newline at end of file